@@ -1,9 +1,66 @@
 
 #include <GLFW/glfw3.h>
+#include <Flecs/GameWorld.h>
+#include <Profiler/Profiler.h>
+#include <Renderer/BenchmarkReport.h>
+#include <Renderer/FrustumCuller.h>
 #include <Renderer/Renderer.h>
+#include <Renderer/VertexWelder.h>
+#include <Renderer/WorkerPool.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * SelfishGame [--benchmark <frames>] [--warmup <frames>] [--output <file.json>] [--trace-threshold <ms>]
+ *             [--present-mode immediate|mailbox|fifo|relaxed] [--frames-in-flight <1-4>]
+ *             [--swapchain-images <count>] [--fps-limit <fps>] [--mipmaps on|off] [--anisotropy <samples>]
+ *             [--texture-budget <MB>] [--lod-error <pixels>] [--weld-benchmark <triangles>]
+ *             [--cull-benchmark <spheres>] [--verify-culling on|off]
+ *
+ * --benchmark renders the given number of frames headless with a fixed time step and writes the CPU and GPU
+ * frame time statistics as JSON, to the console or to the --output file. The --warmup frames (default 30) before
+ * them aren't measured. No window is needed, but it is the same Windows executable as the game, PhysX and FBX SDK
+ * included. With --verify-culling on every frame's GPU culling is read back and compared with the same culling on
+ * the CPU, the exit code is 1 if any frame differs.
+ *
+ * F11 writes a Chrome trace of the last 60 frames to trace_<n>.json. With --trace-threshold a trace of the last
+ * frames is also written whenever a frame takes longer than the given number of milliseconds.
+ *
+ * The frame pacing options trade throughput for input latency, see FramePacingSettings. Present mode, image count
+ * and the fps limit can also be changed at runtime in the "Frame Pacing" window.
+ *
+ * --mipmaps off and --anisotropy 1 turn off texture mips and anisotropic filtering, to compare benchmark runs.
+ * --texture-budget limits the device memory of the streamed texture mips (default 256 MB).
+ * --lod-error is how many pixels a mesh LOD may deviate from the full detail mesh on screen (default 1, 0 = no LODs).
+ * --weld-benchmark welds a generated mesh with that many triangles the way the FBX importer does and exits.
+ * --cull-benchmark frustum culls that many random spheres with every CPU path, checks them against the scalar one,
+ * compares the fastest single core path with the target and exits, with 1 if a path disagrees.
+ */
+struct BenchmarkSettings
+{
+    uint32_t frameCount = 0; // 0 = run the game in a window
+    uint32_t warmupFrameCount = 30;
+    std::string outputPath;
+    bool verifyCulling = false;
+
+    static constexpr uint32_t Width = 1280;
+    static constexpr uint32_t Height = 720;
+    static constexpr float FrameSeconds = 1.0f / 60.0f;
+};
 
 class Application {
 public:
+    Application(const FramePacingSettings& pacing, const TextureSettings& textures, float lodErrorPixels) : m_pacing(pacing)
+    {
+        m_renderer.SetTextureSettings(textures);
+        m_renderer.SetLodErrorPixels(lodErrorPixels);
+    }
+
     void Run()
     {
         InitWindow();
@@ -12,6 +69,86 @@ public:
         Cleanup();
     }
 
+    // False if the GPU culling was verified and didn't match
+    bool RunBenchmark(const BenchmarkSettings& settings)
+    {
+        m_gameWorld.Initialize();
+        m_gameWorld.CreateWorld();
+
+        m_renderer.SetVerifyGpuCulling(settings.verifyCulling);
+        m_renderer.InitHeadless(m_gameWorld, { BenchmarkSettings::Width, BenchmarkSettings::Height },
+            BenchmarkSettings::FrameSeconds, m_pacing);
+
+        std::vector<double> cpuFrameTimesMs;
+        cpuFrameTimesMs.reserve(settings.frameCount);
+
+        const uint32_t totalFrameCount = settings.warmupFrameCount + settings.frameCount;
+        for (uint32_t frame = 0; frame < totalFrameCount; ++frame)
+        {
+            Profiler::MarkFrame();
+            const auto startTime = std::chrono::high_resolution_clock::now();
+
+            m_gameWorld.Update(BenchmarkSettings::FrameSeconds);
+            m_renderer.DrawFrame();
+
+            const auto endTime = std::chrono::high_resolution_clock::now();
+            if (frame >= settings.warmupFrameCount)
+            {
+                cpuFrameTimesMs.push_back(std::chrono::duration<double, std::milli>(endTime - startTime).count());
+            }
+        }
+
+        m_renderer.OnExitMainLoop();
+
+        // One GPU time per submitted frame, unless there are no timestamps at all
+        std::vector<double> gpuFrameTimesMs = m_renderer.GetGpuFrameTimesMs();
+        if (gpuFrameTimesMs.size() >= totalFrameCount)
+        {
+            gpuFrameTimesMs.erase(gpuFrameTimesMs.begin(), gpuFrameTimesMs.begin() + settings.warmupFrameCount);
+        }
+        else
+        {
+            gpuFrameTimesMs.clear();
+        }
+
+        BenchmarkReport report;
+        report.deviceName = m_renderer.GetDeviceName();
+        report.width = m_renderer.GetExtent().width;
+        report.height = m_renderer.GetExtent().height;
+        report.warmupFrameCount = settings.warmupFrameCount;
+        report.mipmaps = m_renderer.GetTextureSettings().mipmaps;
+        report.maxAnisotropy = m_renderer.GetTextureSettings().maxAnisotropy;
+        report.textureMemoryBytes = m_renderer.GetTextureMemorySize();
+        report.pipelineColdMs = m_renderer.GetPipelineColdMs();
+        report.pipelineWarmMs = m_renderer.GetPipelineWarmMs();
+        report.cpu = SummarizeFrameTimes(cpuFrameTimesMs);
+        report.gpu = SummarizeFrameTimes(gpuFrameTimesMs);
+
+        if (settings.outputPath.empty())
+        {
+            WriteBenchmarkReport(report, std::cout);
+        }
+        else
+        {
+            std::ofstream file(settings.outputPath);
+            WriteBenchmarkReport(report, file);
+            std::cout << "Benchmark results written to " << settings.outputPath << std::endl;
+        }
+
+        const uint32_t verifiedCount = m_renderer.GetGpuCullingVerifiedCount();
+        const uint32_t mismatchCount = m_renderer.GetGpuCullingMismatchCount();
+        if (settings.verifyCulling)
+        {
+            std::cout << "GPU culling: " << verifiedCount << " frames compared with the CPU, " << mismatchCount << " differ"
+                << std::endl;
+        }
+
+        m_renderer.Cleanup();
+
+        // Nothing compared fails too, the test would pass without testing anything
+        return !settings.verifyCulling || (verifiedCount > 0 && mismatchCount == 0);
+    }
+
 private:
     void InitWindow()
     {
@@ -23,14 +160,48 @@ private:
 
     void InitVulkan()
     {
-        m_renderer.Init(m_window);
+        m_gameWorld.Initialize();
+        m_gameWorld.CreateWorld();
+
+        m_renderer.Init(m_window, m_gameWorld, m_pacing);
     }
 
     void MainLoop()
     {
+        auto lastTime = std::chrono::high_resolution_clock::now();
+
+        bool captureKeyWasDown = false;
+
         while (!glfwWindowShouldClose(m_window)) 
         {
-            glfwPollEvents();
+            Profiler::MarkFrame();
+            PROFILE_ZONE("Application::MainLoop");
+
+            // Input is sampled as late as the frame rate limit allows
+            m_renderer.GetFramePacer().WaitForNextFrame();
+            if (m_renderer.IsMinimized())
+            {
+                // Nothing is drawn, don't spin. The game world keeps ticking.
+                glfwWaitEventsTimeout(0.01);
+            }
+            else
+            {
+                glfwPollEvents();
+            }
+            m_renderer.GetFramePacer().MarkInputSampled();
+
+            const bool captureKeyDown = glfwGetKey(m_window, GLFW_KEY_F11) == GLFW_PRESS;
+            if (captureKeyDown && !captureKeyWasDown)
+            {
+                Profiler::RequestCapture();
+            }
+            captureKeyWasDown = captureKeyDown;
+
+            const auto currentTime = std::chrono::high_resolution_clock::now();
+            const float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count();
+            lastTime = currentTime;
+
+            m_gameWorld.Update(deltaTime);
             m_renderer.DrawFrame();
         }
 
@@ -45,14 +216,133 @@ private:
         glfwTerminate();
     }
 
+    // Declared before the renderer, the renderer's queries must go away before the world
+    GameWorld m_gameWorld;
     Renderer m_renderer;
 
-    GLFWwindow* m_window;
+    FramePacingSettings m_pacing;
+
+    GLFWwindow* m_window = nullptr;
 };
 
-int main()
+int main(int argc, char** argv)
 {
-    Application app;
-    app.Run();
+    Profiler::SetThreadName("main");
+
+    BenchmarkSettings benchmark;
+    FramePacingSettings pacing;
+    TextureSettings textures;
+    float lodErrorPixels = 1.0f;
+    uint32_t weldBenchmarkTriangles = 0;
+    uint32_t cullBenchmarkSpheres = 0;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--benchmark") == 0)
+        {
+            benchmark.frameCount = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--warmup") == 0)
+        {
+            benchmark.warmupFrameCount = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--verify-culling") == 0)
+        {
+            benchmark.verifyCulling = strcmp(argv[i + 1], "on") == 0;
+        }
+        else if (strcmp(argv[i], "--output") == 0)
+        {
+            benchmark.outputPath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--trace-threshold") == 0)
+        {
+            Profiler::SetCaptureThreshold(std::strtod(argv[i + 1], nullptr));
+        }
+        else if (strcmp(argv[i], "--present-mode") == 0)
+        {
+            if (!ParsePresentMode(argv[i + 1], pacing.presentMode))
+            {
+                std::cout << "Unknown present mode " << argv[i + 1] << std::endl;
+            }
+        }
+        else if (strcmp(argv[i], "--frames-in-flight") == 0)
+        {
+            pacing.framesInFlight = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--swapchain-images") == 0)
+        {
+            pacing.swapChainImageCount = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--fps-limit") == 0)
+        {
+            pacing.frameRateLimit = std::strtod(argv[i + 1], nullptr);
+        }
+        else if (strcmp(argv[i], "--mipmaps") == 0)
+        {
+            textures.mipmaps = strcmp(argv[i + 1], "off") != 0;
+        }
+        else if (strcmp(argv[i], "--anisotropy") == 0)
+        {
+            textures.maxAnisotropy = std::strtof(argv[i + 1], nullptr);
+        }
+        else if (strcmp(argv[i], "--texture-budget") == 0)
+        {
+            textures.streamingBudgetMB = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--lod-error") == 0)
+        {
+            lodErrorPixels = std::strtof(argv[i + 1], nullptr);
+        }
+        else if (strcmp(argv[i], "--weld-benchmark") == 0)
+        {
+            weldBenchmarkTriangles = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--cull-benchmark") == 0)
+        {
+            cullBenchmarkSpheres = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+    }
+
+    if (weldBenchmarkTriangles > 0)
+    {
+        const WeldingBenchmarkResult result = VertexWelder::RunBenchmark(weldBenchmarkTriangles);
+        const auto trianglesPerSecond = [&](double ms) { return ms > 0.0 ? result.triangleCount / (ms * 1000.0) : 0.0; };
+        std::cout << result.triangleCount << " triangles welded into " << result.uniqueVertexCount << " vertices" << std::endl;
+        std::cout << "scalar        " << result.scalarMs << " ms, " << trianglesPerSecond(result.scalarMs) << " M triangles/s" << std::endl;
+        std::cout << "SSE           " << result.sseMs << " ms, " << trianglesPerSecond(result.sseMs) << " M triangles/s" << std::endl;
+        std::cout << "unordered_map " << result.unorderedMapMs << " ms, " << trianglesPerSecond(result.unorderedMapMs) << " M triangles/s" << std::endl;
+        return 0;
+    }
+
+    if (cullBenchmarkSpheres > 0)
+    {
+        WorkerPool workerPool;
+        workerPool.Init();
+        const CullingBenchmarkResult result = FrustumCuller::RunBenchmark(&workerPool, cullBenchmarkSpheres);
+        workerPool.Release();
+
+        const auto matches = [](bool match) { return match ? "" : ", DOES NOT MATCH scalar"; };
+        std::cout << result.sphereCount << " spheres, " << result.visibleCount << " visible" << std::endl;
+        std::cout << "scalar   " << result.scalarMs << " ms" << std::endl;
+        std::cout << "SSE      " << result.sseMs << " ms" << matches(result.sseMatches) << std::endl;
+        std::cout << "AVX2     " << result.avx2Ms << " ms" << matches(result.avx2Matches) << std::endl;
+        std::cout << "parallel " << result.parallelMs << " ms on " << result.workerThreadCount + 1 << " threads"
+            << matches(result.parallelMatches) << std::endl;
+
+        const double bestMs = result.GetBestSingleCoreMsPerMillionSpheres();
+        const double targetMs = CullingBenchmarkResult::TargetMsPerMillionSpheres;
+        std::cout << "single core " << bestMs << " ms per 1M spheres, target under " << targetMs << " ms: "
+            << (bestMs < targetMs ? "met" : "MISSED by " + std::to_string(bestMs - targetMs) + " ms") << std::endl;
+        return result.AllPathsMatch() ? 0 : 1;
+    }
+
+    Application app(pacing, textures, lodErrorPixels);
+    if (benchmark.frameCount > 0)
+    {
+        return app.RunBenchmark(benchmark) ? 0 : 1;
+    }
+    else
+    {
+        app.Run();
+    }
     return 0;
 }
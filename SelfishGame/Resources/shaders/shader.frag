@@ -1,13 +1,24 @@
-
 #version 450
 
+// Compiled twice: as is for devices with descriptor indexing, with -DTEXTURE_TABLE_FALLBACK for the others.
+// See BindlessTextureTable.
+#ifdef TEXTURE_TABLE_FALLBACK
+    #define TEXTURE_COUNT 16 // BindlessTextureTable::FallbackTextureCount
+    #define TEXTURE_INDEX(index) (index) // has to be the same for the whole draw
+#else
+    #extension GL_EXT_nonuniform_qualifier : require
+    #define TEXTURE_COUNT
+    #define TEXTURE_INDEX(index) nonuniformEXT(index) // instances of one draw can use different textures
+#endif
+
 // Uniforms
-layout(binding = 1) uniform sampler2D texSampler;
+layout(set = 1, binding = 0) uniform sampler2D textures[TEXTURE_COUNT];
 
 layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) flat in uint fragTextureIndex;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    outColor = texture(textures[TEXTURE_INDEX(fragTextureIndex)], fragTexCoord);
 }
@@ -3,19 +3,26 @@
 
 // Uniforms ////
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
-// Inputs
+// Inputs, quantized to the mesh's bounds with compact vertex layouts (GpuVertex), the fetch converts them to float
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inTexCoord;
 
+// Per instance inputs, cull.comp folded the mesh's dequantization into them
+layout(location = 2) in vec4 inPositionAndScale;  // xyz world position, w uniform scale
+layout(location = 3) in uint inTextureIndex;       // slot in the texture table
+layout(location = 4) in vec3 inTexCoordDequantize; // xy offset, z scale
+
 // Outputs
 layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) flat out uint fragTextureIndex;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragTexCoord = inTexCoord; // values will be smoothly interpolated
+    vec3 worldPosition = inPosition * inPositionAndScale.w + inPositionAndScale.xyz;
+    gl_Position = ubo.proj * ubo.view * vec4(worldPosition, 1.0);
+    fragTexCoord = inTexCoordDequantize.xy + inTexCoord * inTexCoordDequantize.z; // values will be smoothly interpolated
+    fragTextureIndex = inTextureIndex;
 }
@@ -2,6 +2,7 @@
 #include "GameWorld.h"
 
 #include <ImGui/imgui.h>
+#include <Profiler/Profiler.h>
 
 #include "PhysicsWorld/PhysxWorld.h"
 
@@ -10,6 +11,25 @@ void GameWorld::Initialize()
 {
     m_world.set<WorldTime>({ 0.f });
 
+    // A system is complete once its poly is set. The observer runs with the system's table locked, so the profiled
+    // run action is installed later by Update. yield_existing covers the systems of the flecs modules, and of anyone
+    // who created systems before this.
+    m_world.observer<>("Profile Systems")
+        .term(ecs_id(EcsPoly), flecs::System)
+        .event(flecs::OnSet)
+        .yield_existing()
+        .iter([this](flecs::iter& it)
+            {
+                if (m_installingProfiledRun)
+                {
+                    return;
+                }
+                for (auto i : it)
+                {
+                    m_unprofiledSystems.push_back(it.entity(i));
+                }
+            });
+
     m_world.system<Position, OscillatorOffset, const Mesh>("Move Mesh")
         .each([](const flecs::entity& e, Position& p, OscillatorOffset& offset, const Mesh&)
             {
@@ -50,14 +70,56 @@ void GameWorld::CreateWorld()
 
 void GameWorld::Update(float deltaTime)
 {
+    PROFILE_ZONE("GameWorld::Update");
+
     m_lastFrameTime = deltaTime;
 
     const WorldTime* worldTime = m_world.get<WorldTime>();
     m_world.set<WorldTime>({ worldTime->timeSinceStart + deltaTime });
 
+    InstallProfiledSystemRun();
+
     const bool result = m_world.progress(deltaTime);
 }
 
+void GameWorld::ProfiledSystemRun(ecs_iter_t* it)
+{
+    // System names live as long as the system entities, long enough for captures
+    const char* name = ecs_get_name(it->world, it->system);
+    PROFILE_ZONE(name ? name : "unnamed system");
+
+    // Like the default runner: a system without fields runs once per frame, not once per matched table
+    if (it->field_count == 0)
+    {
+        it->callback(it);
+        ecs_iter_fini(it);
+        return;
+    }
+
+    while (ecs_iter_next(it))
+    {
+        it->callback(it);
+    }
+}
+
+void GameWorld::InstallProfiledSystemRun()
+{
+    // Updating a system sets its poly again, the observer has to ignore that
+    m_installingProfiledRun = true;
+    for (flecs::entity_t system : m_unprofiledSystems)
+    {
+        if (m_world.is_alive(system))
+        {
+            ecs_system_desc_t desc{};
+            desc.entity = system;
+            desc.run = ProfiledSystemRun;
+            ecs_system_init(m_world, &desc);
+        }
+    }
+    m_unprofiledSystems.clear();
+    m_installingProfiledRun = false;
+}
+
 void GameWorld::DrawImGui()
 {
     ImGui::SetNextWindowSize(ImVec2(250, 100));
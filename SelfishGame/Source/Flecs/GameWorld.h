@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "flecs.h"
+#include <vector>
 
 struct Position
 {
@@ -16,7 +17,8 @@ struct OscillatorOffset
 };
 
 struct Mesh
-{    
+{
+    uint32_t meshIndex = 0; // which of the loaded meshes to draw
 };
 
 struct WorldTime
@@ -36,8 +38,18 @@ public:
 
     void DrawImGui();
 
+    // Run action of every system, iterates as flecs would but inside a profiler zone named after the system.
+    // Installed on all systems, also the ones created after Initialize, before their first run. Replaces any run
+    // action they were given.
+    static void ProfiledSystemRun(ecs_iter_t* it);
+
     flecs::world m_world;
 
 private:
+    void InstallProfiledSystemRun();
+
     float m_lastFrameTime = 0.f;
+
+    std::vector<flecs::entity_t> m_unprofiledSystems; // found by the observer, installed by Update
+    bool m_installingProfiledRun = false;
 };
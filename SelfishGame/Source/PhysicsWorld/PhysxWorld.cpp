@@ -4,6 +4,7 @@
 #include <cassert>
 
 #include "Flecs/GameWorld.h"
+#include "Profiler/Profiler.h"
 
 
 PhysxWorld::~PhysxWorld()
@@ -102,6 +103,8 @@ void PhysxWorld::Initialize(GameWorld& world)
 
 void PhysxWorld::Update(float deltaSeconds)
 {
+    PROFILE_ZONE("PhysxWorld::Update");
+
     if (deltaSeconds > 1.f/60.f)
     {
         deltaSeconds = 1.f/60.f;
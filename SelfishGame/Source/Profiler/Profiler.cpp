@@ -0,0 +1,258 @@
+#include "Profiler.h"
+
+#if SELFISH_PROFILER_ENABLED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Profiler
+{
+    namespace
+    {
+        struct Event
+        {
+            const char* name;
+            uint64_t beginNs;
+            uint64_t endNs;
+        };
+
+        /*
+         * One slot of the ring, a seqlock. The owner sets sequence to 0, writes the fields and then publishes
+         * sequence = event index + 1. A capture on another thread reads the fields between two reads of sequence and
+         * keeps the event only if both were index + 1. The fields are atomics, so a read that overlaps a write is
+         * discarded instead of being a data race.
+         */
+        struct EventSlot
+        {
+            std::atomic<uint64_t> sequence{ 0 };
+            std::atomic<const char*> name{ nullptr };
+            std::atomic<uint64_t> beginNs{ 0 };
+            std::atomic<uint64_t> endNs{ 0 };
+
+            void Write(uint64_t index, const Event& event)
+            {
+                sequence.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                name.store(event.name, std::memory_order_relaxed);
+                beginNs.store(event.beginNs, std::memory_order_relaxed);
+                endNs.store(event.endNs, std::memory_order_relaxed);
+                sequence.store(index + 1, std::memory_order_release);
+            }
+
+            // False if the slot doesn't hold event index (anymore), or it was overwritten while being read
+            bool Read(uint64_t index, Event& event) const
+            {
+                if (sequence.load(std::memory_order_acquire) != index + 1)
+                {
+                    return false;
+                }
+                event = { name.load(std::memory_order_relaxed), beginNs.load(std::memory_order_relaxed),
+                    endNs.load(std::memory_order_relaxed) };
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return sequence.load(std::memory_order_relaxed) == index + 1;
+            }
+        };
+
+        /*
+         * Single producer ring buffer: only the owning thread writes, captures copy from it on another thread.
+         * The write index is published after the event, it bounds what a capture looks at, the slots themselves
+         * tell which of those events are still intact.
+         */
+        struct ThreadBuffer
+        {
+            static constexpr uint64_t Capacity = 1 << 16; // power of two
+
+            EventSlot events[Capacity];
+            std::atomic<uint64_t> writeIndex{ 0 };
+            uint32_t threadId = 0;
+            std::string name; // guarded by the registry mutex
+        };
+
+        struct Registry
+        {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<ThreadBuffer>> threads; // never shrinks, threads may exit with events left
+
+            // Written by the main thread only
+            uint64_t frameStartNs[MaxCaptureFrames] = {};
+            uint64_t frameCount = 0;
+            uint32_t requestedCaptureFrames = 0;
+            double captureThresholdMs = 0.0;
+            uint32_t captureCount = 0;
+        };
+
+        Registry& GetRegistry()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        const auto Epoch = std::chrono::steady_clock::now();
+
+        uint64_t NowNs()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - Epoch).count());
+        }
+
+        ThreadBuffer& GetThreadBuffer()
+        {
+            thread_local ThreadBuffer* buffer = nullptr;
+            if (buffer == nullptr)
+            {
+                Registry& registry = GetRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.threads.push_back(std::make_unique<ThreadBuffer>());
+                buffer = registry.threads.back().get();
+                buffer->threadId = static_cast<uint32_t>(registry.threads.size());
+                buffer->name = "thread " + std::to_string(buffer->threadId);
+            }
+            return *buffer;
+        }
+
+        void WriteString(FILE* file, const char* value)
+        {
+            fputc('"', file);
+            for (const char* c = value; *c; ++c)
+            {
+                if (*c == '"' || *c == '\\')
+                {
+                    fputc('\\', file);
+                }
+                fputc(*c, file);
+            }
+            fputc('"', file);
+        }
+    }
+
+    Zone::Zone(const char* name)
+        : m_name(name), m_beginNs(NowNs())
+    {
+    }
+
+    Zone::~Zone()
+    {
+        ThreadBuffer& buffer = GetThreadBuffer();
+        const uint64_t index = buffer.writeIndex.load(std::memory_order_relaxed);
+        buffer.events[index & (ThreadBuffer::Capacity - 1)].Write(index, { m_name, m_beginNs, NowNs() });
+        buffer.writeIndex.store(index + 1, std::memory_order_release);
+    }
+
+    void SetThreadName(const char* name)
+    {
+        ThreadBuffer& buffer = GetThreadBuffer();
+        std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+        buffer.name = name;
+    }
+
+    void MarkFrame()
+    {
+        Registry& registry = GetRegistry();
+        const uint64_t now = NowNs();
+
+        // The frame that just ended
+        if (registry.frameCount > 0 && registry.captureThresholdMs > 0.0 && registry.requestedCaptureFrames == 0)
+        {
+            const uint64_t lastStart = registry.frameStartNs[(registry.frameCount - 1) % MaxCaptureFrames];
+            const double frameMs = static_cast<double>(now - lastStart) / 1000000.0;
+            if (frameMs > registry.captureThresholdMs)
+            {
+                std::cout << "Frame took " << frameMs << " ms, capturing a trace" << std::endl;
+                registry.requestedCaptureFrames = 10;
+            }
+        }
+
+        if (registry.requestedCaptureFrames > 0)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "trace_%u.json", registry.captureCount++);
+            if (WriteChromeTrace(path, registry.requestedCaptureFrames))
+            {
+                std::cout << "Trace written to " << path << std::endl;
+            }
+            registry.requestedCaptureFrames = 0;
+        }
+
+        registry.frameStartNs[registry.frameCount % MaxCaptureFrames] = now;
+        ++registry.frameCount;
+    }
+
+    void RequestCapture(uint32_t frameCount)
+    {
+        GetRegistry().requestedCaptureFrames = std::min(std::max(frameCount, 1u), MaxCaptureFrames - 1);
+    }
+
+    void SetCaptureThreshold(double frameMs)
+    {
+        GetRegistry().captureThresholdMs = frameMs;
+    }
+
+    bool WriteChromeTrace(const char* path, uint32_t frameCount)
+    {
+        Registry& registry = GetRegistry();
+
+        frameCount = std::min<uint64_t>({ frameCount, registry.frameCount, MaxCaptureFrames - 1 });
+        const uint64_t startNs = frameCount > 0 ? registry.frameStartNs[(registry.frameCount - frameCount) % MaxCaptureFrames] : 0;
+
+        FILE* file = fopen(path, "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        fprintf(file, "{\"traceEvents\":[\n");
+        bool first = true;
+
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::vector<Event> events;
+        for (const std::unique_ptr<ThreadBuffer>& thread : registry.threads)
+        {
+            const uint64_t writeIndex = thread->writeIndex.load(std::memory_order_acquire);
+            const uint64_t begin = writeIndex > ThreadBuffer::Capacity ? writeIndex - ThreadBuffer::Capacity : 0;
+
+            // Events the owner wrote over while they were copied are dropped
+            events.clear();
+            Event copied;
+            for (uint64_t i = begin; i < writeIndex; ++i)
+            {
+                if (thread->events[i & (ThreadBuffer::Capacity - 1)].Read(i, copied))
+                {
+                    events.push_back(copied);
+                }
+            }
+
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                first ? "" : ",\n", thread->threadId);
+            WriteString(file, thread->name.c_str());
+            fprintf(file, "}}");
+            first = false;
+
+            for (const Event& event : events)
+            {
+                if (event.beginNs < startNs)
+                {
+                    continue;
+                }
+
+                // Chrome trace times are in microseconds
+                fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":", thread->threadId,
+                    static_cast<double>(event.beginNs) / 1000.0, static_cast<double>(event.endNs - event.beginNs) / 1000.0);
+                WriteString(file, event.name);
+                fputc('}', file);
+            }
+        }
+
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        return true;
+    }
+}
+
+#endif
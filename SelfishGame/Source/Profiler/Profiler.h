@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * CPU instrumentation: scoped zones with nanosecond timestamps, recorded into a lock-free ring buffer per thread.
+ * The last frames can be written as a Chrome trace (chrome://tracing, ui.perfetto.dev) on request, or
+ * automatically when a frame takes longer than a threshold.
+ *
+ *     void Foo()
+ *     {
+ *         PROFILE_ZONE("Foo");
+ *         ...
+ *     }
+ *
+ * Zone names are not copied, they have to stay alive until the last capture that may contain them.
+ * With SELFISH_PROFILER_ENABLED set to 0 the zones compile to nothing and the functions to empty inlines.
+ */
+
+#ifndef SELFISH_PROFILER_ENABLED
+#define SELFISH_PROFILER_ENABLED 1
+#endif
+
+namespace Profiler
+{
+    // Frames kept around for captures
+    static constexpr uint32_t MaxCaptureFrames = 256;
+
+#if SELFISH_PROFILER_ENABLED
+
+    class Zone
+    {
+    public:
+        explicit Zone(const char* name);
+        ~Zone();
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        const char* m_name;
+        uint64_t m_beginNs;
+    };
+
+    // Shows up as the thread's name in captures, copied
+    void SetThreadName(const char* name);
+
+    // Called by the main loop at the start of every frame. Writes a pending capture of the frames before.
+    void MarkFrame();
+
+    // The next MarkFrame writes the last frameCount frames to a trace file
+    void RequestCapture(uint32_t frameCount = 60);
+
+    // Capture automatically once a frame takes longer than this, 0 turns it off
+    void SetCaptureThreshold(double frameMs);
+
+    // Events of the last frameCount frames and of the current one, as Chrome trace JSON
+    bool WriteChromeTrace(const char* path, uint32_t frameCount);
+
+#else
+
+    class Zone
+    {
+    public:
+        explicit Zone(const char*) {}
+    };
+
+    inline void SetThreadName(const char*) {}
+    inline void MarkFrame() {}
+    inline void RequestCapture(uint32_t = 60) {}
+    inline void SetCaptureThreshold(double) {}
+    inline bool WriteChromeTrace(const char*, uint32_t) { return false; }
+
+#endif
+}
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+#if SELFISH_PROFILER_ENABLED
+#define PROFILE_ZONE(name) ::Profiler::Zone PROFILER_CONCAT(profilerZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
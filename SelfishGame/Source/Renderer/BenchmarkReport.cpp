@@ -0,0 +1,76 @@
+#include "BenchmarkReport.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+    double Percentile(const std::vector<double>& sorted, double percentile)
+    {
+        const size_t rank = static_cast<size_t>(std::ceil(percentile * static_cast<double>(sorted.size())));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    void WriteSummary(std::ostream& stream, const char* name, const FrameTimeSummary& summary)
+    {
+        stream << "  \"" << name << "\": {\n"
+            << "    \"frames\": " << summary.frameCount << ",\n"
+            << "    \"mean_ms\": " << summary.meanMs << ",\n"
+            << "    \"p50_ms\": " << summary.p50Ms << ",\n"
+            << "    \"p99_ms\": " << summary.p99Ms << ",\n"
+            << "    \"max_ms\": " << summary.maxMs << "\n"
+            << "  }";
+    }
+
+    void WriteString(std::ostream& stream, const std::string& value)
+    {
+        stream << '"';
+        for (const char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                stream << '\\';
+            }
+            stream << c;
+        }
+        stream << '"';
+    }
+}
+
+FrameTimeSummary SummarizeFrameTimes(std::vector<double> frameTimesMs)
+{
+    FrameTimeSummary summary;
+    if (frameTimesMs.empty())
+    {
+        return summary;
+    }
+
+    std::sort(frameTimesMs.begin(), frameTimesMs.end());
+
+    summary.frameCount = static_cast<uint32_t>(frameTimesMs.size());
+    summary.meanMs = std::accumulate(frameTimesMs.begin(), frameTimesMs.end(), 0.0) / frameTimesMs.size();
+    summary.p50Ms = Percentile(frameTimesMs, 0.50);
+    summary.p99Ms = Percentile(frameTimesMs, 0.99);
+    summary.maxMs = frameTimesMs.back();
+    return summary;
+}
+
+void WriteBenchmarkReport(const BenchmarkReport& report, std::ostream& stream)
+{
+    stream << "{\n  \"device\": ";
+    WriteString(stream, report.deviceName);
+    stream << ",\n"
+        << "  \"width\": " << report.width << ",\n"
+        << "  \"height\": " << report.height << ",\n"
+        << "  \"warmup_frames\": " << report.warmupFrameCount << ",\n"
+        << "  \"mipmaps\": " << (report.mipmaps ? "true" : "false") << ",\n"
+        << "  \"max_anisotropy\": " << report.maxAnisotropy << ",\n"
+        << "  \"texture_memory_bytes\": " << report.textureMemoryBytes << ",\n"
+        << "  \"pipeline_cold_ms\": " << report.pipelineColdMs << ",\n"
+        << "  \"pipeline_warm_ms\": " << report.pipelineWarmMs << ",\n";
+    WriteSummary(stream, "cpu", report.cpu);
+    stream << ",\n";
+    WriteSummary(stream, "gpu", report.gpu);
+    stream << "\n}\n";
+}
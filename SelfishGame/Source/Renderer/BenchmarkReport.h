@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct FrameTimeSummary
+{
+    uint32_t frameCount = 0;
+    double meanMs = 0.0;
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+// Nearest-rank percentiles, all zero without frames
+FrameTimeSummary SummarizeFrameTimes(std::vector<double> frameTimesMs);
+
+// Result of a headless benchmark run, written as JSON so runs can be compared by scripts
+struct BenchmarkReport
+{
+    std::string deviceName;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t warmupFrameCount = 0; // rendered but not part of the statistics
+    bool mipmaps = true;
+    float maxAnisotropy = 0.0f;
+    uint64_t textureMemoryBytes = 0;
+    double pipelineColdMs = 0.0;   // scene pipeline creation with an empty pipeline cache
+    double pipelineWarmMs = 0.0;   // and with the renderer's cache, which already holds it
+    FrameTimeSummary cpu;          // whole frame on the main thread, from the game world update to the submission
+    FrameTimeSummary gpu;          // first to last command of the frame, frameCount is 0 without timestamp support
+};
+
+void WriteBenchmarkReport(const BenchmarkReport& report, std::ostream& stream);
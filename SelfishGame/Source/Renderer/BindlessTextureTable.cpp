@@ -0,0 +1,219 @@
+#include "BindlessTextureTable.h"
+
+#include <VulkanCheck.h>
+#include <algorithm>
+#include <cassert>
+
+void BindlessTextureTable::Init(VkDevice device, const Features& features, uint32_t frameCount)
+{
+    m_device = device;
+    m_features = features;
+
+    if (m_features.descriptorIndexing)
+    {
+        m_capacity = std::min(MaxBindlessTextures, m_features.maxTextures);
+    }
+    else
+    {
+        m_capacity = FallbackTextureCount;
+    }
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = m_capacity;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    // Slots can be written while the set is bound in command buffers that are still pending, and stay empty until then
+    const VkDescriptorBindingFlagsEXT bindingFlags =
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+    if (m_features.descriptorIndexing)
+    {
+        layoutInfo.pNext = &bindingFlagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    }
+    VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_layout));
+
+    // One set is enough if it can be updated while in use
+    const uint32_t setCount = m_features.descriptorIndexing ? 1 : frameCount;
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = m_capacity * setCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = m_features.descriptorIndexing ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT : 0;
+    poolInfo.maxSets = setCount;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    VK_CHECK(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_pool));
+
+    std::vector<VkDescriptorSetLayout> layouts(setCount, m_layout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_pool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts = layouts.data();
+
+    std::vector<VkDescriptorSet> descriptorSets(setCount);
+    VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()));
+
+    // Frames keep their released slots even if they share the set
+    m_frames.resize(frameCount);
+    for (uint32_t i = 0; i < frameCount; ++i)
+    {
+        m_frames[i].descriptorSet = descriptorSets[std::min(i, setCount - 1)];
+    }
+
+    m_entries.reserve(m_capacity);
+}
+
+void BindlessTextureTable::Release()
+{
+    vkDestroyDescriptorPool(m_device, m_pool, nullptr); // frees the sets
+    vkDestroyDescriptorSetLayout(m_device, m_layout, nullptr);
+    m_pool = VK_NULL_HANDLE;
+    m_layout = VK_NULL_HANDLE;
+
+    m_entries.clear();
+    m_freeSlots.clear();
+    m_frames.clear();
+    m_pendingCount = 0;
+}
+
+uint32_t BindlessTextureTable::Add(VkImageView view, VkSampler sampler)
+{
+    uint32_t slot;
+    if (!m_freeSlots.empty())
+    {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    else if (m_entries.size() < m_capacity)
+    {
+        slot = static_cast<uint32_t>(m_entries.size());
+        m_entries.emplace_back();
+    }
+    else
+    {
+        return InvalidSlot;
+    }
+
+    m_entries[slot] = { view, sampler };
+
+    if (m_features.descriptorIndexing)
+    {
+        // Nothing in flight uses a free slot, so it can be written right away
+        WriteSlot(m_frames[0].descriptorSet, slot, m_entries[slot]);
+    }
+    else
+    {
+        for (Frame& frame : m_frames)
+        {
+            frame.dirty = true;
+        }
+    }
+
+    return slot;
+}
+
+void BindlessTextureTable::Remove(uint32_t slot)
+{
+    assert(slot < m_entries.size() && m_entries[slot].view != VK_NULL_HANDLE);
+
+    // The descriptor stays as it is, frames in flight may still sample it
+    m_entries[slot] = {};
+    m_frames[m_currentFrame].releasedSlots.push_back(slot);
+    ++m_pendingCount;
+
+    if (!m_features.descriptorIndexing)
+    {
+        for (Frame& frame : m_frames)
+        {
+            frame.dirty = true;
+        }
+    }
+}
+
+void BindlessTextureTable::BeginFrame(uint32_t frameIndex)
+{
+    m_currentFrame = frameIndex;
+    Frame& frame = m_frames[frameIndex];
+
+    /*
+     * The slots were released while this frame was recorded last time. Its fence has been waited for and
+     * the frames recorded after it never referenced them, so nothing can sample them anymore.
+     */
+    m_pendingCount -= static_cast<uint32_t>(frame.releasedSlots.size());
+    m_freeSlots.insert(m_freeSlots.end(), frame.releasedSlots.begin(), frame.releasedSlots.end());
+    frame.releasedSlots.clear();
+
+    if (frame.dirty)
+    {
+        WriteAllSlots(frame.descriptorSet);
+        frame.dirty = false;
+    }
+}
+
+void BindlessTextureTable::WriteSlot(VkDescriptorSet descriptorSet, uint32_t slot, const Entry& entry)
+{
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = entry.view;
+    imageInfo.sampler = entry.sampler;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = 0;
+    write.dstArrayElement = slot;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.descriptorCount = 1;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
+
+void BindlessTextureTable::WriteAllSlots(VkDescriptorSet descriptorSet)
+{
+    // Without partially bound descriptors every slot has to be valid, the empty ones get the first texture
+    const auto firstValid = std::find_if(m_entries.begin(), m_entries.end(),
+        [](const Entry& entry) { return entry.view != VK_NULL_HANDLE; });
+    if (firstValid == m_entries.end())
+    {
+        return;
+    }
+
+    std::vector<VkDescriptorImageInfo> imageInfos(m_capacity);
+    for (uint32_t slot = 0; slot < m_capacity; ++slot)
+    {
+        const Entry& entry = slot < m_entries.size() && m_entries[slot].view != VK_NULL_HANDLE ? m_entries[slot] : *firstValid;
+        imageInfos[slot].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfos[slot].imageView = entry.view;
+        imageInfos[slot].sampler = entry.sampler;
+    }
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = 0;
+    write.dstArrayElement = 0;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.descriptorCount = m_capacity;
+    write.pImageInfo = imageInfos.data();
+
+    vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+/*
+ * One descriptor set with an array of every texture the scene uses, bound once per command buffer. Shaders pick
+ * their texture with an index that comes with the instance data, so draws never rebind descriptors.
+ *
+ * With VK_EXT_descriptor_indexing the array is partially bound and update-after-bind: a single set is shared by
+ * all frames, new textures are written into it right away and unused slots don't need a descriptor.
+ * Without it there is a small fixed size array per frame in flight, rewritten at the start of a frame whenever the
+ * table changed. Every slot has to be valid there, empty slots repeat the first texture.
+ *
+ * Released slots go back to the free list only once the frames that may still sample them are done.
+ */
+class BindlessTextureTable
+{
+public:
+    struct Features
+    {
+        bool descriptorIndexing = false; // VK_EXT_descriptor_indexing is enabled with the features below
+        uint32_t maxTextures = 0;        // device limit for update-after-bind sampled images per stage
+    };
+
+    static constexpr uint32_t MaxBindlessTextures = 4096;
+    static constexpr uint32_t FallbackTextureCount = 16; // TEXTURE_COUNT in shader.frag's fallback variant
+    static constexpr uint32_t InvalidSlot = ~0u;
+
+    void Init(VkDevice device, const Features& features, uint32_t frameCount);
+    void Release();
+
+    // Returns the slot the shaders address the texture with, InvalidSlot if the table is full
+    uint32_t Add(VkImageView view, VkSampler sampler);
+    // The image view has to stay alive until the frames in flight are done with it
+    void Remove(uint32_t slot);
+
+    // Call after waiting for the frame's fence, before anything samples the table
+    void BeginFrame(uint32_t frameIndex);
+
+    VkDescriptorSetLayout GetLayout() const { return m_layout; }
+    VkDescriptorSet GetDescriptorSet(uint32_t frameIndex) const { return m_frames[m_features.descriptorIndexing ? 0 : frameIndex].descriptorSet; }
+    bool IsBindless() const { return m_features.descriptorIndexing; }
+    uint32_t GetCapacity() const { return m_capacity; }
+    uint32_t GetUsedCount() const { return static_cast<uint32_t>(m_entries.size() - m_freeSlots.size()) - m_pendingCount; }
+
+private:
+    struct Entry
+    {
+        VkImageView view = VK_NULL_HANDLE;
+        VkSampler sampler = VK_NULL_HANDLE;
+    };
+
+    struct Frame
+    {
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        std::vector<uint32_t> releasedSlots; // removed while this frame was being recorded
+        bool dirty = false;                  // fallback only, the set has to be rewritten
+    };
+
+    void WriteSlot(VkDescriptorSet descriptorSet, uint32_t slot, const Entry& entry);
+    void WriteAllSlots(VkDescriptorSet descriptorSet);
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    Features m_features;
+    uint32_t m_capacity = 0;
+
+    VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+    VkDescriptorPool m_pool = VK_NULL_HANDLE;
+
+    std::vector<Entry> m_entries;     // grows up to m_capacity, removed slots keep a null view
+    std::vector<uint32_t> m_freeSlots;
+    uint32_t m_pendingCount = 0;      // removed, but not free yet
+
+    std::vector<Frame> m_frames;
+    uint32_t m_currentFrame = 0;
+};
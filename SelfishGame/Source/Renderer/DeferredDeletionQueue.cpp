@@ -0,0 +1,24 @@
+#include "DeferredDeletionQueue.h"
+
+void DeferredDeletionQueue::Push(std::function<void()> deleter)
+{
+    m_entries.push_back({ m_submittedFrameCount, std::move(deleter) });
+}
+
+void DeferredDeletionQueue::Collect(uint64_t completedFrameCount)
+{
+    while (!m_entries.empty() && m_entries.front().submittedFrameCount <= completedFrameCount)
+    {
+        m_entries.front().deleter();
+        m_entries.pop_front();
+    }
+}
+
+void DeferredDeletionQueue::Flush()
+{
+    for (Entry& entry : m_entries)
+    {
+        entry.deleter();
+    }
+    m_entries.clear();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+/*
+ * Destroys objects once the GPU is done with them, without waiting for the device to go idle.
+ *
+ * Everything pushed is tagged with the number of frames submitted so far, any of them may still use it. It is
+ * destroyed once the renderer reports that all of those frames have completed, i.e. their fences were signaled.
+ */
+class DeferredDeletionQueue
+{
+public:
+    void Push(std::function<void()> deleter);
+
+    // Call right after every queue submission of a frame
+    void OnFrameSubmitted() { ++m_submittedFrameCount; }
+    uint64_t GetSubmittedFrameCount() const { return m_submittedFrameCount; }
+
+    // All frames up to completedFrameCount are done, runs the deleters they were holding back
+    void Collect(uint64_t completedFrameCount);
+
+    // Only once the device is idle
+    void Flush();
+
+    size_t GetPendingCount() const { return m_entries.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t submittedFrameCount;
+        std::function<void()> deleter;
+    };
+
+    std::deque<Entry> m_entries; // in push order, the frame counts never decrease
+    uint64_t m_submittedFrameCount = 0;
+};
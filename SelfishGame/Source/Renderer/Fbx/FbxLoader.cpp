@@ -1,11 +1,13 @@
 
 #include "FbxLoader.h"
 
+#include <VertexWelder.h>
 #include <WinString.h>
+#include <glm/geometric.hpp>
 
 namespace Asset
 {
-    FbxLoader::FbxLoader(const char* pathToFbxFile)
+    FbxLoader::FbxLoader(const char* pathToFbxFile, const MeshLodSettings& lodSettings)
     {
         // Initialize the SDK manager. This object handles memory management.
         FbxManager* lSdkManager = FbxManager::Create();
@@ -45,6 +47,15 @@ namespace Asset
         }
         // Destroy the SDK manager and all the other objects it was handling.
         lSdkManager->Destroy();
+
+        // The remaining import stages work on the meshes alone
+        for (ImportedMesh& mesh : m_importedMeshes)
+        {
+            GenerateLods(mesh, lodSettings);
+            OptimizeMesh(mesh);
+            m_meshes.push_back(SplitMesh(mesh));
+        }
+        m_importedMeshes.clear();
     }
 
     struct Log
@@ -111,32 +122,17 @@ namespace Asset
 
         if (pAttribute->GetAttributeType() == FbxNodeAttribute::eMesh)
         {
-            m_meshes.push_back(ReadMesh(pAttribute));
+            m_importedMeshes.push_back(ReadMesh(pAttribute));
         }
     }
 
-    FbxLoader::Mesh FbxLoader::ReadMesh(FbxNodeAttribute* pAttribute)
+    FbxLoader::ImportedMesh FbxLoader::ReadMesh(FbxNodeAttribute* pAttribute)
     {
-        Mesh mesh;
+        ImportedMesh mesh;
 
         if (FbxMesh* fbxMesh = pAttribute->GetNode()->GetMesh())
         {
-            {
-                const FbxVector4* vertexBuffer = fbxMesh->GetControlPoints();
-                const int vertexCount = fbxMesh->GetControlPointsCount();
-                mesh.m_vertices.resize(vertexCount);
-
-                for (int vertexIndex = 0; vertexIndex < vertexCount; ++vertexIndex)
-                {
-                    const double* buffer = vertexBuffer[vertexIndex].Buffer();
-                    glm::vec3 vertex;
-                    vertex.x = static_cast<float>(buffer[0]);
-                    vertex.y = static_cast<float>(buffer[1]);
-                    vertex.z = static_cast<float>(buffer[2]);
-
-                    mesh.m_vertices[vertexIndex].pos = vertex;
-                }
-            }
+            const FbxVector4* controlPoints = fbxMesh->GetControlPoints();
 
             const bool check = fbxMesh->IsTriangleMesh();
             if (check == false)
@@ -148,43 +144,237 @@ namespace Asset
 
             FbxStringList lUVNames;
             fbxMesh->GetUVSetNames(lUVNames);
-            const auto uvCount = lUVNames.GetCount();
-            const char* uvName = lUVNames[0]; ///
-
+            const char* uvName = hasUV ? lUVNames[0] : nullptr;
+
+            /*
+             * UVs are stored per polygon corner, a control point on a UV seam has different ones in different
+             * triangles. Every corner becomes a vertex of its own first, the welder then merges the identical ones.
+             *
+             * Normals are left at zero until the GpuVertex carries them: read, they would split every hard edge into
+             * vertices that share a position, and the simplifier locks those, so hard edged meshes would get no LODs
+             * for an attribute nothing draws.
+             */
             const int polygonCount = fbxMesh->GetPolygonCount();
-            mesh.m_indices.reserve(polygonCount);
+            std::vector<Vertex> corners(static_cast<size_t>(polygonCount) * 3);
 
             for (int polygonIndex = 0; polygonIndex < polygonCount; ++polygonIndex)
             {
-                const int vertexIndex0 = fbxMesh->GetPolygonVertex(polygonIndex, 0);
-                const int vertexIndex1 = fbxMesh->GetPolygonVertex(polygonIndex, 1);
-                const int vertexIndex2 = fbxMesh->GetPolygonVertex(polygonIndex, 2);
-
-                mesh.m_indices.push_back(vertexIndex0);
-                mesh.m_indices.push_back(vertexIndex1);
-                mesh.m_indices.push_back(vertexIndex2);
-
-                bool unmapped;
-                FbxVector2 uv;
-                bool result = fbxMesh->GetPolygonVertexUV(polygonIndex, 0, uvName, uv, unmapped);
-                mesh.m_vertices[vertexIndex0].texCoordinates = { static_cast<float>(uv.Buffer()[0]), static_cast<float>(uv.Buffer()[1]) };
-                result |= fbxMesh->GetPolygonVertexUV(polygonIndex, 1, uvName, uv, unmapped);
-                mesh.m_vertices[vertexIndex1].texCoordinates = { static_cast<float>(uv.Buffer()[0]), static_cast<float>(uv.Buffer()[1]) };
-                result |= fbxMesh->GetPolygonVertexUV(polygonIndex, 2, uvName, uv, unmapped);
-                mesh.m_vertices[vertexIndex2].texCoordinates = { static_cast<float>(uv.Buffer()[0]), static_cast<float>(uv.Buffer()[1]) };
-
-                /*FbxVector4 normal;
-                result = fbxMesh->GetPolygonVertexNormal( polygonIndex, 0, normal );
-                mesh.m_vertices[vertexIndex0].m_normal = { static_cast<float>( normal.Buffer()[0] ), static_cast<float>( normal.Buffer()[1] ), static_cast<float>( normal.Buffer()[2] ) };
-                result = fbxMesh->GetPolygonVertexNormal( polygonIndex, 1, normal );
-                mesh.m_vertices[vertexIndex1].m_normal = { static_cast<float>( normal.Buffer()[0] ), static_cast<float>( normal.Buffer()[1] ), static_cast<float>( normal.Buffer()[2] ) };
-                result = fbxMesh->GetPolygonVertexNormal( polygonIndex, 2, normal );
-                mesh.m_vertices[vertexIndex2].m_normal = { static_cast<float>( normal.Buffer()[0] ), static_cast<float>( normal.Buffer()[1] ), static_cast<float>( normal.Buffer()[2] ) };*/
-
-                assert(result);
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    Vertex& vertex = corners[static_cast<size_t>(polygonIndex) * 3 + corner];
+
+                    const double* position = controlPoints[fbxMesh->GetPolygonVertex(polygonIndex, corner)].Buffer();
+                    vertex.pos = { static_cast<float>(position[0]), static_cast<float>(position[1]), static_cast<float>(position[2]) };
+
+                    vertex.texCoordinates = { 0.0f, 0.0f };
+                    bool unmapped;
+                    FbxVector2 uv;
+                    if (hasUV && fbxMesh->GetPolygonVertexUV(polygonIndex, corner, uvName, uv, unmapped))
+                    {
+                        vertex.texCoordinates = { static_cast<float>(uv.Buffer()[0]), static_cast<float>(uv.Buffer()[1]) };
+                    }
+
+                    vertex.normal = { 0.0f, 0.0f, 0.0f };
+                }
+            }
+
+            VertexWelder::Weld(corners.data(), corners.size(), mesh.m_vertices, mesh.m_indices);
+
+            Log::Message("<welded corners='%zu' control_points='%d' vertices='%zu'/>\n",
+                corners.size(), fbxMesh->GetControlPointsCount(), mesh.m_vertices.size());
+        }
+
+        return mesh;
+    }
+
+    void FbxLoader::GenerateLods(ImportedMesh& mesh, const MeshLodSettings& settings)
+    {
+        mesh.m_lods.clear();
+        mesh.m_lods.push_back({ 0, static_cast<uint32_t>(mesh.m_indices.size()), 0.0f });
+
+        std::vector<glm::vec3> positions(mesh.m_vertices.size());
+        float radius = 0.0f;
+        for (size_t i = 0; i < mesh.m_vertices.size(); ++i)
+        {
+            positions[i] = mesh.m_vertices[i].pos;
+            radius = std::max(radius, glm::length(positions[i]));
+        }
+
+        // Every LOD is simplified from the full detail mesh, so its error is measured against the real surface
+        const std::vector<uint32_t> fullDetail = mesh.m_indices;
+        const float maxError = settings.maxError * radius;
+
+        while (mesh.m_lods.size() < settings.maxLodCount)
+        {
+            const ImportedLod& previous = mesh.m_lods.back();
+            const size_t targetIndexCount = static_cast<size_t>(previous.m_indexCount * settings.reduction) / 3 * 3;
+            if (targetIndexCount / 3 < settings.minTriangleCount)
+            {
+                break;
+            }
+
+            float error = 0.0f;
+            const std::vector<uint32_t> indices = MeshSimplifier::Simplify(positions.data(), positions.size(),
+                fullDetail.data(), fullDetail.size(), targetIndexCount, maxError, &error);
+
+            // Held back by the error bound or by locked vertices, another LOD would hardly save anything
+            if (indices.size() > previous.m_indexCount * 0.9f)
+            {
+                break;
+            }
+
+            ImportedLod lod;
+            lod.m_firstIndex = static_cast<uint32_t>(mesh.m_indices.size());
+            lod.m_indexCount = static_cast<uint32_t>(indices.size());
+            lod.m_error = std::max(error, previous.m_error);
+            mesh.m_indices.insert(mesh.m_indices.end(), indices.begin(), indices.end());
+            mesh.m_lods.push_back(lod);
+        }
+    }
+
+    /**
+     * FBX polygon order and control point order are whatever the authoring tool left behind. Reorder every LOD's
+     * triangles for the post-transform cache and overdraw, then the vertices in the order the LODs first use them.
+     */
+    void FbxLoader::OptimizeMesh(ImportedMesh& mesh)
+    {
+        if (mesh.m_indices.empty())
+        {
+            return;
+        }
+
+        std::vector<glm::vec3> positions(mesh.m_vertices.size());
+        for (size_t i = 0; i < mesh.m_vertices.size(); ++i)
+        {
+            positions[i] = mesh.m_vertices[i].pos;
+        }
+
+        std::vector<uint32_t>& indices = mesh.m_indices;
+        const ImportedLod& fullDetail = mesh.m_lods.front();
+        const VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(&indices[fullDetail.m_firstIndex],
+            fullDetail.m_indexCount, positions.size());
+
+        std::vector<uint32_t> clusterStarts;
+        for (const ImportedLod& lod : mesh.m_lods)
+        {
+            uint32_t* lodIndices = &indices[lod.m_firstIndex];
+            MeshOptimizer::OptimizeVertexCache(lodIndices, lod.m_indexCount, positions.size(), clusterStarts);
+            MeshOptimizer::OptimizeOverdraw(lodIndices, lod.m_indexCount, positions.data(), positions.size(), clusterStarts);
+        }
+
+        const VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(&indices[fullDetail.m_firstIndex],
+            fullDetail.m_indexCount, positions.size());
+
+        // LOD 0 is drawn the most, it decides the vertex order, vertices only the coarser LODs use come after
+        std::vector<uint32_t> remap(mesh.m_vertices.size(), ~0u);
+        uint32_t vertexCount = 0;
+        for (const ImportedLod& lod : mesh.m_lods)
+        {
+            vertexCount = MeshOptimizer::BuildFetchRemap(&indices[lod.m_firstIndex], lod.m_indexCount, remap, vertexCount);
+        }
+
+        std::vector<Vertex> vertices(vertexCount);
+        for (size_t i = 0; i < remap.size(); ++i)
+        {
+            if (remap[i] != ~0u)
+            {
+                vertices[remap[i]] = mesh.m_vertices[i];
             }
         }
 
+        const size_t unusedCount = mesh.m_vertices.size() - vertexCount;
+        mesh.m_vertices = std::move(vertices);
+
+        Log::Message("<optimized triangles='%u' acmr='%.3f -> %.3f' atvr='%.3f -> %.3f' unused_vertices_removed='%zu'/>\n",
+            fullDetail.m_indexCount / 3, before.acmr, after.acmr, before.atvr, after.atvr, unusedCount);
+    }
+
+    /**
+     * The shared index buffer holds 16 bit indices, half the bandwidth of 32 bit ones. A mesh with more vertices
+     * than they reach is split into parts: every LOD's triangles are taken in order, which OptimizeMesh left
+     * local, and a new part starts when the next triangle would bring in more vertices than a part can reach.
+     * Every part gets its own copy of the vertices it uses, the ones on part borders end up duplicated.
+     */
+    FbxLoader::Mesh FbxLoader::SplitMesh(const ImportedMesh& imported)
+    {
+        Mesh mesh;
+        mesh.m_indices.reserve(imported.m_indices.size());
+
+        if (imported.m_vertices.size() <= MaxPartVertexCount)
+        {
+            mesh.m_vertices = imported.m_vertices;
+            mesh.m_indices.assign(imported.m_indices.begin(), imported.m_indices.end());
+            for (const ImportedLod& lod : imported.m_lods)
+            {
+                mesh.m_lods.push_back({ static_cast<uint32_t>(mesh.m_parts.size()), 1, lod.m_indexCount, lod.m_error });
+                mesh.m_parts.push_back({ lod.m_firstIndex, lod.m_indexCount, 0 });
+            }
+            return mesh;
+        }
+
+        std::vector<uint32_t> partIndex(imported.m_vertices.size(), ~0u); // of every imported vertex in the current part
+        std::vector<uint32_t> partVertices; // imported vertex of every vertex in the current part
+        uint32_t partFirstIndex = 0;
+
+        for (const ImportedLod& lod : imported.m_lods)
+        {
+            Lod splitLod{ static_cast<uint32_t>(mesh.m_parts.size()), 0, lod.m_indexCount, lod.m_error };
+
+            const auto closePart = [&]()
+                {
+                    if (partVertices.empty())
+                    {
+                        return;
+                    }
+
+                    Part part;
+                    part.m_firstIndex = partFirstIndex;
+                    part.m_indexCount = static_cast<uint32_t>(mesh.m_indices.size()) - partFirstIndex;
+                    part.m_baseVertex = static_cast<uint32_t>(mesh.m_vertices.size());
+                    for (uint32_t vertex : partVertices)
+                    {
+                        mesh.m_vertices.push_back(imported.m_vertices[vertex]);
+                        partIndex[vertex] = ~0u;
+                    }
+                    partVertices.clear();
+                    partFirstIndex = static_cast<uint32_t>(mesh.m_indices.size());
+
+                    mesh.m_parts.push_back(part);
+                    ++splitLod.m_partCount;
+                };
+
+            for (uint32_t i = lod.m_firstIndex; i < lod.m_firstIndex + lod.m_indexCount; i += 3)
+            {
+                const uint32_t* triangle = &imported.m_indices[i];
+
+                size_t newVertexCount = 0;
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    newVertexCount += partIndex[triangle[corner]] == ~0u ? 1 : 0;
+                }
+                if (partVertices.size() + newVertexCount > MaxPartVertexCount)
+                {
+                    closePart();
+                }
+
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    uint32_t& local = partIndex[triangle[corner]];
+                    if (local == ~0u)
+                    {
+                        local = static_cast<uint32_t>(partVertices.size());
+                        partVertices.push_back(triangle[corner]);
+                    }
+                    mesh.m_indices.push_back(static_cast<uint16_t>(local));
+                }
+            }
+            closePart();
+
+            mesh.m_lods.push_back(splitLod);
+        }
+
+        Log::Message("<split vertices='%zu' parts='%zu' vertices_after_split='%zu'/>\n",
+            imported.m_vertices.size(), mesh.m_parts.size(), mesh.m_vertices.size());
         return mesh;
     }
 
@@ -2,6 +2,8 @@
 
 #include <fbxsdk.h>
 #include <vector>
+#include <MeshOptimizer.h>
+#include <MeshSimplifier.h>
 #include <Vertex.h>
 
 namespace Asset
@@ -9,19 +11,65 @@ namespace Asset
     class FbxLoader
     {
     public:
-        explicit FbxLoader( const char* pathToFbxFile );
+        explicit FbxLoader( const char* pathToFbxFile, const MeshLodSettings& lodSettings = {} );
+
+        // Goes up whenever the import stages produce something different, cooked meshes from older versions are
+        // imported again
+        static constexpr uint32_t ImporterVersion = 3;
+
+        // Vertices one part can reach with its 16 bit indices
+        static constexpr uint32_t MaxPartVertexCount = 65536;
+
+        // A range of m_indices, relative to m_vertices[m_baseVertex]. Drawn as one draw with m_baseVertex added.
+        struct Part
+        {
+            uint32_t m_firstIndex = 0;
+            uint32_t m_indexCount = 0;
+            uint32_t m_baseVertex = 0;
+        };
+
+        // A range of m_parts, one part unless the mesh has more vertices than 16 bit indices can reach
+        struct Lod
+        {
+            uint32_t m_firstPart = 0;
+            uint32_t m_partCount = 0;
+            uint32_t m_indexCount = 0; // of all its parts
+            float m_error = 0.0f; // how far the surface moved from the full detail mesh at most, in mesh units
+        };
 
         struct Mesh
         {
             std::vector<Vertex> m_vertices;
             std::vector<uint16_t> m_indices;
+            std::vector<Part> m_parts;
+            std::vector<Lod> m_lods; // m_lods[0] is the full detail mesh, the following ones get coarser
         };
 
         [[nodiscard]] const std::vector<Mesh>& GetMeshes() const { return m_meshes; }
 
     private:
+        // A LOD while the mesh is imported, a range of ImportedMesh::m_indices
+        struct ImportedLod
+        {
+            uint32_t m_firstIndex = 0;
+            uint32_t m_indexCount = 0;
+            float m_error = 0.0f;
+        };
+
+        // The import stages work on 32 bit indices, so control point counts past 65535 don't overflow
+        struct ImportedMesh
+        {
+            std::vector<Vertex> m_vertices;
+            std::vector<uint32_t> m_indices;
+            std::vector<ImportedLod> m_lods;
+        };
+
+        std::vector<ImportedMesh> m_importedMeshes;
         std::vector<Mesh> m_meshes;
-        Mesh ReadMesh( FbxNodeAttribute* pAttribute );
+        ImportedMesh ReadMesh( FbxNodeAttribute* pAttribute );
+        static void GenerateLods( ImportedMesh& mesh, const MeshLodSettings& settings );
+        static void OptimizeMesh( ImportedMesh& mesh );
+        static Mesh SplitMesh( const ImportedMesh& mesh );
 
         /* Tab character ("\t") counter */
         int m_numTabs = 0;
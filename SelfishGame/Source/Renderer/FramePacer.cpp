@@ -0,0 +1,174 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <Profiler/Profiler.h>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <timeapi.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+const char* GetPresentModeName(VkPresentModeKHR presentMode)
+{
+    switch (presentMode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "relaxed";
+    default: return "other";
+    }
+}
+
+bool ParsePresentMode(const char* name, VkPresentModeKHR& presentMode)
+{
+    const VkPresentModeKHR modes[] = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+        VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+
+    for (const VkPresentModeKHR mode : modes)
+    {
+        if (strcmp(name, GetPresentModeName(mode)) == 0)
+        {
+            presentMode = mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+FramePacer::FramePacer()
+{
+#if defined(_WIN32)
+    m_waitableTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#endif
+}
+
+FramePacer::~FramePacer()
+{
+    SetFrameRateLimit(0.0);
+
+#if defined(_WIN32)
+    if (m_waitableTimer != nullptr)
+    {
+        CloseHandle(m_waitableTimer);
+    }
+#endif
+}
+
+void FramePacer::SetFrameRateLimit(double framesPerSecond)
+{
+    m_frameRateLimit = framesPerSecond;
+
+#if defined(_WIN32)
+    // The raised tick costs power system wide, only hold it while there is a limit to keep
+    const bool raisePeriod = framesPerSecond > 0.0 && m_waitableTimer == nullptr;
+    if (raisePeriod != m_timerPeriodRaised)
+    {
+        if (raisePeriod)
+        {
+            timeBeginPeriod(1);
+        }
+        else
+        {
+            timeEndPeriod(1);
+        }
+        m_timerPeriodRaised = raisePeriod;
+    }
+#endif
+}
+
+void FramePacer::WaitForNextFrame()
+{
+    const Clock::time_point now = Clock::now();
+    if (m_frameRateLimit <= 0.0)
+    {
+        m_nextFrameTime = now;
+        return;
+    }
+
+    PROFILE_ZONE("FramePacer::WaitForNextFrame");
+
+    const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_frameRateLimit));
+
+    // After a hitch (or the first frame) start over instead of rushing through frames to catch up
+    if (now > m_nextFrameTime + period)
+    {
+        m_nextFrameTime = now;
+    }
+
+    const auto spin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(SpinMs));
+    for (Clock::time_point current = Clock::now(); current + spin < m_nextFrameTime; current = Clock::now())
+    {
+        SleepFor(m_nextFrameTime - spin - current);
+    }
+
+    while (Clock::now() < m_nextFrameTime)
+    {
+        std::this_thread::yield();
+    }
+
+    m_nextFrameTime += period;
+}
+
+void FramePacer::SleepFor(Clock::duration duration)
+{
+#if defined(_WIN32)
+    if (m_waitableTimer != nullptr)
+    {
+        // Negative is relative to now, in 100 ns units
+        using Ticks = std::chrono::duration<LONGLONG, std::ratio<1, 10000000>>;
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -std::max<LONGLONG>(1, std::chrono::duration_cast<Ticks>(duration).count());
+        if (SetWaitableTimerEx(m_waitableTimer, &dueTime, 0, nullptr, nullptr, nullptr, 0))
+        {
+            WaitForSingleObject(m_waitableTimer, INFINITE);
+            return;
+        }
+    }
+#endif
+
+    std::this_thread::sleep_for(duration);
+}
+
+void FramePacer::MarkInputSampled()
+{
+    m_inputSampleTime = Clock::now();
+    m_inputSampled = true;
+}
+
+void FramePacer::MarkPresented()
+{
+    if (!m_inputSampled)
+    {
+        return;
+    }
+    m_inputSampled = false;
+
+    m_latencyMs[m_latencyNext] = std::chrono::duration<double, std::milli>(Clock::now() - m_inputSampleTime).count();
+    m_latencyNext = (m_latencyNext + 1) % LatencyHistorySize;
+    m_latencyCount = std::min(m_latencyCount + 1, LatencyHistorySize);
+}
+
+FramePacer::LatencyStats FramePacer::GetLatencyStats() const
+{
+    LatencyStats stats;
+    stats.sampleCount = m_latencyCount;
+    for (uint32_t i = 0; i < m_latencyCount; ++i)
+    {
+        stats.averageMs += m_latencyMs[i];
+        stats.maxMs = std::max(stats.maxMs, m_latencyMs[i]);
+    }
+    if (m_latencyCount > 0)
+    {
+        stats.averageMs /= m_latencyCount;
+    }
+    return stats;
+}
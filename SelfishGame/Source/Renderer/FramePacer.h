@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+// How frames are queued and presented, the trade between throughput and input latency
+struct FramePacingSettings
+{
+    // IMMEDIATE tears but has the lowest latency, MAILBOX doesn't tear and drops late frames,
+    // FIFO waits for vblank, FIFO_RELAXED tears when a frame misses it. Unsupported modes fall back to FIFO.
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+
+    // More frames in flight keep the GPU busier, every extra frame adds up to a frame of latency
+    uint32_t framesInFlight = 2;
+
+    // 0 = one more than the surface minimum, clamped to what the surface supports
+    uint32_t swapChainImageCount = 0;
+
+    // Frames per second, 0 = unlimited
+    double frameRateLimit = 0.0;
+};
+
+const char* GetPresentModeName(VkPresentModeKHR presentMode);
+// "immediate", "mailbox", "fifo" or "relaxed"
+bool ParsePresentMode(const char* name, VkPresentModeKHR& presentMode);
+
+/*
+ * Frame rate limiter and input to present latency measurement.
+ *
+ * The main loop calls WaitForNextFrame right before it samples input, so a limited frame starts with the freshest
+ * input it can get instead of sitting on it. The wait sleeps for most of the remaining time and spins for the last
+ * SpinMs, sleeping alone overshoots by up to the OS scheduler granularity.
+ *
+ * On Windows that granularity is the system timer tick, 15.6 ms by default, far more than SpinMs. The sleep goes
+ * through a high resolution waitable timer instead; where that doesn't exist (before Windows 10 1803) the tick is
+ * raised to 1 ms for as long as a limit is set.
+ */
+class FramePacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t MaxFramesInFlight = 4;
+    static constexpr uint32_t LatencyHistorySize = 120;
+
+    struct LatencyStats
+    {
+        uint32_t sampleCount = 0;
+        double averageMs = 0.0;
+        double maxMs = 0.0;
+    };
+
+    FramePacer();
+    ~FramePacer();
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    void SetFrameRateLimit(double framesPerSecond);
+    double GetFrameRateLimit() const { return m_frameRateLimit; }
+
+    void WaitForNextFrame();
+
+    void MarkInputSampled();
+    // After vkQueuePresentKHR returned for the frame that used the last sampled input
+    void MarkPresented();
+
+    LatencyStats GetLatencyStats() const;
+
+private:
+    static constexpr double SpinMs = 2.0;
+
+    void SleepFor(Clock::duration duration);
+
+    void* m_waitableTimer = nullptr; // Windows HANDLE, null where high resolution timers aren't supported
+    bool m_timerPeriodRaised = false;
+
+    double m_frameRateLimit = 0.0;
+    Clock::time_point m_nextFrameTime{};
+
+    Clock::time_point m_inputSampleTime{};
+    bool m_inputSampled = false;
+
+    double m_latencyMs[LatencyHistorySize] = {};
+    uint32_t m_latencyCount = 0;
+    uint32_t m_latencyNext = 0;
+};
@@ -0,0 +1,82 @@
+#include "FrameRingBuffer.h"
+
+#include <Utilities.h>
+#include <VulkanCheck.h>
+#include <algorithm>
+#include <cassert>
+
+void FrameRingBuffer::Init(VkPhysicalDevice physicalDevice, VkDevice device, GpuMemoryAllocator& allocator,
+    uint32_t frameCount, VkDeviceSize bytesPerFrame)
+{
+    m_device = device;
+    m_allocator = &allocator;
+    m_frameCount = frameCount;
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // Both limits are powers of two, so the larger one satisfies both
+    m_defaultAlignment = std::max<VkDeviceSize>({ 16,
+        properties.limits.minUniformBufferOffsetAlignment,
+        properties.limits.minStorageBufferOffsetAlignment });
+
+    // Every partition has to start on an aligned offset as well
+    m_bytesPerFrame = AlignUp(bytesPerFrame, m_defaultAlignment);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = m_bytesPerFrame * m_frameCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &m_buffer));
+
+    // Coherent, so there is no need to flush the written ranges before the submit
+    VK_CHECK(m_allocator->AllocateForBuffer(m_buffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_allocation));
+    assert(m_allocation.mapped != nullptr);
+
+    m_frameBegin = 0;
+    m_head = 0;
+}
+
+void FrameRingBuffer::Release()
+{
+    vkDestroyBuffer(m_device, m_buffer, nullptr);
+    m_buffer = VK_NULL_HANDLE;
+    m_allocator->Free(m_allocation);
+}
+
+void FrameRingBuffer::BeginFrame(uint32_t frameIndex)
+{
+    assert(frameIndex < m_frameCount);
+
+    m_frameBegin = m_bytesPerFrame * frameIndex;
+    m_head = m_frameBegin;
+}
+
+FrameAllocation FrameRingBuffer::Allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (alignment == 0)
+    {
+        alignment = m_defaultAlignment;
+    }
+
+    const VkDeviceSize offset = AlignUp(m_head, alignment);
+    if (offset + size > m_frameBegin + m_bytesPerFrame)
+    {
+        assert(!"FrameRingBuffer: out of space for this frame, increase bytesPerFrame");
+        return {};
+    }
+
+    m_head = offset + size;
+    m_peakUsedBytes = std::max(m_peakUsedBytes, m_head - m_frameBegin);
+
+    FrameAllocation allocation;
+    allocation.buffer = m_buffer;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = static_cast<char*>(m_allocation.mapped) + offset;
+    return allocation;
+}
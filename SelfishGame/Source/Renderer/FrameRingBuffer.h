@@ -0,0 +1,69 @@
+#pragma once
+
+#include <GpuMemoryAllocator.h>
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+// A sub-range of the ring buffer, valid until the same frame slot comes around again
+struct FrameAllocation
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0; // from the start of the buffer, usable as a dynamic offset or a vertex buffer offset
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+
+    bool IsValid() const { return buffer != VK_NULL_HANDLE; }
+};
+
+/*
+ * Persistently mapped ring allocator for data that changes every frame: uniforms, instance data, streaming vertices.
+ *
+ * One VkBuffer is split into a partition per frame in flight. BeginFrame() must only be called once the fence
+ * of that frame has been waited on: the GPU is done reading the partition and it can be handed out again.
+ * Allocating is just bumping an offset, nothing is created or destroyed per frame and many objects share
+ * one buffer through dynamic offsets.
+ */
+class FrameRingBuffer
+{
+public:
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device, GpuMemoryAllocator& allocator,
+        uint32_t frameCount, VkDeviceSize bytesPerFrame);
+    void Release();
+
+    void BeginFrame(uint32_t frameIndex);
+
+    // alignment of 0 means the strictest alignment needed for a uniform or storage buffer offset
+    FrameAllocation Allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+
+    template <typename T>
+    FrameAllocation Push(const T& data)
+    {
+        FrameAllocation allocation = Allocate(sizeof(T));
+        if (allocation.IsValid())
+        {
+            *static_cast<T*>(allocation.mapped) = data;
+        }
+        return allocation;
+    }
+
+    VkBuffer GetBuffer() const { return m_buffer; }
+    VkDeviceSize GetBytesPerFrame() const { return m_bytesPerFrame; }
+    VkDeviceSize GetUsedBytes() const { return m_head - m_frameBegin; }
+    VkDeviceSize GetPeakUsedBytes() const { return m_peakUsedBytes; }
+
+private:
+    VkDevice m_device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* m_allocator = nullptr;
+
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    GpuAllocation m_allocation;
+
+    VkDeviceSize m_defaultAlignment = 16;
+    VkDeviceSize m_bytesPerFrame = 0;
+    uint32_t m_frameCount = 0;
+
+    // Current partition is [m_frameBegin, m_frameBegin + m_bytesPerFrame)
+    VkDeviceSize m_frameBegin = 0;
+    VkDeviceSize m_head = 0;
+    VkDeviceSize m_peakUsedBytes = 0;
+};
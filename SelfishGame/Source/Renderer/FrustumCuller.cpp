@@ -0,0 +1,367 @@
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE // same as the renderer
+
+#include "FrustumCuller.h"
+
+#include <Utilities.h>
+#include <WorkerPool.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if SELFISH_SSE2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SELFISH_TARGET_AVX2
+#else
+#define SELFISH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+    // Below this many spheres splitting the work costs more than it saves
+    constexpr uint32_t ParallelGrainSize = 16 * 1024;
+
+    uint32_t CountTrailingZeros(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return index;
+#else
+        return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+    }
+
+    // Appends begin + index of every set bit of the mask
+    uint32_t* WriteVisible(uint32_t mask, uint32_t begin, uint32_t* visible)
+    {
+        while (mask != 0)
+        {
+            *visible++ = begin + CountTrailingZeros(mask);
+            mask &= mask - 1;
+        }
+        return visible;
+    }
+
+    uint32_t CullScalar(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t begin, uint32_t end, uint32_t* visible)
+    {
+        uint32_t* out = visible;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const float x = spheres.x[i];
+            const float y = spheres.y[i];
+            const float z = spheres.z[i];
+            const float negativeRadius = -spheres.radius[i];
+
+            bool inside = true;
+            for (const glm::vec4& plane : frustum.planes)
+            {
+                // Same order of operations as the SIMD paths, so the results match bit for bit
+                const float distance = plane.x * x + plane.y * y + plane.z * z + plane.w;
+                inside &= distance >= negativeRadius;
+            }
+
+            if (inside)
+            {
+                *out++ = i;
+            }
+        }
+        return static_cast<uint32_t>(out - visible);
+    }
+
+#if SELFISH_SSE2
+    uint32_t CullSse(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t begin, uint32_t end, uint32_t* visible)
+    {
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; ++p)
+        {
+            planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+
+        uint32_t* out = visible;
+        uint32_t i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps(&spheres.x[i]);
+            const __m128 y = _mm_loadu_ps(&spheres.y[i]);
+            const __m128 z = _mm_loadu_ps(&spheres.z[i]);
+            const __m128 negativeRadius = _mm_xor_ps(_mm_loadu_ps(&spheres.radius[i]), signBit);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; ++p)
+            {
+                __m128 distance = _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planeZ[p], z));
+                distance = _mm_add_ps(distance, planeW[p]);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+
+            out = WriteVisible(static_cast<uint32_t>(_mm_movemask_ps(inside)), i, out);
+        }
+
+        out += CullScalar(frustum, spheres, i, end, out);
+        return static_cast<uint32_t>(out - visible);
+    }
+
+    SELFISH_TARGET_AVX2
+    uint32_t CullAvx2(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t begin, uint32_t end, uint32_t* visible)
+    {
+        __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; ++p)
+        {
+            planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+        }
+        const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+        uint32_t* out = visible;
+        uint32_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(&spheres.x[i]);
+            const __m256 y = _mm256_loadu_ps(&spheres.y[i]);
+            const __m256 z = _mm256_loadu_ps(&spheres.z[i]);
+            const __m256 negativeRadius = _mm256_xor_ps(_mm256_loadu_ps(&spheres.radius[i]), signBit);
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < 6; ++p)
+            {
+                // No FMA on purpose, it would round differently than the scalar reference
+                __m256 distance = _mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(planeZ[p], z));
+                distance = _mm256_add_ps(distance, planeW[p]);
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+            }
+
+            out = WriteVisible(static_cast<uint32_t>(_mm256_movemask_ps(inside)), i, out);
+        }
+
+        out += CullScalar(frustum, spheres, i, end, out);
+        return static_cast<uint32_t>(out - visible);
+    }
+
+    bool CpuHasAvx2()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        __cpuid(info, 1);
+        const bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6; // OSXSAVE, XMM and YMM state
+        const bool avx = (info[2] & (1 << 28)) != 0;
+
+        __cpuidex(info, 7, 0);
+        const bool avx2 = (info[1] & (1 << 5)) != 0;
+        return osSavesYmm && avx && avx2;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+}
+
+Frustum Frustum::FromViewProjection(const glm::mat4& viewProjection)
+{
+    // Gribb/Hartmann, rows of the matrix; the depth range is [0, 1] so the near plane is just the third row
+    const glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    const glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    const glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    const glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0; // left
+    frustum.planes[1] = row3 - row0; // right
+    frustum.planes[2] = row3 + row1; // bottom
+    frustum.planes[3] = row3 - row1; // top
+    frustum.planes[4] = row2;        // near
+    frustum.planes[5] = row3 - row2; // far
+
+    // Normalized, so the distance can be compared against the sphere radius
+    for (glm::vec4& plane : frustum.planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+void BoundingSpheres::Clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+}
+
+void BoundingSpheres::Reserve(size_t count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    z.reserve(count);
+    radius.reserve(count);
+}
+
+void BoundingSpheres::Add(float centerX, float centerY, float centerZ, float sphereRadius)
+{
+    x.push_back(centerX);
+    y.push_back(centerY);
+    z.push_back(centerZ);
+    radius.push_back(sphereRadius);
+}
+
+FrustumCuller::Path FrustumCuller::GetBestPath()
+{
+#if SELFISH_SSE2
+    static const Path bestPath = CpuHasAvx2() ? Path::Avx2 : Path::Sse; // SSE2 is part of x64
+    return bestPath;
+#else
+    return Path::Scalar;
+#endif
+}
+
+const char* FrustumCuller::GetPathName(Path path)
+{
+    switch (path)
+    {
+    case Path::Scalar: return "scalar";
+    case Path::Sse: return "SSE";
+    case Path::Avx2: return "AVX2";
+    }
+    return "unknown";
+}
+
+uint32_t FrustumCuller::CullRange(Path path, const Frustum& frustum, const BoundingSpheres& spheres,
+    uint32_t begin, uint32_t end, uint32_t* visible)
+{
+#if SELFISH_SSE2
+    switch (path)
+    {
+    case Path::Sse: return CullSse(frustum, spheres, begin, end, visible);
+    case Path::Avx2: return CullAvx2(frustum, spheres, begin, end, visible);
+    case Path::Scalar: break;
+    }
+#endif
+    return CullScalar(frustum, spheres, begin, end, visible);
+}
+
+uint32_t FrustumCuller::Cull(WorkerPool* workerPool, const Frustum& frustum, const BoundingSpheres& spheres,
+    std::vector<uint32_t>& visible)
+{
+    const uint32_t count = spheres.Size();
+    const Path path = GetBestPath();
+    visible.resize(count);
+
+    if (workerPool == nullptr || count <= ParallelGrainSize)
+    {
+        const uint32_t visibleCount = CullRange(path, frustum, spheres, 0, count, visible.data());
+        visible.resize(visibleCount);
+        return visibleCount;
+    }
+
+    // Every chunk writes to its own part of the output, which is then compacted in order
+    const uint32_t chunkCount = (count + ParallelGrainSize - 1) / ParallelGrainSize;
+    std::vector<uint32_t> chunkVisibleCounts(chunkCount, 0);
+
+    workerPool->ParallelFor(count, ParallelGrainSize, [&](uint32_t begin, uint32_t end)
+        {
+            chunkVisibleCounts[begin / ParallelGrainSize] = CullRange(path, frustum, spheres, begin, end, visible.data() + begin);
+        });
+
+    uint32_t visibleCount = chunkVisibleCounts[0];
+    for (uint32_t chunk = 1; chunk < chunkCount; ++chunk)
+    {
+        memmove(visible.data() + visibleCount, visible.data() + chunk * ParallelGrainSize,
+            chunkVisibleCounts[chunk] * sizeof(uint32_t));
+        visibleCount += chunkVisibleCounts[chunk];
+    }
+
+    visible.resize(visibleCount);
+    return visibleCount;
+}
+
+CullingBenchmarkResult FrustumCuller::RunBenchmark(WorkerPool* workerPool, uint32_t sphereCount)
+{
+    // Spheres scattered around the camera, roughly one in seven ends up visible
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> radius(0.5f, 5.0f);
+
+    BoundingSpheres spheres;
+    spheres.Reserve(sphereCount);
+    for (uint32_t i = 0; i < sphereCount; ++i)
+    {
+        spheres.Add(position(random), position(random), position(random), radius(random));
+    }
+
+    const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.1f), glm::vec3(0.0f, 0.0f, 1.0f));
+    const Frustum frustum = Frustum::FromViewProjection(projection * view);
+
+    CullingBenchmarkResult result;
+    result.sphereCount = sphereCount;
+    result.workerThreadCount = workerPool != nullptr ? workerPool->GetThreadCount() : 0;
+
+    std::vector<uint32_t> reference(sphereCount);
+    std::vector<uint32_t> visible(sphereCount);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    result.visibleCount = CullRange(Path::Scalar, frustum, spheres, 0, sphereCount, reference.data());
+    result.scalarMs = MillisecondsSince(start);
+    reference.resize(result.visibleCount);
+
+    auto matchesReference = [&](uint32_t visibleCount)
+    {
+        return visibleCount == result.visibleCount &&
+            std::equal(reference.begin(), reference.end(), visible.begin());
+    };
+
+#if SELFISH_SSE2
+    start = std::chrono::high_resolution_clock::now();
+    uint32_t visibleCount = CullRange(Path::Sse, frustum, spheres, 0, sphereCount, visible.data());
+    result.sseMs = MillisecondsSince(start);
+    result.sseMatches = matchesReference(visibleCount);
+
+    if (GetBestPath() == Path::Avx2)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        visibleCount = CullRange(Path::Avx2, frustum, spheres, 0, sphereCount, visible.data());
+        result.avx2Ms = MillisecondsSince(start);
+        result.avx2Matches = matchesReference(visibleCount);
+    }
+#endif
+
+    start = std::chrono::high_resolution_clock::now();
+    const uint32_t parallelVisibleCount = Cull(workerPool, frustum, spheres, visible);
+    result.parallelMs = MillisecondsSince(start);
+    result.parallelMatches = matchesReference(parallelVisibleCount);
+
+    return result;
+}
+
+double CullingBenchmarkResult::GetBestSingleCoreMsPerMillionSpheres() const
+{
+    double bestMs = scalarMs;
+    for (const double ms : { sseMs, avx2Ms })
+    {
+        if (ms > 0.0)
+        {
+            bestMs = std::min(bestMs, ms);
+        }
+    }
+    return sphereCount > 0 ? bestMs * 1000000.0 / sphereCount : 0.0;
+}
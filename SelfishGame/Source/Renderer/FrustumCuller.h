@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+class WorkerPool;
+
+// Six normalized planes pointing inwards: left, right, bottom, top, near, far
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // Expects a [0, 1] depth range (GLM_FORCE_DEPTH_ZERO_TO_ONE)
+    static Frustum FromViewProjection(const glm::mat4& viewProjection);
+};
+
+// Bounding spheres in structure of arrays layout, so 4 or 8 of them fit into one SIMD register per component
+struct BoundingSpheres
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+
+    void Clear();
+    void Reserve(size_t count);
+    void Add(float centerX, float centerY, float centerZ, float sphereRadius);
+    uint32_t Size() const { return static_cast<uint32_t>(x.size()); }
+};
+
+struct CullingBenchmarkResult
+{
+    // The goal: 1M spheres in well under a millisecond on one core
+    static constexpr double TargetMsPerMillionSpheres = 1.0;
+
+    uint32_t sphereCount = 0;
+    uint32_t visibleCount = 0;
+    uint32_t workerThreadCount = 0; // the parallel path also runs on the calling thread
+    double scalarMs = 0.0;
+    double sseMs = 0.0;
+    double avx2Ms = 0.0;    // 0 if the CPU has no AVX2
+    double parallelMs = 0.0; // best path on all worker threads
+
+    // Whether each path wrote exactly the visible list of the scalar path, paths that didn't run match
+    bool sseMatches = true;
+    bool avx2Matches = true;
+    bool parallelMatches = true;
+
+    bool AllPathsMatch() const { return sseMatches && avx2Matches && parallelMatches; }
+
+    // Fastest single core path, scaled to 1M spheres to compare with the target
+    double GetBestSingleCoreMsPerMillionSpheres() const;
+};
+
+/*
+ * CPU frustum culling of bounding spheres, writes the indices of the visible spheres into a compact list.
+ *
+ * A sphere is visible unless it is completely behind one of the planes. The SIMD paths test 4 (SSE) or 8 (AVX2)
+ * spheres against a plane at once, the best one the CPU supports is picked at runtime. The scalar path is the
+ * reference the others have to match exactly.
+ */
+class FrustumCuller
+{
+public:
+    enum class Path
+    {
+        Scalar,
+        Sse,
+        Avx2,
+    };
+
+    static Path GetBestPath();
+    static const char* GetPathName(Path path);
+
+    // Culls spheres [begin, end), visible has to have room for end - begin indices. Returns how many were written.
+    static uint32_t CullRange(Path path, const Frustum& frustum, const BoundingSpheres& spheres,
+        uint32_t begin, uint32_t end, uint32_t* visible);
+
+    // Culls all spheres with the best path, splitting the work across the pool if there are enough of them
+    static uint32_t Cull(WorkerPool* workerPool, const Frustum& frustum, const BoundingSpheres& spheres,
+        std::vector<uint32_t>& visible);
+
+    // Times every path on sphereCount random spheres, the result of all of them is checked against the scalar path
+    static CullingBenchmarkResult RunBenchmark(WorkerPool* workerPool, uint32_t sphereCount);
+};
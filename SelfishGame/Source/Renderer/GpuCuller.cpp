@@ -0,0 +1,467 @@
+#include "GpuCuller.h"
+
+#include <FrustumCuller.h>
+#include <Vertex.h>
+#include <Utilities.h>
+#include <VulkanCheck.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <unordered_map>
+#include <glm/geometric.hpp>
+
+namespace
+{
+    constexpr uint32_t CullGroupSize = 64; // local_size_x in cull.comp
+    constexpr uint32_t BindingCount = 6;
+}
+
+void GpuCuller::Init(VkPhysicalDevice physicalDevice, VkDevice device, GpuMemoryAllocator& allocator, VkPipelineCache pipelineCache,
+    const std::vector<char>& shaderCode, uint32_t frameCount, const Features& features)
+{
+    m_device = device;
+    m_allocator = &allocator;
+    m_features = features;
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_storageAlignment = std::max<VkDeviceSize>(16, properties.limits.minStorageBufferOffsetAlignment);
+
+    if (m_features.drawIndirectCount)
+    {
+        m_vkCmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+            vkGetDeviceProcAddr(m_device, "vkCmdDrawIndexedIndirectCountKHR"));
+        m_features.drawIndirectCount = m_vkCmdDrawIndexedIndirectCount != nullptr;
+    }
+
+    // Layout: instances, instance meshes, meshes, counters, draw commands, visible instances
+    std::array<VkDescriptorSetLayoutBinding, BindingCount> bindings{};
+    for (uint32_t i = 0; i < BindingCount; ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout));
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = BindingCount * frameCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = frameCount;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    VK_CHECK(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool));
+
+    m_frames.resize(frameCount);
+    std::vector<VkDescriptorSetLayout> layouts(frameCount, m_descriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_descriptorPool;
+    allocInfo.descriptorSetCount = frameCount;
+    allocInfo.pSetLayouts = layouts.data();
+
+    std::vector<VkDescriptorSet> descriptorSets(frameCount);
+    VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()));
+    for (uint32_t i = 0; i < frameCount; ++i)
+    {
+        m_frames[i].descriptorSet = descriptorSets[i];
+    }
+
+    VkPushConstantRange pushConstants{};
+    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstants.offset = 0;
+    pushConstants.size = sizeof(CullConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+    VK_CHECK(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout));
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = shaderCode.size();
+    moduleInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+
+    VkShaderModule shaderModule;
+    VK_CHECK(vkCreateShaderModule(m_device, &moduleInfo, nullptr, &shaderModule));
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_pipelineLayout;
+    VK_CHECK(vkCreateComputePipelines(m_device, pipelineCache, 1, &pipelineInfo, nullptr, &m_pipeline));
+
+    vkDestroyShaderModule(m_device, shaderModule, nullptr);
+}
+
+void GpuCuller::Release()
+{
+    for (FrameOutput& frame : m_frames)
+    {
+        vkDestroyBuffer(m_device, frame.buffer, nullptr);
+        m_allocator->Free(frame.allocation);
+        vkDestroyBuffer(m_device, frame.readbackBuffer, nullptr);
+        m_allocator->Free(frame.readbackAllocation);
+    }
+    m_frames.clear();
+
+    vkDestroyPipeline(m_device, m_pipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr); // frees the descriptor sets
+    vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+}
+
+void GpuCuller::Reserve(FrameOutput& output, VkDeviceSize size)
+{
+    if (size <= output.capacity)
+    {
+        return;
+    }
+
+    // The frame's fence has been waited on, the old buffer isn't used by the GPU anymore
+    vkDestroyBuffer(m_device, output.buffer, nullptr);
+    m_allocator->Free(output.allocation);
+
+    output.capacity = std::max(size, output.capacity * 2);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = output.capacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &output.buffer));
+
+    VK_CHECK(m_allocator->AllocateForBuffer(output.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, output.allocation));
+}
+
+void GpuCuller::ReserveReadback(FrameOutput& output, VkDeviceSize size)
+{
+    if (size <= output.readbackCapacity)
+    {
+        return;
+    }
+
+    vkDestroyBuffer(m_device, output.readbackBuffer, nullptr);
+    m_allocator->Free(output.readbackAllocation);
+
+    output.readbackCapacity = std::max(size, output.readbackCapacity * 2);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = output.readbackCapacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &output.readbackBuffer));
+
+    // Coherent, the copy only has to be made available to the host
+    VK_CHECK(m_allocator->AllocateForBuffer(output.readbackBuffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, output.readbackAllocation));
+    assert(output.readbackAllocation.mapped != nullptr);
+}
+
+void GpuCuller::Prepare(uint32_t frameIndex, const CullInput& input)
+{
+    FrameOutput& output = m_frames[frameIndex];
+
+    output.meshCount = input.meshCount;
+    output.readbackRecorded = false;
+    output.countersSize = sizeof(uint32_t) * (1 + input.meshCount);
+    output.drawsOffset = AlignUp(output.countersSize, m_storageAlignment);
+    output.drawsSize = sizeof(VkDrawIndexedIndirectCommand) * input.meshCount;
+    output.instancesOffset = AlignUp(output.drawsOffset + output.drawsSize, m_storageAlignment);
+    output.instancesSize = sizeof(InstanceData) * input.instanceCount;
+
+    if (input.instanceCount == 0 || input.meshCount == 0)
+    {
+        output.meshCount = 0;
+        return;
+    }
+
+    Reserve(output, output.instancesOffset + output.instancesSize);
+    if (m_readback)
+    {
+        ReserveReadback(output, output.instancesOffset + output.instancesSize);
+    }
+
+    // Not in use by the GPU either, every frame points it at this frame's ring buffer ranges
+    const std::array<VkDescriptorBufferInfo, BindingCount> bufferInfos = { {
+        { input.instances.buffer, input.instances.offset, input.instances.size },
+        { input.instanceMeshes.buffer, input.instanceMeshes.offset, input.instanceMeshes.size },
+        { input.meshes.buffer, input.meshes.offset, input.meshes.size },
+        { output.buffer, 0, output.countersSize },
+        { output.buffer, output.drawsOffset, output.drawsSize },
+        { output.buffer, output.instancesOffset, output.instancesSize },
+    } };
+
+    std::array<VkWriteDescriptorSet, BindingCount> writes{};
+    for (uint32_t i = 0; i < BindingCount; ++i)
+    {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = output.descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void GpuCuller::RecordCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex, const CullInput& input)
+{
+    FrameOutput& output = m_frames[frameIndex];
+    if (output.meshCount == 0)
+    {
+        return;
+    }
+
+    // Counters start at zero, so do the draw slots: the ones that don't get written are empty draws
+    vkCmdFillBuffer(commandBuffer, output.buffer, 0, output.drawsOffset + output.drawsSize, 0);
+
+    VkMemoryBarrier clearBarrier{};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1,
+        &output.descriptorSet, 0, nullptr);
+
+    CullConstants constants{};
+    const Frustum frustum = Frustum::FromViewProjection(input.viewProjection);
+    std::copy(std::begin(frustum.planes), std::end(frustum.planes), constants.frustumPlanes);
+    constants.instanceCount = input.instanceCount;
+    constants.meshCount = input.meshCount;
+
+    // Pass 0: one invocation per instance, appends the visible ones to their mesh's range
+    constants.pass = 0;
+    vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, (input.instanceCount + CullGroupSize - 1) / CullGroupSize, 1, 1);
+
+    VkMemoryBarrier cullBarrier{};
+    cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+    // Pass 1: one invocation per mesh, writes a draw command for every mesh with visible instances
+    constants.pass = 1;
+    vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, (input.meshCount + CullGroupSize - 1) / CullGroupSize, 1, 1);
+
+    if (m_readback)
+    {
+        RecordReadback(commandBuffer, output);
+    }
+
+    // The barrier in front of the draws comes from the render graph, GetOutputBuffer is written by the compute shader
+}
+
+void GpuCuller::RecordReadback(VkCommandBuffer commandBuffer, FrameOutput& output)
+{
+    VkMemoryBarrier culledBarrier{};
+    culledBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    culledBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    culledBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        1, &culledBarrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy copy{};
+    copy.size = output.instancesOffset + output.instancesSize;
+    vkCmdCopyBuffer(commandBuffer, output.buffer, output.readbackBuffer, 1, &copy);
+
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+    output.readbackRecorded = true;
+}
+
+bool GpuCuller::VerifyReadback(uint32_t frameIndex, const CullInput& input, std::string& error)
+{
+    FrameOutput& output = m_frames[frameIndex];
+    if (!output.readbackRecorded)
+    {
+        return true;
+    }
+    output.readbackRecorded = false;
+
+    const char* readback = static_cast<const char*>(output.readbackAllocation.mapped);
+    const uint32_t drawCount = *reinterpret_cast<const uint32_t*>(readback);
+    const uint32_t* visibleCounts = reinterpret_cast<const uint32_t*>(readback) + 1;
+    const VkDrawIndexedIndirectCommand* draws = reinterpret_cast<const VkDrawIndexedIndirectCommand*>(readback + output.drawsOffset);
+    const InstanceData* visibleInstances = reinterpret_cast<const InstanceData*>(readback + output.instancesOffset);
+
+    const InstanceData* instances = static_cast<const InstanceData*>(input.instances.mapped);
+    const uint32_t* instanceMeshes = static_cast<const uint32_t*>(input.instanceMeshes.mapped);
+    const GpuMeshInfo* meshes = static_cast<const GpuMeshInfo*>(input.meshes.mapped);
+
+    // cull.comp pass 0, the same test and the same dequantization folded into the visible instances
+    const Frustum frustum = Frustum::FromViewProjection(input.viewProjection);
+    std::vector<std::vector<InstanceData>> expected(input.meshCount);
+    for (uint32_t i = 0; i < input.instanceCount; ++i)
+    {
+        const glm::vec4 positionAndScale = instances[i].positionAndScale;
+        const GpuMeshInfo& mesh = meshes[instanceMeshes[i]];
+        const float radius = mesh.boundingRadius * positionAndScale.w;
+
+        bool visible = true;
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            visible = visible && glm::dot(glm::vec3(plane), glm::vec3(positionAndScale)) + plane.w >= -radius;
+        }
+        if (!visible)
+        {
+            continue;
+        }
+
+        InstanceData culled = instances[i];
+        culled.positionAndScale = glm::vec4(glm::vec3(positionAndScale) + glm::vec3(mesh.positionDequantize) * positionAndScale.w,
+            mesh.positionDequantize.w * positionAndScale.w);
+        culled.texCoordDequantize = glm::vec3(mesh.texCoordDequantize);
+        expected[instanceMeshes[i]].push_back(culled);
+    }
+
+    // Pass 1, one draw for every slot with visible instances
+    uint32_t expectedDrawCount = 0;
+    std::unordered_map<uint32_t, uint32_t> slotsByFirstInstance; // slots with visible instances have ranges of their own
+    for (uint32_t slot = 0; slot < input.meshCount; ++slot)
+    {
+        if (visibleCounts[slot] != expected[slot].size())
+        {
+            error = "slot " + std::to_string(slot) + " has " + std::to_string(visibleCounts[slot]) + " visible instances, "
+                + std::to_string(expected[slot].size()) + " on the CPU";
+            return false;
+        }
+        if (!expected[slot].empty())
+        {
+            ++expectedDrawCount;
+            slotsByFirstInstance[meshes[slot].firstInstance] = slot;
+        }
+    }
+    if (drawCount != expectedDrawCount)
+    {
+        error = std::to_string(drawCount) + " draws, " + std::to_string(expectedDrawCount) + " on the CPU";
+        return false;
+    }
+
+    // The draws come in the order the invocations got their slot
+    for (uint32_t i = 0; i < drawCount; ++i)
+    {
+        const VkDrawIndexedIndirectCommand& draw = draws[i];
+        const auto slot = slotsByFirstInstance.find(draw.firstInstance);
+        if (slot == slotsByFirstInstance.end())
+        {
+            error = "draw " + std::to_string(i) + " starts at instance " + std::to_string(draw.firstInstance) + ", no slot does";
+            return false;
+        }
+
+        const GpuMeshInfo& mesh = meshes[slot->second];
+        if (draw.indexCount != mesh.indexCount || draw.firstIndex != mesh.firstIndex || draw.vertexOffset != mesh.vertexOffset ||
+            draw.instanceCount != expected[slot->second].size())
+        {
+            error = "draw " + std::to_string(i) + " doesn't match slot " + std::to_string(slot->second);
+            return false;
+        }
+        slotsByFirstInstance.erase(slot);
+    }
+
+    // Same for the instances, ordered by position as the atomics hand out the places in any order
+    const auto byPosition = [](const InstanceData& a, const InstanceData& b)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                if (a.positionAndScale[c] != b.positionAndScale[c])
+                {
+                    return a.positionAndScale[c] < b.positionAndScale[c];
+                }
+            }
+            return a.textureIndex < b.textureIndex;
+        };
+
+    for (uint32_t slot = 0; slot < input.meshCount; ++slot)
+    {
+        std::vector<InstanceData>& cpu = expected[slot];
+        std::vector<InstanceData> gpu(visibleInstances + meshes[slot].firstInstance,
+            visibleInstances + meshes[slot].firstInstance + cpu.size());
+        std::sort(cpu.begin(), cpu.end(), byPosition);
+        std::sort(gpu.begin(), gpu.end(), byPosition);
+
+        for (size_t i = 0; i < cpu.size(); ++i)
+        {
+            // The GPU may fuse the multiply-add of the dequantization
+            bool equal = gpu[i].textureIndex == cpu[i].textureIndex && gpu[i].texCoordDequantize == cpu[i].texCoordDequantize;
+            for (int c = 0; c < 4; ++c)
+            {
+                equal = equal && std::abs(gpu[i].positionAndScale[c] - cpu[i].positionAndScale[c]) <=
+                    1e-5f * std::max(1.0f, std::abs(cpu[i].positionAndScale[c]));
+            }
+            if (!equal)
+            {
+                error = "visible instance " + std::to_string(i) + " of slot " + std::to_string(slot) + " differs";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void GpuCuller::RecordDraws(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t firstSlot, uint32_t slotCount)
+{
+    const FrameOutput& output = m_frames[frameIndex];
+    if (firstSlot >= output.meshCount)
+    {
+        return;
+    }
+    slotCount = std::min(slotCount, output.meshCount - firstSlot);
+
+    vkCmdBindVertexBuffers(commandBuffer, 1, 1, &output.buffer, &output.instancesOffset);
+
+    constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    const VkDeviceSize firstDrawOffset = output.drawsOffset + VkDeviceSize(firstSlot) * stride;
+    if (m_features.drawIndirectCount)
+    {
+        /*
+         * The first counter is the total number of draw commands. Starting at firstSlot the driver draws
+         * min(count, slotCount) slots, which covers every written slot of this range; the extra ones
+         * it may draw past the count are zeroed and draw nothing.
+         */
+        m_vkCmdDrawIndexedIndirectCount(commandBuffer, output.buffer, firstDrawOffset, output.buffer, 0, slotCount, stride);
+    }
+    else if (m_features.multiDrawIndirect)
+    {
+        vkCmdDrawIndexedIndirect(commandBuffer, output.buffer, firstDrawOffset, slotCount, stride);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < slotCount; ++i)
+        {
+            vkCmdDrawIndexedIndirect(commandBuffer, output.buffer, firstDrawOffset + i * stride, 1, stride);
+        }
+    }
+}
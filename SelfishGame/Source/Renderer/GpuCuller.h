@@ -0,0 +1,151 @@
+#pragma once
+
+#include <FrameRingBuffer.h>
+#include <GpuMemoryAllocator.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <vulkan/vulkan_core.h>
+
+// Per draw slot data read by cull.comp, std430 layout. A slot is one part of one LOD of a mesh, see MeshPartInfo.
+struct GpuMeshInfo
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance; // start of the slot's range in the instance and the visible instance buffers
+    float boundingRadius;   // around the mesh origin, in mesh units
+    float padding[3];
+    glm::vec4 positionDequantize; // VertexQuantization: xyz offset, w scale
+    glm::vec4 texCoordDequantize; // xy offset, z scale
+};
+
+// Everything the culling pass reads, all of it written by the CPU into the frame ring buffer
+struct CullInput
+{
+    FrameAllocation instances;      // InstanceData[instanceCount], grouped by draw slot
+    FrameAllocation instanceMeshes; // uint32_t[instanceCount], draw slot of every instance, i.e. mesh, LOD and part
+    FrameAllocation meshes;         // GpuMeshInfo[meshCount], one per draw slot
+    uint32_t instanceCount = 0;
+    uint32_t meshCount = 0;
+    glm::mat4 viewProjection{ 1.0f };
+};
+
+/*
+ * GPU driven culling: a compute pass frustum-culls every instance against its mesh's bounding sphere and writes
+ * the survivors, compacted per mesh, to a device local buffer together with one VkDrawIndexedIndirectCommand per
+ * visible mesh and the number of those commands.
+ *
+ * The draws are submitted with vkCmdDrawIndexedIndirectCount if VK_KHR_draw_indirect_count is enabled. Otherwise
+ * with vkCmdDrawIndexedIndirect for every mesh slot; the slots after the last written command stay zeroed, which
+ * makes them empty draws. Without multiDrawIndirect every slot is its own indirect draw.
+ *
+ * The input is whatever the CPU packed, the LOD of every instance included. Selecting LODs or skipping the CPU
+ * side culling would need the whole scene resident on the GPU, which it isn't.
+ */
+class GpuCuller
+{
+public:
+    struct Features
+    {
+        bool drawIndirectCount = false; // VK_KHR_draw_indirect_count is enabled on the device
+        bool multiDrawIndirect = false;
+    };
+
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device, GpuMemoryAllocator& allocator, VkPipelineCache pipelineCache,
+        const std::vector<char>& shaderCode, uint32_t frameCount, const Features& features);
+    void Release();
+
+    // Sizes the frame's output buffer and points the descriptors at the input, before anything is recorded
+    void Prepare(uint32_t frameIndex, const CullInput& input);
+
+    // Records the culling dispatches, has to be outside of a render pass. The draws have to wait for the
+    // compute shader writes to the output buffer.
+    void RecordCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex, const CullInput& input);
+
+    // Binds the visible instances to vertex binding 1 and records the indirect draws of draw slots
+    // [firstSlot, firstSlot + slotCount), inside of the render pass. Slots can be split across secondary command buffers.
+    // The vertex and index buffers of the meshes have to be bound already.
+    void RecordDraws(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t firstSlot, uint32_t slotCount);
+
+    // One slot per mesh, only the first "draw count" of them hold draws after culling
+    uint32_t GetDrawSlotCount(uint32_t frameIndex) const { return m_frames[frameIndex].meshCount; }
+
+    // Draw commands and visible instances, VK_NULL_HANDLE if nothing has been culled yet
+    VkBuffer GetOutputBuffer(uint32_t frameIndex) const { return m_frames[frameIndex].buffer; }
+
+    const Features& GetFeatures() const { return m_features; }
+
+    // Without multi draw indirect RecordDraws records a draw per slot, otherwise any range of slots is a single draw
+    bool RecordsDrawPerSlot() const { return !m_features.drawIndirectCount && !m_features.multiDrawIndirect; }
+
+    /*
+     * For tests: RecordCulling also copies the output to host memory, VerifyReadback then compares it with
+     * cull.comp run on the CPU over the same input. Has to be called before the first frame.
+     */
+    void EnableReadback() { m_readback = true; }
+
+    // True if the frame culled anything since its last VerifyReadback
+    bool HasReadback(uint32_t frameIndex) const { return m_frames[frameIndex].readbackRecorded; }
+    // The frame's input is gone before it could be verified
+    void DiscardReadback(uint32_t frameIndex) { m_frames[frameIndex].readbackRecorded = false; }
+
+    // Once the frame's fence has been waited on and while its input is still in the ring buffer. Draw counts,
+    // draw commands and every draw slot's visible instances have to match, the order within a slot may differ.
+    // error says what didn't.
+    bool VerifyReadback(uint32_t frameIndex, const CullInput& input, std::string& error);
+
+private:
+    struct CullConstants
+    {
+        glm::vec4 frustumPlanes[6];
+        uint32_t instanceCount;
+        uint32_t meshCount;
+        uint32_t pass; // 0 = cull instances, 1 = build the draw commands
+        uint32_t padding;
+    };
+
+    // Device local output of one frame: [draw count + visible count per mesh][draw commands][visible instances]
+    struct FrameOutput
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        GpuAllocation allocation;
+        VkDeviceSize capacity = 0;
+
+        VkDeviceSize countersSize = 0;
+        VkDeviceSize drawsOffset = 0;
+        VkDeviceSize drawsSize = 0;
+        VkDeviceSize instancesOffset = 0;
+        VkDeviceSize instancesSize = 0;
+        uint32_t meshCount = 0;
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+        // Host visible copy of buffer, only with readback enabled
+        VkBuffer readbackBuffer = VK_NULL_HANDLE;
+        GpuAllocation readbackAllocation;
+        VkDeviceSize readbackCapacity = 0;
+        bool readbackRecorded = false;
+    };
+
+    void Reserve(FrameOutput& output, VkDeviceSize size);
+    void ReserveReadback(FrameOutput& output, VkDeviceSize size);
+    void RecordReadback(VkCommandBuffer commandBuffer, FrameOutput& output);
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* m_allocator = nullptr;
+    Features m_features;
+    VkDeviceSize m_storageAlignment = 16;
+    bool m_readback = false;
+
+    VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+    PFN_vkCmdDrawIndexedIndirectCountKHR m_vkCmdDrawIndexedIndirectCount = nullptr;
+
+    std::vector<FrameOutput> m_frames;
+};
@@ -1,73 +1,359 @@
-
 #include "GpuImage.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
 #include <Renderer.h>
+#include <TextureContainer.h>
+#include <Utilities.h>
+#include <VulkanCheck.h>
 #include <stb_image/stb_image.h>
 
-
-void GpuImage::CreateDepthImage(Renderer& renderer, VkExtent2D swapChainExtent)
+namespace
 {
-    const VkFormat depthFormat = renderer.FindDepthFormat();
+    float SrgbToLinear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
 
-    renderer.CreateImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_image, m_deviceMemory);
+    unsigned char LinearToSrgb(float value)
+    {
+        const float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+        return static_cast<unsigned char>(std::clamp(srgb, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
 
-    m_view = CreateImageView(renderer, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-}
+    // 2x2 box filter of an RGBA8 sRGB image, averaged in linear space like the hardware does for sRGB blits.
+    // A level one texel wide or high repeats its only column or row.
+    std::vector<unsigned char> DownsampleSrgb(const unsigned char* source, uint32_t width, uint32_t height)
+    {
+        static const std::array<float, 256> toLinear = []
+            {
+                std::array<float, 256> table{};
+                for (size_t i = 0; i < table.size(); ++i)
+                {
+                    table[i] = SrgbToLinear(static_cast<float>(i) / 255.0f);
+                }
+                return table;
+            }();
 
-void GpuImage::CreateFromImageData(Renderer& renderer, const unsigned char* imageData, int width, int height)
-{
-    const VkDeviceSize imageSize = width * height * 4;
+        const uint32_t nextWidth = std::max(width / 2, 1u);
+        const uint32_t nextHeight = std::max(height / 2, 1u);
+        std::vector<unsigned char> result(static_cast<size_t>(nextWidth) * nextHeight * 4);
+
+        for (uint32_t y = 0; y < nextHeight; ++y)
+        {
+            const uint32_t y0 = std::min(y * 2, height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+            for (uint32_t x = 0; x < nextWidth; ++x)
+            {
+                const uint32_t x0 = std::min(x * 2, width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                const unsigned char* texels[4] =
+                {
+                    source + (static_cast<size_t>(y0) * width + x0) * 4, source + (static_cast<size_t>(y0) * width + x1) * 4,
+                    source + (static_cast<size_t>(y1) * width + x0) * 4, source + (static_cast<size_t>(y1) * width + x1) * 4
+                };
+
+                unsigned char* destination = &result[(static_cast<size_t>(y) * nextWidth + x) * 4];
+                for (int c = 0; c < 3; ++c)
+                {
+                    const float sum = toLinear[texels[0][c]] + toLinear[texels[1][c]] + toLinear[texels[2][c]] + toLinear[texels[3][c]];
+                    destination[c] = LinearToSrgb(sum * 0.25f);
+                }
+                // alpha is linear
+                destination[3] = static_cast<unsigned char>((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+            }
+        }
+
+        return result;
+    }
+
+    // Stands in for a texture whose file can't be read or decoded, a magenta and black checker
+    constexpr uint32_t MissingTextureSize = 2;
+    const unsigned char MissingTexturePixels[MissingTextureSize * MissingTextureSize * 4] =
+    {
+        255, 0, 255, 255,   0, 0, 0, 255,
+        0, 0, 0, 255,       255, 0, 255, 255,
+    };
+
+    struct StbiDeleter
+    {
+        void operator()(stbi_uc* pixels) const { stbi_image_free(pixels); }
+    };
+
+    // What the device can do with the textures, queried once on the loading thread
+    struct TextureCapabilities
+    {
+        VkPhysicalDevice physicalDevice;
+        bool mipmaps;
+        bool linearBlits; // of the decoded RGBA8 images
+    };
+
+    TextureCapabilities GetTextureCapabilities(VkPhysicalDevice physicalDevice, const TextureSettings& settings)
+    {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+
+        TextureCapabilities capabilities;
+        capabilities.physicalDevice = physicalDevice;
+        capabilities.mipmaps = settings.mipmaps;
+        capabilities.linearBlits = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+        return capabilities;
+    }
+
+    // Everything needed to create and fill one image. Preparing it touches neither the device nor the upload
+    // manager, so it can run on any thread.
+    struct TextureSource
+    {
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        uint32_t mipLevels = 1; // mips past the given levels are blitted
+        std::vector<UploadManager::ImageLevel> levels;
+
+        // Owners of the level data
+        TextureContainer container;
+        std::unique_ptr<stbi_uc, StbiDeleter> pixels;
+        std::vector<std::vector<unsigned char>> mips;
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+        bool NeedsBlits() const { return mipLevels > levels.size(); }
+    };
 
-    renderer.CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer, stagingBufferMemory);
+    void PrepareImageData(const unsigned char* imageData, uint32_t width, uint32_t height, const TextureCapabilities& capabilities,
+        TextureSource& source)
+    {
+        source.format = VK_FORMAT_R8G8B8A8_SRGB;
+        source.levels = { { imageData, VkDeviceSize(width) * height * 4, width, height } };
+        source.mipLevels = capabilities.mipmaps ? GpuImage::GetMipLevelCount(width, height) : 1;
 
-    void* data;
-    vkMapMemory(renderer.m_device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, imageData, imageSize);
-    vkUnmapMemory(renderer.m_device, stagingBufferMemory);
+        if (capabilities.linearBlits || source.mipLevels == 1)
+        {
+            return;
+        }
+
+        // No linear blits for this format, the chain is filtered on the CPU instead
+        source.mips.reserve(source.mipLevels - 1);
+        for (uint32_t mip = 1; mip < source.mipLevels; ++mip)
+        {
+            const UploadManager::ImageLevel& previous = source.levels.back();
+            source.mips.push_back(DownsampleSrgb(static_cast<const unsigned char*>(previous.data), previous.width, previous.height));
+            source.levels.push_back({ source.mips.back().data(), source.mips.back().size(),
+                std::max(previous.width / 2, 1u), std::max(previous.height / 2, 1u) });
+        }
+    }
+
+    // A cooked container is used as it is, if the device can sample its format
+    bool PrepareContainer(const std::string& path, const TextureCapabilities& capabilities, TextureSource& source)
+    {
+        if (!source.container.Load(path))
+        {
+            return false;
+        }
+
+        // Block compressed formats are optional (textureCompressionBC)
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(capabilities.physicalDevice, source.container.GetFormat(), &formatProperties);
+        if ((formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0)
+        {
+            return false;
+        }
+
+        source.format = source.container.GetFormat();
+        source.mipLevels = capabilities.mipmaps ? source.container.GetHeader().mipLevels : 1;
+        source.levels.clear();
+        for (uint32_t mip = 0; mip < source.mipLevels; ++mip)
+        {
+            const TextureContainer::Level& level = source.container.GetLevels()[mip];
+            source.levels.push_back({ source.container.GetLevelData(mip), level.size, level.width, level.height });
+        }
+        return true;
+    }
+
+    // Prefers a cooked .stex next to the image, decodes the image otherwise. False if neither can be read, source
+    // holds the missing texture then.
+    bool PrepareTextureFile(const char* texturePath, const TextureCapabilities& capabilities, TextureSource& source)
+    {
+        const std::string cookedPath = std::filesystem::path(texturePath).replace_extension(".stex").string();
+        if (PrepareContainer(cookedPath, capabilities, source))
+        {
+            return true;
+        }
+
+        int texWidth = 0, texHeight = 0, texChannels = 0;
+        source.pixels.reset(stbi_load(texturePath, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha));
+        if (!source.pixels)
+        {
+            PrepareImageData(MissingTexturePixels, MissingTextureSize, MissingTextureSize, capabilities, source);
+            return false;
+        }
+
+        PrepareImageData(source.pixels.get(), static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), capabilities, source);
+        return true;
+    }
+}
+
+uint32_t GpuImage::GetMipLevelCount(uint32_t width, uint32_t height)
+{
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+void GpuImage::CreateFromImageData(Renderer& renderer, const unsigned char* imageData, int width, int height)
+{
+    TextureSource source;
+    PrepareImageData(imageData, static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+        GetTextureCapabilities(renderer.m_physicalDevice, renderer.m_textureSettings), source);
 
     // create a texture image in GPU memory
+    Create(renderer, source.format, source.levels[0].width, source.levels[0].height, source.mipLevels, source.NeedsBlits());
 
-    renderer.CreateImage(width, height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT /*as a destination for copy from staging buffer*/ | VK_IMAGE_USAGE_SAMPLED_BIT /*as a sampler for shaders*/,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT /*Bind to local GPU buffer*/, m_image, m_deviceMemory);
+    // staged right away, the copies, the blits and the layout transitions are recorded with the next flush of the upload manager
+    renderer.m_uploadManager.UploadImage(m_image, source.levels.data(), static_cast<uint32_t>(source.levels.size()), source.mipLevels);
+}
 
-    renderer.TransitionImageLayout(m_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+void GpuImage::CreateFromMipLevels(Renderer& renderer, VkFormat format, const std::vector<UploadManager::ImageLevel>& levels)
+{
+    assert(!levels.empty());
+    const uint32_t mipLevels = static_cast<uint32_t>(levels.size());
 
-    renderer.CopyBufferToImage(stagingBuffer, m_image, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+    Create(renderer, format, levels[0].width, levels[0].height, mipLevels, false);
 
-    renderer.TransitionImageLayout(m_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // staged right away, one copy per level is recorded with the next flush of the upload manager
+    renderer.m_uploadManager.UploadImage(m_image, levels.data(), mipLevels, mipLevels);
+}
 
-    vkDestroyBuffer(renderer.m_device, stagingBuffer, nullptr);
-    vkFreeMemory(renderer.m_device, stagingBufferMemory, nullptr);
+void GpuImage::CreateFromContainer(Renderer& renderer, const TextureContainer& container)
+{
+    std::vector<UploadManager::ImageLevel> levels;
+    const uint32_t mipLevels = renderer.m_textureSettings.mipmaps ? container.GetHeader().mipLevels : 1;
+    for (uint32_t mip = 0; mip < mipLevels; ++mip)
+    {
+        const TextureContainer::Level& level = container.GetLevels()[mip];
+        levels.push_back({ container.GetLevelData(mip), level.size, level.width, level.height });
+    }
 
-    m_view = CreateImageView(renderer, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+    CreateFromMipLevels(renderer, container.GetFormat(), levels);
 }
 
-void GpuImage::CreateFromTextureFile(Renderer& renderer, const char* texturePath)
+bool GpuImage::CreateFromTextureFile(Renderer& renderer, const char* texturePath)
 {
     // texture -> staging buffer -> copy -> local GPU buffer
+    TextureSource source;
+    const bool loaded = PrepareTextureFile(texturePath, GetTextureCapabilities(renderer.m_physicalDevice, renderer.m_textureSettings), source);
+    if (!loaded)
+    {
+        std::cout << "Texture: can't read " << texturePath << ", using the missing texture" << std::endl;
+    }
+
+    Create(renderer, source.format, source.levels[0].width, source.levels[0].height, source.mipLevels, source.NeedsBlits());
+    renderer.m_uploadManager.UploadImage(m_image, source.levels.data(), static_cast<uint32_t>(source.levels.size()), source.mipLevels);
+    return loaded;
+}
+
+TextureBatch GpuImage::LoadBatch(Renderer& renderer, const std::vector<std::string>& texturePaths)
+{
+    const uint32_t count = static_cast<uint32_t>(texturePaths.size());
+    const TextureCapabilities capabilities = GetTextureCapabilities(renderer.m_physicalDevice, renderer.m_textureSettings);
+
+    // Reading, decoding and CPU mips, one texture per job. The loaded flags are bytes, not a std::vector<bool>
+    // whose neighbouring bits would be written by different jobs.
+    std::vector<TextureSource> sources(count);
+    std::vector<uint8_t> loaded(count);
+    renderer.m_workerPool.ParallelFor(count, 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                loaded[i] = PrepareTextureFile(texturePaths[i].c_str(), capabilities, sources[i]);
+            }
+        });
+
+    TextureBatch batch;
+    batch.m_uploadManager = &renderer.m_uploadManager;
+    batch.m_images.resize(count);
+    batch.m_missing.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (!loaded[i])
+        {
+            std::cout << "Texture: can't read " << texturePaths[i] << ", using the missing texture" << std::endl;
+            batch.m_missing[i] = true;
+        }
+    }
+
+    if (count == 0)
+    {
+        return batch;
+    }
+
+    // Device objects on this thread, and where every level goes in one shared staging region
+    std::vector<std::vector<UploadManager::StagedImageLevel>> stagedLevels(count);
+    VkDeviceSize stagingSize = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const TextureSource& source = sources[i];
+        batch.m_images[i].Create(renderer, source.format, source.levels[0].width, source.levels[0].height,
+            source.mipLevels, source.NeedsBlits());
+
+        for (const UploadManager::ImageLevel& level : source.levels)
+        {
+            stagingSize = AlignUp(stagingSize, StagingAlignment);
+            stagedLevels[i].push_back({ stagingSize, level.width, level.height });
+            stagingSize += level.size;
+        }
+    }
+
+    const UploadManager::StagingRegion staging = renderer.m_uploadManager.AllocateStaging(stagingSize);
 
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(texturePath, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    assert(pixels);
+    // The workers copy straight into the mapped staging memory
+    renderer.m_workerPool.ParallelFor(count, 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                for (size_t mip = 0; mip < sources[i].levels.size(); ++mip)
+                {
+                    const UploadManager::ImageLevel& level = sources[i].levels[mip];
+                    memcpy(static_cast<char*>(staging.data) + stagedLevels[i][mip].offset, level.data, level.size);
+                    stagedLevels[i][mip].offset += staging.offset;
+                }
+            }
+        });
 
-    CreateFromImageData(renderer, pixels, texWidth, texHeight);
-    
-    stbi_image_free(pixels);
+    // All copies, blits and layout transitions of the batch go out with one submission
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        renderer.m_uploadManager.UploadStagedImage(batch.m_images[i].m_image, staging.buffer, stagedLevels[i].data(),
+            static_cast<uint32_t>(stagedLevels[i].size()), sources[i].mipLevels);
+    }
+    batch.m_ticket = renderer.m_uploadManager.Flush();
+
+    return batch;
 }
 
 void GpuImage::Release(Renderer& renderer)
 {
     vkDestroyImageView(renderer.m_device, m_view, nullptr);
     vkDestroyImage(renderer.m_device, m_image, nullptr);
-    vkFreeMemory(renderer.m_device, m_deviceMemory, nullptr);
+    renderer.m_allocator.Free(m_allocation);
+
+    m_view = VK_NULL_HANDLE;
+    m_image = VK_NULL_HANDLE;
+    m_mipLevels = 1;
+}
+
+void GpuImage::Create(Renderer& renderer, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, bool blitMips)
+{
+    m_mipLevels = mipLevels;
+
+    // blitted mips are read from the level above them
+    const VkImageUsageFlags usage = (blitMips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0) |
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT /*as a destination for copy from staging buffer*/ | VK_IMAGE_USAGE_SAMPLED_BIT /*as a sampler for shaders*/;
+
+    renderer.CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT /*Bind to local GPU buffer*/, m_image, m_allocation, m_mipLevels);
+
+    m_view = CreateImageView(renderer, format, VK_IMAGE_ASPECT_COLOR_BIT);
 }
 
 VkImageView GpuImage::CreateImageView(Renderer& renderer, VkFormat format, VkImageAspectFlags aspectFlags)
@@ -79,12 +365,34 @@ VkImageView GpuImage::CreateImageView(Renderer& renderer, VkFormat format, VkIma
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectFlags;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = m_mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
     VkImageView imageView;
-    assert(vkCreateImageView(renderer.m_device, &viewInfo, nullptr, &imageView) == VK_SUCCESS);
+    VK_CHECK(vkCreateImageView(renderer.m_device, &viewInfo, nullptr, &imageView));
 
     return imageView;
 }
+
+VkDeviceSize TextureBatch::GetMemorySize() const
+{
+    VkDeviceSize size = 0;
+    for (const GpuImage& image : m_images)
+    {
+        size += image.m_allocation.size;
+    }
+    return size;
+}
+
+void TextureBatch::Release(Renderer& renderer)
+{
+    for (GpuImage& image : m_images)
+    {
+        image.Release(renderer);
+    }
+    m_images.clear();
+    m_missing.clear();
+    m_uploadManager = nullptr;
+    m_ticket = 0;
+}
@@ -1,25 +1,94 @@
-
 #pragma once
 
+#include <GpuMemoryAllocator.h>
+#include <UploadManager.h>
+#include <cstdint>
+#include <string>
+#include <vector>
 #include <vulkan/vulkan_core.h>
 
 class Renderer;
+class TextureBatch;
+class TextureContainer;
+
+struct TextureSettings
+{
+    bool mipmaps = true;         // false: only the full resolution level, to compare against
+    float maxAnisotropy = 16.0f; // clamped to the device limit, 1 or less disables anisotropic filtering
+    uint32_t streamingBudgetMB = 256; // for the streamed mips, the mip tails are always resident
+};
 
 class GpuImage
 {
 public:
-    void CreateDepthImage(Renderer& renderer, VkExtent2D swapChainExtent);
-
+    // Full mip chain: blitted on the GPU if the format supports linear filtering, box filtered on the CPU otherwise
     void CreateFromImageData(Renderer& renderer, const unsigned char* imageData, int width, int height);
 
-    void CreateFromTextureFile(Renderer& renderer, const char* texturePath);
+    // Precomputed mips, levels[0] is the full resolution and every following one halves it
+    void CreateFromMipLevels(Renderer& renderer, VkFormat format, const std::vector<UploadManager::ImageLevel>& levels);
+
+    // No decoding, the levels of the container are staged as they are
+    void CreateFromContainer(Renderer& renderer, const TextureContainer& container);
+
+    // Prefers a cooked .stex next to the image (same name, see TextureCooker) if the device can sample its format.
+    // False if neither can be read or decoded, the image is a small checker then.
+    bool CreateFromTextureFile(Renderer& renderer, const char* texturePath);
+
+    /*
+     * Loads many textures at once: files are read and decoded on the worker pool, the levels of all of them are
+     * copied by the workers into one staging region and everything is uploaded with a single submission.
+     * The texture at index i of texturePaths is handle i of the batch. A file that can't be read or decoded still
+     * gets its image, a small checker, and TextureBatch::IsMissing reports it.
+     */
+    static TextureBatch LoadBatch(Renderer& renderer, const std::vector<std::string>& texturePaths);
+
+    // Image and view without any data, for callers that stage the levels themselves. With blitMips only the first
+    // level is uploaded and the rest blitted from it.
+    void Create(Renderer& renderer, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, bool blitMips = false);
+
     void Release(Renderer& renderer);
 
+    static uint32_t GetMipLevelCount(uint32_t width, uint32_t height);
+
     VkImage         m_image = VK_NULL_HANDLE;
-    VkDeviceMemory  m_deviceMemory = VK_NULL_HANDLE;
+    GpuAllocation   m_allocation;
     VkImageView     m_view = VK_NULL_HANDLE;
+    uint32_t        m_mipLevels = 1;
 
 private:
     VkImageView CreateImageView(Renderer& renderer, VkFormat format, VkImageAspectFlags aspectFlags);
 };
 
+using TextureHandle = uint32_t;
+
+/*
+ * Textures of one GpuImage::LoadBatch call. Images and views exist right away and can be referenced by anything
+ * submitted to the graphics queue afterwards, the upload comes first in queue order. The batch becomes ready when
+ * the upload's fence signals: the data is resident and the staging memory is gone, waiting on it is only needed
+ * to know the loading is over.
+ */
+class TextureBatch
+{
+public:
+    bool IsReady() const { return m_uploadManager == nullptr || m_uploadManager->IsComplete(m_ticket); }
+    void Wait() { if (m_uploadManager) { m_uploadManager->Wait(m_ticket); } }
+
+    uint32_t GetCount() const { return static_cast<uint32_t>(m_images.size()); }
+    const GpuImage& Get(TextureHandle handle) const { return m_images[handle]; }
+    // The file couldn't be read or decoded, the image is the missing texture checker
+    bool IsMissing(TextureHandle handle) const { return m_missing[handle]; }
+
+    // Device memory of all images, mips included
+    VkDeviceSize GetMemorySize() const;
+
+    // The frames in flight must be done with the images
+    void Release(Renderer& renderer);
+
+private:
+    friend class GpuImage;
+
+    std::vector<GpuImage> m_images;
+    std::vector<bool> m_missing;
+    UploadManager* m_uploadManager = nullptr;
+    UploadManager::Ticket m_ticket = 0;
+};
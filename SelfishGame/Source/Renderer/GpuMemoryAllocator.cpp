@@ -0,0 +1,572 @@
+
+#include "GpuMemoryAllocator.h"
+
+#include <Utilities.h>
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+struct GpuMemoryBlock
+{
+    struct Range
+    {
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        GpuResourceKind kind = GpuResourceKind::Free;
+        void* userData = nullptr;
+        VkDeviceSize alignment = 1;
+    };
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+    uint32_t memoryType = 0;
+    bool dedicated = false;
+
+    // Sorted by offset, always covers the whole block
+    std::vector<Range> ranges;
+    VkDeviceSize usedBytes = 0;
+    uint32_t allocationCount = 0;
+};
+
+namespace
+{
+    // bufferImageGranularity is a power of two, so a "page" is the offset with the low bits cleared
+    bool OnSamePage(VkDeviceSize lastByteOfA, VkDeviceSize firstByteOfB, VkDeviceSize pageSize)
+    {
+        return (lastByteOfA & ~(pageSize - 1)) == (firstByteOfB & ~(pageSize - 1));
+    }
+
+    bool KindsConflict(GpuResourceKind a, GpuResourceKind b)
+    {
+        return a != GpuResourceKind::Free && b != GpuResourceKind::Free && a != b;
+    }
+
+    GpuAllocation MakeAllocation(GpuMemoryBlock& block, const GpuMemoryBlock::Range& range)
+    {
+        GpuAllocation allocation;
+        allocation.memory = block.memory;
+        allocation.offset = range.offset;
+        allocation.size = range.size;
+        allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + range.offset : nullptr;
+        allocation.memoryType = block.memoryType;
+        allocation.block = &block;
+        return allocation;
+    }
+}
+
+GpuMemoryAllocator::GpuMemoryAllocator() = default;
+
+GpuMemoryAllocator::~GpuMemoryAllocator() = default;
+
+void GpuMemoryAllocator::Init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+{
+    m_device = device;
+    m_blockSize = blockSize;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_bufferImageGranularity = std::max<VkDeviceSize>(1, properties.limits.bufferImageGranularity);
+    m_maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+
+void GpuMemoryAllocator::Release()
+{
+    for (auto& block : m_blocks)
+    {
+        if (block->allocationCount > 0)
+        {
+            std::cout << "GpuMemoryAllocator: " << block->allocationCount << " allocation(s) leaked in memory type "
+                << block->memoryType << std::endl;
+        }
+
+        if (block->mapped)
+        {
+            vkUnmapMemory(m_device, block->memory);
+        }
+        vkFreeMemory(m_device, block->memory, nullptr);
+    }
+
+    m_blocks.clear();
+    m_deviceAllocationCount = 0;
+}
+
+VkResult GpuMemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+    GpuResourceKind kind, GpuAllocation& allocation, void* userData)
+{
+    assert(kind != GpuResourceKind::Free);
+
+    allocation = {};
+
+    uint32_t memoryType = 0;
+    VkResult result = FindMemoryType(requirements.memoryTypeBits, properties, memoryType);
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    result = AllocateOfType(requirements, memoryType, kind, userData, allocation);
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY)
+    {
+        // The single empty block kept per memory type still holds device memory, give those back and try again
+        ReleaseEmptyBlocks();
+        result = AllocateOfType(requirements, memoryType, kind, userData, allocation);
+    }
+
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && (properties & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+    {
+        // Slower memory the device can still reach beats failing, skip every type of the exhausted heap
+        const uint32_t exhaustedHeap = m_memoryProperties.memoryTypes[memoryType].heapIndex;
+        uint32_t otherHeapTypes = 0;
+        for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i)
+        {
+            if (m_memoryProperties.memoryTypes[i].heapIndex != exhaustedHeap)
+            {
+                otherHeapTypes |= 1u << i;
+            }
+        }
+
+        uint32_t fallbackType = 0;
+        if (FindMemoryType(requirements.memoryTypeBits & otherHeapTypes, properties & ~VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            fallbackType) == VK_SUCCESS)
+        {
+            std::cout << "GpuMemoryAllocator: heap " << exhaustedHeap << " is out of memory, falling back to memory type "
+                << fallbackType << " for " << requirements.size << " bytes" << std::endl;
+            result = AllocateOfType(requirements, fallbackType, kind, userData, allocation);
+        }
+    }
+
+    return result;
+}
+
+void GpuMemoryAllocator::Free(GpuAllocation& allocation)
+{
+    GpuMemoryBlock* block = allocation.block;
+    if (!block)
+    {
+        return;
+    }
+
+    auto& ranges = block->ranges;
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), allocation.offset,
+        [](const GpuMemoryBlock::Range& range, VkDeviceSize offset) { return range.offset < offset; });
+    assert(it != ranges.end() && it->offset == allocation.offset && it->kind != GpuResourceKind::Free);
+
+    block->usedBytes -= it->size;
+    block->allocationCount--;
+
+    it->kind = GpuResourceKind::Free;
+    it->userData = nullptr;
+
+    // Merge with the free neighbours
+    auto next = it + 1;
+    if (next != ranges.end() && next->kind == GpuResourceKind::Free)
+    {
+        it->size += next->size;
+        it = ranges.erase(next) - 1;
+    }
+    if (it != ranges.begin())
+    {
+        auto previous = it - 1;
+        if (previous->kind == GpuResourceKind::Free)
+        {
+            previous->size += it->size;
+            ranges.erase(it);
+        }
+    }
+
+    allocation = {};
+
+    if (block->allocationCount == 0)
+    {
+        // Keep a single empty block per memory type around, staging buffers come and go all the time
+        const bool hasOtherEmptyBlock = std::any_of(m_blocks.begin(), m_blocks.end(), [block](const auto& other)
+            {
+                return other.get() != block && !other->dedicated && other->memoryType == block->memoryType &&
+                    other->allocationCount == 0;
+            });
+
+        if (block->dedicated || hasOtherEmptyBlock)
+        {
+            DestroyBlock(block);
+        }
+    }
+}
+
+VkResult GpuMemoryAllocator::AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, GpuAllocation& allocation,
+    void* userData)
+{
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
+
+    VkResult result = Allocate(memRequirements, properties, GpuResourceKind::Linear, allocation, userData);
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    result = vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset);
+    if (result != VK_SUCCESS)
+    {
+        Free(allocation);
+    }
+
+    return result;
+}
+
+VkResult GpuMemoryAllocator::AllocateForImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties,
+    GpuAllocation& allocation, void* userData)
+{
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(m_device, image, &memRequirements);
+
+    const GpuResourceKind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? GpuResourceKind::Optimal : GpuResourceKind::Linear;
+
+    VkResult result = Allocate(memRequirements, properties, kind, allocation, userData);
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    result = vkBindImageMemory(m_device, image, allocation.memory, allocation.offset);
+    if (result != VK_SUCCESS)
+    {
+        Free(allocation);
+    }
+
+    return result;
+}
+
+uint32_t GpuMemoryAllocator::Defragment(VkDeviceSize maxBytesToMove, const DefragmentationCallback& moveAllocation)
+{
+    uint32_t movedCount = 0;
+    VkDeviceSize movedBytes = 0;
+
+    for (uint32_t memoryType = 0; memoryType < m_memoryProperties.memoryTypeCount; ++memoryType)
+    {
+        std::vector<GpuMemoryBlock*> blocks;
+        for (auto& block : m_blocks)
+        {
+            if (!block->dedicated && block->memoryType == memoryType && block->allocationCount > 0)
+            {
+                blocks.push_back(block.get());
+            }
+        }
+
+        if (blocks.size() < 2)
+        {
+            continue;
+        }
+
+        // Try to empty the least used block into the others
+        std::sort(blocks.begin(), blocks.end(), [](const GpuMemoryBlock* a, const GpuMemoryBlock* b)
+            {
+                return a->usedBytes < b->usedBytes;
+            });
+
+        GpuMemoryBlock& source = *blocks.front();
+
+        const std::vector<GpuMemoryBlock::Range> sourceRanges = source.ranges;
+        for (const auto& range : sourceRanges)
+        {
+            if (range.kind == GpuResourceKind::Free)
+            {
+                continue;
+            }
+
+            if (movedBytes + range.size > maxBytesToMove)
+            {
+                return movedCount;
+            }
+
+            GpuAllocation to;
+            bool found = false;
+            for (size_t i = 1; i < blocks.size() && !found; ++i)
+            {
+                found = AllocateFromBlock(*blocks[i], range.size, range.alignment, range.kind, range.userData, to);
+            }
+
+            if (!found)
+            {
+                break;
+            }
+
+            GpuAllocation from = MakeAllocation(source, range);
+            const bool lastRange = source.allocationCount == 1;
+
+            if (moveAllocation(range.userData, from, to))
+            {
+                ++movedCount;
+                movedBytes += range.size;
+                Free(from);
+            }
+            else
+            {
+                Free(to);
+            }
+
+            if (lastRange)
+            {
+                break; // the source block might be gone now
+            }
+        }
+    }
+
+    ReleaseEmptyBlocks();
+
+    return movedCount;
+}
+
+void GpuMemoryAllocator::ReleaseEmptyBlocks()
+{
+    std::vector<GpuMemoryBlock*> emptyBlocks;
+    for (auto& block : m_blocks)
+    {
+        if (block->allocationCount == 0)
+        {
+            emptyBlocks.push_back(block.get());
+        }
+    }
+
+    for (GpuMemoryBlock* block : emptyBlocks)
+    {
+        DestroyBlock(block);
+    }
+}
+
+GpuMemoryStats GpuMemoryAllocator::GetStats() const
+{
+    GpuMemoryStats stats;
+    for (const auto& block : m_blocks)
+    {
+        AddBlockStats(*block, stats);
+    }
+    return stats;
+}
+
+GpuMemoryStats GpuMemoryAllocator::GetMemoryTypeStats(uint32_t memoryType) const
+{
+    GpuMemoryStats stats;
+    for (const auto& block : m_blocks)
+    {
+        if (block->memoryType == memoryType)
+        {
+            AddBlockStats(*block, stats);
+        }
+    }
+    return stats;
+}
+
+VkResult GpuMemoryAllocator::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, uint32_t& memoryType) const
+{
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            memoryType = i;
+            return VK_SUCCESS;
+        }
+    }
+
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+}
+
+VkResult GpuMemoryAllocator::AllocateOfType(const VkMemoryRequirements& requirements, uint32_t memoryType, GpuResourceKind kind,
+    void* userData, GpuAllocation& allocation)
+{
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(1, requirements.alignment);
+
+    // Big resources would waste most of a block, give them their own memory
+    const bool dedicated = requirements.size > m_blockSize / 2;
+    if (!dedicated)
+    {
+        for (auto& block : m_blocks)
+        {
+            if (!block->dedicated && block->memoryType == memoryType &&
+                AllocateFromBlock(*block, requirements.size, alignment, kind, userData, allocation))
+            {
+                return VK_SUCCESS;
+            }
+        }
+    }
+
+    GpuMemoryBlock* block = nullptr;
+    VkResult result = CreateBlock(memoryType, dedicated ? requirements.size : m_blockSize, dedicated, block);
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && !dedicated)
+    {
+        // A whole block doesn't fit into the heap anymore, the request on its own still might
+        result = CreateBlock(memoryType, requirements.size, true, block);
+    }
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    // A new block starts at offset 0 and holds at least the requested size
+    const bool allocated = AllocateFromBlock(*block, requirements.size, alignment, kind, userData, allocation);
+    assert(allocated);
+    (void)allocated;
+
+    return VK_SUCCESS;
+}
+
+VkResult GpuMemoryAllocator::CreateBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated, GpuMemoryBlock*& block)
+{
+    if (m_deviceAllocationCount >= m_maxAllocationCount)
+    {
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+
+    auto newBlock = std::make_unique<GpuMemoryBlock>();
+    newBlock->size = size;
+    newBlock->memoryType = memoryType;
+    newBlock->dedicated = dedicated;
+    newBlock->ranges.push_back({ 0, size, GpuResourceKind::Free, nullptr });
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    VkResult result = vkAllocateMemory(m_device, &allocInfo, nullptr, &newBlock->memory);
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    // Persistently map host visible memory, a VkDeviceMemory can only be mapped once
+    if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        result = vkMapMemory(m_device, newBlock->memory, 0, VK_WHOLE_SIZE, 0, &newBlock->mapped);
+        if (result != VK_SUCCESS)
+        {
+            vkFreeMemory(m_device, newBlock->memory, nullptr);
+            return result;
+        }
+    }
+
+    ++m_deviceAllocationCount;
+    m_blocks.push_back(std::move(newBlock));
+    block = m_blocks.back().get();
+    return VK_SUCCESS;
+}
+
+void GpuMemoryAllocator::DestroyBlock(GpuMemoryBlock* block)
+{
+    auto it = std::find_if(m_blocks.begin(), m_blocks.end(), [block](const auto& other) { return other.get() == block; });
+    assert(it != m_blocks.end());
+
+    if (block->mapped)
+    {
+        vkUnmapMemory(m_device, block->memory);
+    }
+    vkFreeMemory(m_device, block->memory, nullptr);
+    --m_deviceAllocationCount;
+
+    m_blocks.erase(it);
+}
+
+bool GpuMemoryAllocator::AllocateFromBlock(GpuMemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment,
+    GpuResourceKind kind, void* userData, GpuAllocation& allocation)
+{
+    auto& ranges = block.ranges;
+
+    // Best fit: pick the smallest free range that can hold the request
+    size_t bestIndex = ranges.size();
+    VkDeviceSize bestStart = 0;
+    VkDeviceSize bestWaste = ~VkDeviceSize(0);
+
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const auto& range = ranges[i];
+        if (range.kind != GpuResourceKind::Free || range.size < size)
+        {
+            continue;
+        }
+
+        VkDeviceSize start = AlignUp(range.offset, alignment);
+
+        if (m_bufferImageGranularity > 1 && i > 0)
+        {
+            const auto& previous = ranges[i - 1];
+            if (KindsConflict(previous.kind, kind) && OnSamePage(previous.offset + previous.size - 1, start, m_bufferImageGranularity))
+            {
+                start = AlignUp(start, m_bufferImageGranularity);
+            }
+        }
+
+        const VkDeviceSize end = start + size;
+        const VkDeviceSize rangeEnd = range.offset + range.size;
+        if (end > rangeEnd)
+        {
+            continue;
+        }
+
+        if (m_bufferImageGranularity > 1 && i + 1 < ranges.size())
+        {
+            const auto& next = ranges[i + 1];
+            if (KindsConflict(next.kind, kind) && OnSamePage(end - 1, next.offset, m_bufferImageGranularity))
+            {
+                continue;
+            }
+        }
+
+        const VkDeviceSize waste = range.size - size;
+        if (waste < bestWaste)
+        {
+            bestIndex = i;
+            bestStart = start;
+            bestWaste = waste;
+        }
+    }
+
+    if (bestIndex == ranges.size())
+    {
+        return false;
+    }
+
+    const GpuMemoryBlock::Range freeRange = ranges[bestIndex];
+    const VkDeviceSize end = bestStart + size;
+    const VkDeviceSize freeEnd = freeRange.offset + freeRange.size;
+
+    std::vector<GpuMemoryBlock::Range> split;
+    if (bestStart > freeRange.offset)
+    {
+        split.push_back({ freeRange.offset, bestStart - freeRange.offset, GpuResourceKind::Free, nullptr });
+    }
+    split.push_back({ bestStart, size, kind, userData, alignment });
+    if (end < freeEnd)
+    {
+        split.push_back({ end, freeEnd - end, GpuResourceKind::Free, nullptr });
+    }
+
+    ranges.erase(ranges.begin() + bestIndex);
+    ranges.insert(ranges.begin() + bestIndex, split.begin(), split.end());
+
+    block.usedBytes += size;
+    block.allocationCount++;
+
+    allocation = MakeAllocation(block, split[bestStart > freeRange.offset ? 1 : 0]);
+    return true;
+}
+
+void GpuMemoryAllocator::AddBlockStats(const GpuMemoryBlock& block, GpuMemoryStats& stats) const
+{
+    stats.blockCount++;
+    if (block.dedicated)
+    {
+        stats.dedicatedBlockCount++;
+    }
+    stats.allocationCount += block.allocationCount;
+    stats.reservedBytes += block.size;
+    stats.usedBytes += block.usedBytes;
+
+    for (const auto& range : block.ranges)
+    {
+        if (range.kind == GpuResourceKind::Free)
+        {
+            stats.largestFreeRange = std::max(stats.largestFreeRange, range.size);
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+struct GpuMemoryBlock;
+
+/*
+ * Resources that live next to each other in the same VkDeviceMemory have to respect bufferImageGranularity:
+ * a linear resource (buffer, linear image) and an optimal tiling image may not share a "page" of that size.
+ */
+enum class GpuResourceKind : uint8_t
+{
+    Free,
+    Linear,
+    Optimal,
+};
+
+// A sub-range of a device memory block, handed out by GpuMemoryAllocator
+struct GpuAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr; // already offset, only set for host visible memory
+    uint32_t memoryType = 0;
+
+    GpuMemoryBlock* block = nullptr;
+
+    bool IsValid() const { return memory != VK_NULL_HANDLE; }
+};
+
+struct GpuMemoryStats
+{
+    uint32_t blockCount = 0;
+    uint32_t dedicatedBlockCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize reservedBytes = 0; // sum of all vkAllocateMemory sizes
+    VkDeviceSize usedBytes = 0;     // sum of all live sub-allocations
+    VkDeviceSize largestFreeRange = 0;
+};
+
+/*
+ * Block based device memory allocator.
+ *
+ * Instead of one vkAllocateMemory per resource, memory is reserved in large blocks per memory type and resources
+ * are sub-allocated from them. This keeps us far away from maxMemoryAllocationCount (which can be as low as 4096)
+ * and makes creating/destroying short-lived resources like staging buffers cheap.
+ * Host visible blocks are persistently mapped, so there is no need to call vkMapMemory on a sub-allocation.
+ */
+class GpuMemoryAllocator
+{
+public:
+    GpuMemoryAllocator();
+    ~GpuMemoryAllocator();
+
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64ull * 1024 * 1024);
+    void Release();
+
+    /*
+     * Failures come back as the VkResult of the Vulkan call that failed, allocation is left invalid then.
+     * When a device local heap is exhausted, empty cached blocks are given back first, then the request falls back
+     * to a memory type of another heap with the same properties minus DEVICE_LOCAL.
+     * VK_ERROR_FEATURE_NOT_PRESENT means no memory type has the requested properties.
+     */
+    VkResult Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+        GpuResourceKind kind, GpuAllocation& allocation, void* userData = nullptr);
+    void Free(GpuAllocation& allocation);
+
+    // Allocate memory for the resource and bind it
+    VkResult AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, GpuAllocation& allocation,
+        void* userData = nullptr);
+    VkResult AllocateForImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties,
+        GpuAllocation& allocation, void* userData = nullptr);
+
+    /*
+     * Defragmentation hook. The allocator only knows about memory ranges, not about the resources bound to them,
+     * so moving is left to the owner: for every allocation from a sparsely used block the callback receives the
+     * userData given at allocation time, the current range and a new range in a denser block. The owner
+     * recreates and binds its resource to the new range, copies the contents and returns true; the old range is freed.
+     * Returning false keeps the resource where it is.
+     */
+    using DefragmentationCallback = std::function<bool(void* userData, const GpuAllocation& from, const GpuAllocation& to)>;
+    uint32_t Defragment(VkDeviceSize maxBytesToMove, const DefragmentationCallback& moveAllocation);
+
+    // Return blocks without any live allocations back to the driver
+    void ReleaseEmptyBlocks();
+
+    GpuMemoryStats GetStats() const;
+    GpuMemoryStats GetMemoryTypeStats(uint32_t memoryType) const;
+
+    VkResult FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, uint32_t& memoryType) const;
+
+private:
+    VkResult AllocateOfType(const VkMemoryRequirements& requirements, uint32_t memoryType, GpuResourceKind kind,
+        void* userData, GpuAllocation& allocation);
+    VkResult CreateBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated, GpuMemoryBlock*& block);
+    void DestroyBlock(GpuMemoryBlock* block);
+    bool AllocateFromBlock(GpuMemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, GpuResourceKind kind,
+        void* userData, GpuAllocation& allocation);
+    void AddBlockStats(const GpuMemoryBlock& block, GpuMemoryStats& stats) const;
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties{};
+    VkDeviceSize m_blockSize = 0;
+    VkDeviceSize m_bufferImageGranularity = 1;
+    uint32_t m_maxAllocationCount = 0;
+    uint32_t m_deviceAllocationCount = 0;
+
+    std::vector<std::unique_ptr<GpuMemoryBlock>> m_blocks;
+};
@@ -0,0 +1,167 @@
+#include "GpuProfiler.h"
+
+#include <VulkanCheck.h>
+#include <cassert>
+#include <cstring>
+#include <imgui.h>
+
+namespace
+{
+    // Weight of the newest frame in the displayed average
+    constexpr double AverageWeight = 0.05;
+}
+
+void GpuProfiler::Init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount)
+{
+    m_device = device;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    const uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    if (validBits == 0)
+    {
+        return;
+    }
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_timestampPeriodNs = properties.limits.timestampPeriod;
+    m_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = MaxScopesPerFrame * 2;
+
+    m_frames.resize(frameCount);
+    for (Frame& frame : m_frames)
+    {
+        VK_CHECK(vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &frame.queryPool));
+        frame.scopes.reserve(MaxScopesPerFrame);
+    }
+
+    m_timestamps.resize(MaxScopesPerFrame * 2);
+}
+
+void GpuProfiler::Release()
+{
+    for (Frame& frame : m_frames)
+    {
+        vkDestroyQueryPool(m_device, frame.queryPool, nullptr);
+    }
+    m_frames.clear();
+    m_results.clear();
+}
+
+bool GpuProfiler::BeginFrame(uint32_t frameIndex)
+{
+    if (!IsEnabled())
+    {
+        return false;
+    }
+
+    m_currentFrame = frameIndex;
+    m_depth = 0;
+
+    Frame& frame = m_frames[frameIndex];
+    const bool recorded = frame.recorded && !frame.scopes.empty();
+    frame.recorded = false;
+
+    bool readBack = false;
+    if (recorded)
+    {
+        // The fence has been waited for, the results are there without VK_QUERY_RESULT_WAIT_BIT
+        const uint32_t queryCount = static_cast<uint32_t>(frame.scopes.size()) * 2;
+        const VkResult result = vkGetQueryPoolResults(m_device, frame.queryPool, 0, queryCount,
+            queryCount * sizeof(uint64_t), m_timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+        if (result == VK_SUCCESS)
+        {
+            // Keep the averages of scopes that are still in the same place
+            const std::vector<GpuScopeResult> previous = std::move(m_results);
+            m_results.resize(frame.scopes.size());
+
+            for (size_t i = 0; i < frame.scopes.size(); ++i)
+            {
+                const uint64_t begin = m_timestamps[i * 2] & m_timestampMask;
+                const uint64_t end = m_timestamps[i * 2 + 1] & m_timestampMask;
+
+                GpuScopeResult& scope = m_results[i];
+                scope.name = frame.scopes[i].name;
+                scope.depth = frame.scopes[i].depth;
+                scope.ms = static_cast<double>((end - begin) & m_timestampMask) * m_timestampPeriodNs / 1000000.0;
+
+                const bool samePlace = i < previous.size() && strcmp(previous[i].name, scope.name) == 0;
+                scope.averageMs = samePlace ? previous[i].averageMs + (scope.ms - previous[i].averageMs) * AverageWeight : scope.ms;
+            }
+            readBack = true;
+        }
+    }
+
+    frame.scopes.clear();
+    return readBack;
+}
+
+void GpuProfiler::ResetQueries(VkCommandBuffer commandBuffer)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    Frame& frame = m_frames[m_currentFrame];
+    vkCmdResetQueryPool(commandBuffer, frame.queryPool, 0, MaxScopesPerFrame * 2);
+    frame.recorded = true;
+}
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+    if (!IsEnabled())
+    {
+        return InvalidScope;
+    }
+
+    Frame& frame = m_frames[m_currentFrame];
+    if (frame.scopes.size() == MaxScopesPerFrame)
+    {
+        return InvalidScope;
+    }
+
+    const uint32_t scope = static_cast<uint32_t>(frame.scopes.size());
+    frame.scopes.push_back({ name, m_depth++ });
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.queryPool, scope * 2);
+    return scope;
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    if (scope == InvalidScope)
+    {
+        return;
+    }
+
+    --m_depth;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_frames[m_currentFrame].queryPool, scope * 2 + 1);
+}
+
+void GpuProfiler::DrawImGui() const
+{
+    ImGui::SetNextWindowPos(ImVec2(260, 0), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(250, 150), ImGuiCond_FirstUseEver);
+    ImGui::Begin("GPU Profiler");
+
+    if (!IsEnabled())
+    {
+        ImGui::Text("no timestamp support");
+    }
+
+    for (const GpuScopeResult& scope : m_results)
+    {
+        ImGui::Text("%*s%-16s %6.3f ms", static_cast<int>(scope.depth * 2), "", scope.name, scope.averageMs);
+    }
+
+    ImGui::End();
+}
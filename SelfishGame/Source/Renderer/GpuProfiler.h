@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+struct GpuScopeResult
+{
+    const char* name = nullptr; // the string passed to BeginScope, has to outlive the profiler
+    uint32_t depth = 0;         // nesting level, 0 for the outermost scopes
+    double ms = 0.0;
+    double averageMs = 0.0;     // smoothed over the last frames, for display
+};
+
+/*
+ * Named GPU timing scopes from timestamp queries.
+ *
+ * Every frame in flight has its own query pool. The queries of a frame are reset at the start of its primary
+ * command buffer and read back the next time the frame comes around, after its fence has been waited for, so
+ * reading the results never stalls. Scopes can be written into secondary command buffers as long as those are
+ * executed by the primary of the same frame, after ResetQueries.
+ *
+ * Not thread safe, scopes are opened and closed on the main thread only.
+ */
+class GpuProfiler
+{
+public:
+    static constexpr uint32_t MaxScopesPerFrame = 32;
+    static constexpr uint32_t InvalidScope = ~0u;
+
+    // Without timestamp support on the queue family the profiler stays disabled and every call is a no-op
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount);
+    void Release();
+
+    bool IsEnabled() const { return !m_frames.empty(); }
+
+    // Call after waiting for the frame's fence. Returns true if the frame's previous results were read back.
+    bool BeginFrame(uint32_t frameIndex);
+
+    // First thing in the frame's primary command buffer, outside of a render pass
+    void ResetQueries(VkCommandBuffer commandBuffer);
+
+    uint32_t BeginScope(VkCommandBuffer commandBuffer, const char* name);
+    void EndScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    // Scopes of the last frame that was read back, in the order they were opened
+    const std::vector<GpuScopeResult>& GetResults() const { return m_results; }
+
+    void DrawImGui() const;
+
+private:
+    struct Scope
+    {
+        const char* name;
+        uint32_t depth;
+    };
+
+    struct Frame
+    {
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        std::vector<Scope> scopes; // query 2 * i and 2 * i + 1 belong to scope i
+        bool recorded = false;     // the queries were reset and written since the last read back
+    };
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    double m_timestampPeriodNs = 0.0;
+    uint64_t m_timestampMask = 0;
+
+    std::vector<Frame> m_frames;
+    uint32_t m_currentFrame = 0;
+    uint32_t m_depth = 0;
+
+    std::vector<uint64_t> m_timestamps;
+    std::vector<GpuScopeResult> m_results;
+};
+
+// Times the commands recorded while it is alive
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name)
+        : m_profiler(profiler), m_commandBuffer(commandBuffer), m_scope(profiler.BeginScope(commandBuffer, name)) {}
+    ~GpuProfileScope() { m_profiler.EndScope(m_commandBuffer, m_scope); }
+
+    GpuProfileScope(const GpuProfileScope&) = delete;
+    GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+    GpuProfiler& m_profiler;
+    VkCommandBuffer m_commandBuffer;
+    uint32_t m_scope;
+};
@@ -0,0 +1,297 @@
+#include "MeshContainer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <Utilities.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+namespace
+{
+    constexpr uint64_t DataAlignment = 16;
+
+    template <typename T>
+    MeshContainer::Section AddSection(uint64_t& offset, const std::vector<T>& items)
+    {
+        const MeshContainer::Section section{ offset, items.size() * sizeof(T) };
+        offset = AlignUp(offset + section.size, DataAlignment);
+        return section;
+    }
+
+    template <typename T>
+    void CopySection(std::vector<char>& data, const MeshContainer::Section& section, const std::vector<T>& items)
+    {
+        if (!items.empty())
+        {
+            memcpy(data.data() + section.offset, items.data(), section.size);
+        }
+    }
+}
+
+bool MeshContainer::MakeKey(const std::string& sourcePath, const MeshLodSettings& settings, Key& key)
+{
+    std::vector<char> source;
+    {
+        std::ifstream file(sourcePath, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        source.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(source.data(), source.size());
+        if (!file)
+        {
+            return false;
+        }
+    }
+
+    key.sourceHash = Hash(source.data(), source.size());
+    key.sourceSize = source.size();
+    key.settingsHash = Hash(&settings, sizeof(settings));
+    return true;
+}
+
+bool MeshContainer::Load(const std::string& path, const Key& key, const char** reason)
+{
+    m_header = {};
+    m_data.clear();
+
+    {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (file.is_open())
+        {
+            m_data.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(m_data.data(), m_data.size());
+        }
+    }
+
+    const char* failure = nullptr;
+    if (m_data.empty())
+    {
+        failure = "no cache file";
+    }
+    else if (m_data.size() < sizeof(Header))
+    {
+        failure = "truncated header";
+    }
+    else
+    {
+        memcpy(&m_header, m_data.data(), sizeof(Header));
+        Validate(key, failure);
+    }
+
+    if (failure != nullptr)
+    {
+        m_header = {};
+        m_data.clear();
+    }
+    if (reason != nullptr)
+    {
+        *reason = failure;
+    }
+    return failure == nullptr;
+}
+
+bool MeshContainer::Validate(const Key& key, const char*& reason) const
+{
+    const Header expected = MakeHeader(key);
+    if (m_header.magic != expected.magic || m_header.version != expected.version)
+    {
+        reason = "unknown file format";
+        return false;
+    }
+    if (m_header.importerVersion != expected.importerVersion)
+    {
+        reason = "different importer version";
+        return false;
+    }
+    if (m_header.vertexStride != expected.vertexStride || m_header.positionFormat != expected.positionFormat ||
+        m_header.texCoordFormat != expected.texCoordFormat)
+    {
+        reason = "different vertex layout";
+        return false;
+    }
+    if (m_header.key.sourceHash != key.sourceHash || m_header.key.sourceSize != key.sourceSize)
+    {
+        reason = "source changed";
+        return false;
+    }
+    if (m_header.key.settingsHash != key.settingsHash)
+    {
+        reason = "different LOD settings";
+        return false;
+    }
+
+    for (const Section& section : { m_header.meshes, m_header.parts, m_header.lods, m_header.vertices, m_header.indices })
+    {
+        if (section.offset % DataAlignment != 0 || section.offset < sizeof(Header) || section.offset > m_data.size() ||
+            section.size > m_data.size() - section.offset)
+        {
+            reason = "truncated data";
+            return false;
+        }
+    }
+
+    if (m_header.dataHash != Hash(m_data.data() + sizeof(Header), m_data.size() - sizeof(Header)))
+    {
+        reason = "corrupted data";
+        return false;
+    }
+
+    // The hash only proves the file is what was written, check that the tables and indices fit together so a bad cook
+    // can't draw out of bounds
+    const uint64_t partCount = m_header.parts.size / sizeof(Part);
+    const uint64_t lodCount = m_header.lods.size / sizeof(Lod);
+    const uint64_t vertexCount = m_header.vertices.size / m_header.vertexStride;
+    const uint64_t indexCount = m_header.indices.size / sizeof(uint16_t);
+    const uint16_t* indices = Table<uint16_t>(m_header.indices);
+    if (m_header.meshes.size != uint64_t(m_header.meshCount) * sizeof(Mesh))
+    {
+        reason = "inconsistent tables";
+        return false;
+    }
+    for (uint32_t meshIndex = 0; meshIndex < m_header.meshCount; ++meshIndex)
+    {
+        const Mesh& mesh = GetMesh(meshIndex);
+        bool valid = uint64_t(mesh.firstPart) + mesh.partCount <= partCount && uint64_t(mesh.firstLod) + mesh.lodCount <= lodCount;
+        for (uint32_t part = 0; valid && part < mesh.partCount; ++part)
+        {
+            const Part& p = GetPart(mesh.firstPart + part);
+            valid = uint64_t(p.firstIndex) + p.indexCount <= indexCount && p.vertexOffset >= 0;
+            if (valid && p.indexCount > 0)
+            {
+                const uint16_t maxIndex = *std::max_element(indices + p.firstIndex, indices + p.firstIndex + p.indexCount);
+                valid = uint64_t(p.vertexOffset) + maxIndex < vertexCount;
+            }
+        }
+        for (uint32_t lod = 0; valid && lod < mesh.lodCount; ++lod)
+        {
+            const Lod& l = GetLod(mesh.firstLod + lod);
+            valid = uint64_t(l.firstPart) + l.partCount <= mesh.partCount;
+        }
+        if (!valid)
+        {
+            reason = "inconsistent tables";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MeshContainer::Build(const std::vector<Asset::FbxLoader::Mesh>& meshes, const Key& key)
+{
+    std::vector<Mesh> meshTable;
+    std::vector<Part> parts;
+    std::vector<Lod> lods;
+    std::vector<GpuVertex> vertices;
+    std::vector<uint16_t> indices;
+
+    for (const Asset::FbxLoader::Mesh& imported : meshes)
+    {
+        // Every mesh is quantized on its own, the culling pass hands the dequantization to the vertex shader
+        Mesh mesh{};
+        mesh.quantization = GpuVertex::ComputeQuantization(imported.m_vertices.data(), imported.m_vertices.size());
+        mesh.vertexOffset = static_cast<int32_t>(vertices.size());
+        mesh.vertexCount = static_cast<uint32_t>(imported.m_vertices.size());
+        if (!imported.m_vertices.empty())
+        {
+            mesh.boundsMin = imported.m_vertices[0].pos;
+            mesh.boundsMax = imported.m_vertices[0].pos;
+        }
+        for (const Vertex& vertex : imported.m_vertices)
+        {
+            mesh.boundsMin = glm::min(mesh.boundsMin, vertex.pos);
+            mesh.boundsMax = glm::max(mesh.boundsMax, vertex.pos);
+            mesh.boundingRadius = std::max(mesh.boundingRadius, glm::length(vertex.pos));
+            vertices.push_back(GpuVertex::Encode(vertex, mesh.quantization));
+        }
+
+        // Indices stay relative to their own part, the draw adds the part's vertexOffset
+        mesh.firstPart = static_cast<uint32_t>(parts.size());
+        mesh.partCount = static_cast<uint32_t>(imported.m_parts.size());
+        for (const Asset::FbxLoader::Part& part : imported.m_parts)
+        {
+            parts.push_back({ static_cast<uint32_t>(indices.size()) + part.m_firstIndex, part.m_indexCount,
+                mesh.vertexOffset + static_cast<int32_t>(part.m_baseVertex) });
+        }
+
+        mesh.firstLod = static_cast<uint32_t>(lods.size());
+        mesh.lodCount = static_cast<uint32_t>(imported.m_lods.size());
+        for (const Asset::FbxLoader::Lod& lod : imported.m_lods)
+        {
+            lods.push_back({ lod.m_firstPart, lod.m_partCount, lod.m_indexCount, lod.m_error });
+        }
+
+        indices.insert(indices.end(), imported.m_indices.begin(), imported.m_indices.end());
+        meshTable.push_back(mesh);
+    }
+
+    m_header = MakeHeader(key);
+    m_header.meshCount = static_cast<uint32_t>(meshTable.size());
+
+    uint64_t offset = AlignUp(sizeof(Header), DataAlignment);
+    m_header.meshes = AddSection(offset, meshTable);
+    m_header.parts = AddSection(offset, parts);
+    m_header.lods = AddSection(offset, lods);
+    m_header.vertices = AddSection(offset, vertices);
+    m_header.indices = AddSection(offset, indices);
+
+    m_data.assign(offset, 0);
+    CopySection(m_data, m_header.meshes, meshTable);
+    CopySection(m_data, m_header.parts, parts);
+    CopySection(m_data, m_header.lods, lods);
+    CopySection(m_data, m_header.vertices, vertices);
+    CopySection(m_data, m_header.indices, indices);
+
+    m_header.dataHash = Hash(m_data.data() + sizeof(Header), m_data.size() - sizeof(Header));
+    memcpy(m_data.data(), &m_header, sizeof(Header));
+}
+
+bool MeshContainer::Write(const std::string& path) const
+{
+    return WriteFileAtomically(path, m_data.data(), m_data.size());
+}
+
+MeshContainer::Header MeshContainer::MakeHeader(const Key& key)
+{
+    constexpr auto attributes = GpuVertex::getAttributeDescriptions();
+
+    Header header{};
+    header.magic = Magic;
+    header.version = Version;
+    header.importerVersion = Asset::FbxLoader::ImporterVersion;
+    header.vertexStride = sizeof(GpuVertex);
+    header.positionFormat = static_cast<uint32_t>(attributes[0].format);
+    header.texCoordFormat = static_cast<uint32_t>(attributes[1].format);
+    header.key = key;
+    return header;
+}
+
+uint64_t MeshContainer::Hash(const void* data, size_t size)
+{
+    // Not FNV-1a proper: it takes 8 byte words with the FNV constants and folds the upper half back in after every
+    // multiply, since the low bits of the product never see the word's upper bits. The source files are large and
+    // this runs on every start, bytes one by one would be 8 times the multiplies.
+    uint64_t hash = 14695981039346656037ull;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Fbx/FbxLoader.h>
+#include <MeshSimplifier.h>
+#include <Vertex.h>
+
+/*
+ * Cooked meshes (.smesh), what the renderer makes of an FBX file, ready to upload.
+ *
+ * Header | Mesh table | Part table | Lod table | vertex data | index data. Vertices are already encoded as
+ * GpuVertex and indices are 16 bit, every section starts 16 byte aligned, so the vertex and index data can be
+ * copied into the buffers straight from the file image (or from a mapping of the file) without touching them.
+ *
+ * The header records what the file was cooked from: hash and size of the source file, the importer version, the
+ * LOD settings and the vertex formats. If any of them doesn't match, or the file is truncated or corrupted, it is
+ * ignored and the source gets imported and cooked again. Like the pipeline cache and the texture containers it is
+ * written to a temporary file first and renamed over the old one.
+ */
+class MeshContainer
+{
+public:
+    struct Section
+    {
+        uint64_t offset; // from the start of the file
+        uint64_t size;
+    };
+
+    // What a cache is valid for, everything has to match
+    struct Key
+    {
+        uint64_t sourceHash;
+        uint64_t sourceSize;
+        uint64_t settingsHash;
+    };
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t importerVersion;
+        uint32_t vertexStride;
+        uint32_t positionFormat; // VkFormat of GpuVertex::pos
+        uint32_t texCoordFormat; // VkFormat of GpuVertex::texCoordinates
+        uint32_t meshCount;
+        uint32_t padding;
+        Key key;
+        uint64_t dataHash;       // of everything after the header
+        Section meshes;
+        Section parts;
+        Section lods;
+        Section vertices;
+        Section indices;
+    };
+
+    // Offsets are into the whole vertex and index data, i.e. ready to be drawn from the shared buffers
+    struct Mesh
+    {
+        VertexQuantization quantization; // of the mesh's GpuVertex data
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        float boundingRadius;            // around the mesh origin
+        int32_t vertexOffset;
+        uint32_t vertexCount;
+        uint32_t firstPart;
+        uint32_t partCount;
+        uint32_t firstLod;
+        uint32_t lodCount;
+        uint32_t padding;
+    };
+
+    struct Part
+    {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t vertexOffset;
+    };
+
+    struct Lod
+    {
+        uint32_t firstPart; // relative to the mesh's firstPart
+        uint32_t partCount;
+        uint32_t indexCount;
+        float error;
+    };
+
+    static constexpr uint32_t Magic = 0x48534D53; // "SMSH"
+    static constexpr uint32_t Version = 1;
+
+    // Hashes the source file, false if it can't be read
+    static bool MakeKey(const std::string& sourcePath, const MeshLodSettings& settings, Key& key);
+
+    // Reads the whole file, false if it is missing, stale or damaged. reason says which.
+    bool Load(const std::string& path, const Key& key, const char** reason = nullptr);
+
+    // Cooks the imported meshes into the file image, Write saves it
+    void Build(const std::vector<Asset::FbxLoader::Mesh>& meshes, const Key& key);
+    bool Write(const std::string& path) const;
+
+    uint32_t GetMeshCount() const { return m_header.meshCount; }
+    const Mesh& GetMesh(uint32_t mesh) const { return Table<Mesh>(m_header.meshes)[mesh]; }
+    const Part& GetPart(uint32_t part) const { return Table<Part>(m_header.parts)[part]; }
+    const Lod& GetLod(uint32_t lod) const { return Table<Lod>(m_header.lods)[lod]; }
+
+    const void* GetVertexData() const { return m_data.data() + m_header.vertices.offset; }
+    uint64_t GetVertexDataSize() const { return m_header.vertices.size; }
+    const void* GetIndexData() const { return m_data.data() + m_header.indices.offset; }
+    uint64_t GetIndexDataSize() const { return m_header.indices.size; }
+
+private:
+    static Header MakeHeader(const Key& key);
+    static uint64_t Hash(const void* data, size_t size);
+    bool Validate(const Key& key, const char*& reason) const;
+
+    template <typename T>
+    const T* Table(const Section& section) const { return reinterpret_cast<const T*>(m_data.data() + section.offset); }
+
+    Header m_header{};
+    std::vector<char> m_data; // the whole file
+};
@@ -0,0 +1,271 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <glm/geometric.hpp>
+
+namespace
+{
+    // Triangles around every vertex, in compressed rows
+    struct TriangleAdjacency
+    {
+        std::vector<uint32_t> offsets; // vertexCount + 1
+        std::vector<uint32_t> triangles;
+
+        TriangleAdjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+            : offsets(vertexCount + 1, 0), triangles(indexCount)
+        {
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                ++offsets[indices[i] + 1];
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+            std::vector<uint32_t> writeOffsets(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                triangles[writeOffsets[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+    };
+
+    constexpr uint32_t NoVertex = ~0u;
+}
+
+void MeshOptimizer::OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& clusterStarts)
+{
+    clusterStarts.clear();
+    if (indexCount == 0)
+    {
+        return;
+    }
+
+    const TriangleAdjacency adjacency(indices, indexCount, vertexCount);
+    const size_t triangleCount = indexCount / 3;
+
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+    {
+        liveTriangles[vertex] = adjacency.offsets[vertex + 1] - adjacency.offsets[vertex];
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0); // when the vertex entered the cache
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds;                   // recently used vertices to continue with when fanning ends
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(indexCount);
+
+    uint32_t time = CacheSize + 1;
+    uint32_t nextInputVertex = 0;
+
+    // Continue with a recently used vertex that still has triangles, otherwise with the next one in input order
+    const auto skipDeadEnd = [&]() -> uint32_t
+        {
+            while (!deadEnds.empty())
+            {
+                const uint32_t vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[vertex] > 0)
+                {
+                    return vertex;
+                }
+            }
+            while (nextInputVertex < vertexCount)
+            {
+                if (liveTriangles[nextInputVertex] > 0)
+                {
+                    return nextInputVertex;
+                }
+                ++nextInputVertex;
+            }
+            return NoVertex;
+        };
+
+    uint32_t fanVertex = skipDeadEnd();
+    clusterStarts.push_back(0);
+    while (fanVertex != NoVertex)
+    {
+        candidates.clear();
+        for (uint32_t i = adjacency.offsets[fanVertex]; i < adjacency.offsets[fanVertex + 1]; ++i)
+        {
+            const uint32_t triangle = adjacency.triangles[i];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+            emitted[triangle] = true;
+
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                const uint32_t vertex = indices[triangle * 3 + corner];
+                result.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                --liveTriangles[vertex];
+
+                if (time - cacheTime[vertex] > CacheSize)
+                {
+                    cacheTime[vertex] = time++;
+                }
+            }
+        }
+
+        // The neighbor that stays in the cache while its remaining triangles are fanned and came in the earliest
+        uint32_t best = NoVertex;
+        int32_t bestPriority = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (liveTriangles[vertex] == 0)
+            {
+                continue;
+            }
+
+            int32_t priority = 0;
+            if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= CacheSize)
+            {
+                priority = static_cast<int32_t>(time - cacheTime[vertex]);
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = vertex;
+            }
+        }
+
+        if (best == NoVertex)
+        {
+            // Nothing around here is left, the next fan starts a new cluster
+            best = skipDeadEnd();
+            if (best != NoVertex && result.size() < indexCount)
+            {
+                clusterStarts.push_back(static_cast<uint32_t>(result.size()));
+            }
+        }
+        fanVertex = best;
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+void MeshOptimizer::OptimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+    const std::vector<uint32_t>& clusterStarts, float threshold)
+{
+    if (clusterStarts.size() < 2)
+    {
+        return;
+    }
+
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+
+    struct Cluster
+    {
+        uint32_t begin;
+        uint32_t end;
+        float sortKey;
+    };
+
+    std::vector<Cluster> clusters(clusterStarts.size());
+    std::vector<glm::vec3> clusterCenters(clusterStarts.size());
+    std::vector<glm::vec3> clusterNormals(clusterStarts.size());
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        clusters[c].begin = clusterStarts[c];
+        clusters[c].end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : static_cast<uint32_t>(indexCount);
+
+        glm::vec3 center(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (uint32_t i = clusters[c].begin; i < clusters[c].end; i += 3)
+        {
+            const glm::vec3& p0 = positions[indices[i]];
+            const glm::vec3& p1 = positions[indices[i + 1]];
+            const glm::vec3& p2 = positions[indices[i + 2]];
+
+            const glm::vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+            const float triangleArea = glm::length(triangleNormal);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += triangleNormal;
+            area += triangleArea;
+        }
+
+        meshCenter += center;
+        meshArea += area;
+        clusterCenters[c] = area > 0.0f ? center / area : positions[indices[clusters[c].begin]];
+        clusterNormals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f);
+    }
+
+    if (meshArea > 0.0f)
+    {
+        meshCenter /= meshArea;
+    }
+
+    // Clusters far out along their own normal occlude the mesh from the directions they face
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        clusters[c].sortKey = glm::dot(clusterCenters[c] - meshCenter, clusterNormals[c]);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indexCount);
+    for (const Cluster& cluster : clusters)
+    {
+        sorted.insert(sorted.end(), indices + cluster.begin, indices + cluster.end);
+    }
+
+    const float acmrBefore = AnalyzeVertexCache(indices, indexCount, vertexCount).acmr;
+    const float acmrAfter = AnalyzeVertexCache(sorted.data(), sorted.size(), vertexCount).acmr;
+    if (acmrAfter <= acmrBefore * threshold)
+    {
+        std::copy(sorted.begin(), sorted.end(), indices);
+    }
+}
+
+uint32_t MeshOptimizer::BuildFetchRemap(uint32_t* indices, size_t indexCount, std::vector<uint32_t>& remap, uint32_t usedCount)
+{
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t& newIndex = remap[indices[i]];
+        if (newIndex == NoVertex)
+        {
+            newIndex = usedCount++;
+        }
+        indices[i] = newIndex;
+    }
+    return usedCount;
+}
+
+VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    VertexCacheStats stats;
+    if (indexCount == 0)
+    {
+        return stats;
+    }
+
+    // FIFO: a vertex is cached if it entered less than cacheSize misses ago
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t misses = 0;
+    uint32_t referencedCount = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        const uint32_t vertex = indices[i];
+        if (cacheTime[vertex] == 0 || misses - cacheTime[vertex] >= cacheSize)
+        {
+            ++misses;
+            cacheTime[vertex] = misses;
+        }
+        if (!referenced[vertex])
+        {
+            referenced[vertex] = true;
+            ++referencedCount;
+        }
+    }
+
+    stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+    stats.atvr = static_cast<float>(misses) / static_cast<float>(referencedCount);
+    return stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+
+// Post-transform cache efficiency of an index list, simulated with a FIFO cache
+struct VertexCacheStats
+{
+    float acmr = 0.0f; // average cache miss ratio: transformed vertices per triangle, 0.5 is ideal for large meshes
+    float atvr = 0.0f; // average transform to vertex ratio: transformed vertices per referenced vertex, 1 is ideal
+};
+
+/*
+ * Reorders triangles and vertices of an indexed triangle list for the GPU, the result renders the same.
+ *
+ * - OptimizeVertexCache: Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+ *   Reduced Overdraw"). Fans around one vertex at a time and continues with the neighbor that is still in the
+ *   cache and has the fewest triangles left. It also returns where the cache was effectively flushed, those
+ *   clusters can be reordered without losing much of the cache efficiency.
+ * - OptimizeOverdraw: sorts the clusters so that the ones facing away from the mesh center are drawn first,
+ *   they are the likely occluders of the rest from any direction. Only kept if ACMR stays within the threshold.
+ * - BuildFetchRemap: numbers the vertices in the order the index list first uses them, so the vertex fetch
+ *   reads the vertex buffer mostly front to back.
+ */
+class MeshOptimizer
+{
+public:
+    static constexpr uint32_t CacheSize = 16;
+
+    // Reorders the triangles of indices in place, clusterStarts receives the first index of every cluster
+    static void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& clusterStarts);
+
+    // Reorders the clusters from OptimizeVertexCache in place, falls back to the original order if the ACMR gets
+    // worse than threshold times what it was
+    static void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+        const std::vector<uint32_t>& clusterStarts, float threshold = 1.05f);
+
+    // New position of every vertex, ~0u for unused ones. Rewrites indices to the new positions and returns the
+    // number of vertices that are left. Several index lists sharing the vertices can be passed one after another
+    // through the same remap, which starts out filled with ~0u.
+    static uint32_t BuildFetchRemap(uint32_t* indices, size_t indexCount, std::vector<uint32_t>& remap, uint32_t usedCount = 0);
+
+    static VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = CacheSize);
+};
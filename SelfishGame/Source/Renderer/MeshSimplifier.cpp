@@ -0,0 +1,332 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include <glm/geometric.hpp>
+
+namespace
+{
+    // Symmetric 4x4 matrix of summed plane equations, only the upper triangle is stored
+    struct Quadric
+    {
+        double a00 = 0.0, a01 = 0.0, a02 = 0.0, a03 = 0.0;
+        double a11 = 0.0, a12 = 0.0, a13 = 0.0;
+        double a22 = 0.0, a23 = 0.0;
+        double a33 = 0.0;
+        double weight = 0.0;
+
+        void AddPlane(const glm::dvec3& normal, double distance, double planeWeight)
+        {
+            a00 += planeWeight * normal.x * normal.x;
+            a01 += planeWeight * normal.x * normal.y;
+            a02 += planeWeight * normal.x * normal.z;
+            a03 += planeWeight * normal.x * distance;
+            a11 += planeWeight * normal.y * normal.y;
+            a12 += planeWeight * normal.y * normal.z;
+            a13 += planeWeight * normal.y * distance;
+            a22 += planeWeight * normal.z * normal.z;
+            a23 += planeWeight * normal.z * distance;
+            a33 += planeWeight * distance * distance;
+            weight += planeWeight;
+        }
+
+        void Add(const Quadric& other)
+        {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+            a11 += other.a11; a12 += other.a12; a13 += other.a13;
+            a22 += other.a22; a23 += other.a23;
+            a33 += other.a33;
+            weight += other.weight;
+        }
+
+        // Weighted mean of the squared distances from the planes, in mesh units squared
+        double Evaluate(const glm::vec3& position) const
+        {
+            const double x = position.x;
+            const double y = position.y;
+            const double z = position.z;
+            const double error = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + 2.0 * a03 * x
+                + a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y
+                + a22 * z * z + 2.0 * a23 * z
+                + a33;
+            return weight > 0.0 ? std::max(error, 0.0) / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        double error;
+    };
+
+    struct PositionKey
+    {
+        uint32_t bits[3];
+
+        bool operator==(const PositionKey& other) const { return std::memcmp(bits, other.bits, sizeof(bits)) == 0; }
+    };
+
+    struct PositionKeyHash
+    {
+        size_t operator()(const PositionKey& key) const
+        {
+            return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+        }
+    };
+
+    // Vertices that never move: on an open border or sharing their position with another vertex
+    std::vector<bool> FindLockedVertices(const glm::vec3* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+    {
+        std::vector<uint32_t> canonical(vertexCount);
+        std::vector<uint32_t> positionUseCount(vertexCount, 0);
+        std::unordered_map<PositionKey, uint32_t, PositionKeyHash> firstWithPosition;
+        firstWithPosition.reserve(vertexCount);
+        for (uint32_t vertex = 0; vertex < vertexCount; ++vertex)
+        {
+            PositionKey key;
+            std::memcpy(key.bits, &positions[vertex], sizeof(key.bits));
+            canonical[vertex] = firstWithPosition.emplace(key, vertex).first->second;
+            ++positionUseCount[canonical[vertex]];
+        }
+
+        // A directed edge without its opposite belongs to one triangle only
+        std::vector<uint64_t> edges;
+        edges.reserve(indexCount);
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                const uint64_t a = canonical[indices[i + corner]];
+                const uint64_t b = canonical[indices[i + (corner + 1) % 3]];
+                edges.push_back((a << 32) | b);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<bool> lockedPosition(vertexCount, false);
+        for (uint64_t edge : edges)
+        {
+            const uint64_t reverse = (edge << 32) | (edge >> 32);
+            if (!std::binary_search(edges.begin(), edges.end(), reverse))
+            {
+                lockedPosition[edge >> 32] = true;
+                lockedPosition[edge & 0xffffffffu] = true;
+            }
+        }
+
+        std::vector<bool> locked(vertexCount);
+        for (uint32_t vertex = 0; vertex < vertexCount; ++vertex)
+        {
+            locked[vertex] = lockedPosition[canonical[vertex]] || positionUseCount[canonical[vertex]] > 1;
+        }
+        return locked;
+    }
+
+    // Moving "from" onto "to" must not turn any of the remaining triangles around
+    bool FlipsTriangles(const glm::vec3* positions, const uint32_t* indices, const uint32_t* triangles, uint32_t triangleCount,
+        uint32_t from, uint32_t to)
+    {
+        for (uint32_t i = 0; i < triangleCount; ++i)
+        {
+            const uint32_t* triangle = &indices[triangles[i] * 3];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+            {
+                continue; // collapses into a line and is removed
+            }
+
+            const uint32_t corner = triangle[0] == from ? 0 : (triangle[1] == from ? 1 : 2);
+            const glm::vec3& p1 = positions[triangle[(corner + 1) % 3]];
+            const glm::vec3& p2 = positions[triangle[(corner + 2) % 3]];
+
+            const glm::vec3 before = glm::cross(p1 - positions[from], p2 - positions[from]);
+            const glm::vec3 after = glm::cross(p1 - positions[to], p2 - positions[to]);
+
+            // Also rejects normals turned by more than about 75 degrees, that looks like a flip from most angles
+            if (glm::dot(before, after) < 0.25f * glm::length(before) * glm::length(after))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+std::vector<uint32_t> MeshSimplifier::Simplify(const glm::vec3* positions, size_t vertexCount, const uint32_t* indices,
+    size_t indexCount, size_t targetIndexCount, float maxError, float* resultError)
+{
+    std::vector<uint32_t> result(indices, indices + indexCount);
+    double largestError = 0.0;
+
+    const std::vector<bool> locked = FindLockedVertices(positions, vertexCount, indices, indexCount);
+
+    // Every triangle adds its plane to its vertices, weighted by area so small triangles don't dominate
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        const glm::dvec3 p0 = positions[indices[i]];
+        const glm::dvec3 p1 = positions[indices[i + 1]];
+        const glm::dvec3 p2 = positions[indices[i + 2]];
+
+        const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const double length = glm::length(normal);
+        if (length == 0.0)
+        {
+            continue;
+        }
+
+        const glm::dvec3 unitNormal = normal / length;
+        const double distance = -glm::dot(unitNormal, p0);
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            quadrics[indices[i + corner]].AddPlane(unitNormal, distance, 0.5 * length);
+        }
+    }
+
+    const double maxErrorSquared = static_cast<double>(maxError) * maxError;
+
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+
+    /*
+     * Each pass collapses the cheapest edges that don't share a neighborhood, so one collapse never invalidates
+     * the cost or the flip test of another, then rebuilds the index list. Passes repeat until the target count
+     * or the error bound is reached.
+     */
+    bool errorBoundReached = false;
+    while (result.size() > targetIndexCount && !errorBoundReached)
+    {
+        const size_t triangleCount = result.size() / 3;
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                const uint32_t a = result[i + corner];
+                const uint32_t b = result[i + (corner + 1) % 3];
+
+                // Interior edges are seen from both triangles, border edges only have locked vertices
+                if (a > b)
+                {
+                    continue;
+                }
+
+                Quadric quadric = quadrics[a];
+                quadric.Add(quadrics[b]);
+                const double costAToB = locked[a] ? HUGE_VAL : quadric.Evaluate(positions[b]);
+                const double costBToA = locked[b] ? HUGE_VAL : quadric.Evaluate(positions[a]);
+                if (costAToB == HUGE_VAL && costBToA == HUGE_VAL)
+                {
+                    continue;
+                }
+
+                collapses.push_back(costAToB <= costBToA ? Collapse{ a, b, costAToB } : Collapse{ b, a, costBToA });
+            }
+        }
+
+        if (collapses.empty())
+        {
+            break;
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        // Triangles around every vertex
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for (uint32_t index : result)
+        {
+            ++triangleOffsets[index + 1];
+        }
+        std::partial_sum(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin());
+        vertexTriangles.resize(result.size());
+        {
+            std::vector<uint32_t> writeOffsets(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); ++i)
+            {
+                vertexTriangles[writeOffsets[result[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(touched.begin(), touched.end(), false);
+
+        // An interior collapse removes two triangles
+        const size_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+        size_t trianglesRemoved = 0;
+        size_t collapseCount = 0;
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapse.error > maxErrorSquared)
+            {
+                errorBoundReached = true;
+                break;
+            }
+
+            if (touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            const uint32_t* triangles = &vertexTriangles[triangleOffsets[collapse.from]];
+            const uint32_t count = triangleOffsets[collapse.from + 1] - triangleOffsets[collapse.from];
+            if (FlipsTriangles(positions, result.data(), triangles, count, collapse.from, collapse.to))
+            {
+                continue;
+            }
+
+            // Everything around "from" changes shape, nothing else may move there in this pass
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    touched[result[triangles[i] * 3 + corner]] = true;
+                }
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            largestError = std::max(largestError, collapse.error);
+            ++collapseCount;
+
+            trianglesRemoved += 2;
+            if (trianglesRemoved >= trianglesToRemove)
+            {
+                break;
+            }
+        }
+
+        if (collapseCount == 0)
+        {
+            break;
+        }
+
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            const uint32_t a = remap[result[i]];
+            const uint32_t b = remap[result[i + 1]];
+            const uint32_t c = remap[result[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                result[writeIndex++] = a;
+                result[writeIndex++] = b;
+                result[writeIndex++] = c;
+            }
+        }
+        result.resize(writeIndex);
+    }
+
+    if (resultError != nullptr)
+    {
+        *resultError = static_cast<float>(std::sqrt(largestError));
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+
+struct MeshLodSettings
+{
+    uint32_t maxLodCount = 5;   // the full detail mesh included
+    float reduction = 0.5f;     // every LOD aims for this fraction of the previous one's triangles
+    float maxError = 0.05f;     // relative to the bounding radius, the chain ends at the first LOD that would exceed it
+    uint32_t minTriangleCount = 32;
+};
+
+/*
+ * Quadric error metric simplification (Garland and Heckbert): every vertex carries the sum of the squared
+ * distances to the planes of the triangles around it, and the edge whose collapse adds the least to that error
+ * goes first.
+ *
+ * Edges only collapse onto one of their two vertices, so the simplified index list reuses the original vertex
+ * buffer and all LODs of a mesh can share it. Vertices on an open border or on an attribute seam (another vertex
+ * with the same position, e.g. a UV seam) never move, which keeps holes closed and seams intact.
+ */
+class MeshSimplifier
+{
+public:
+    // Collapses edges until at most targetIndexCount indices are left or the next collapse would move the surface
+    // further than maxError (in mesh units). resultError is the largest error of the collapses done.
+    static std::vector<uint32_t> Simplify(const glm::vec3* positions, size_t vertexCount, const uint32_t* indices,
+        size_t indexCount, size_t targetIndexCount, float maxError, float* resultError = nullptr);
+};
@@ -0,0 +1,162 @@
+#include "PipelineCache.h"
+
+#include <Utilities.h>
+#include <VulkanCheck.h>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+void PipelineCache::Init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path)
+{
+    m_device = device;
+    m_path = path;
+    vkGetPhysicalDeviceProperties(physicalDevice, &m_properties);
+
+    if (m_properties.apiVersion >= VK_API_VERSION_1_1)
+    {
+        VkPhysicalDeviceIDProperties idProperties{};
+        idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &idProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        memcpy(m_driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+    }
+
+    std::vector<char> data;
+    {
+        std::ifstream file(m_path, std::ios::ate | std::ios::binary);
+        if (file.is_open())
+        {
+            data.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(data.data(), data.size());
+        }
+    }
+
+    const char* reason = nullptr;
+    const FileHeader expected = MakeHeader();
+    FileHeader header{};
+
+    if (data.empty())
+    {
+        reason = "no cache file";
+    }
+    else if (data.size() < sizeof(FileHeader))
+    {
+        reason = "truncated header";
+    }
+    else
+    {
+        memcpy(&header, data.data(), sizeof(header));
+
+        if (header.magic != expected.magic || header.headerSize != expected.headerSize)
+        {
+            reason = "unknown file format";
+        }
+        else if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID)
+        {
+            reason = "different device";
+        }
+        else if (header.driverVersion != expected.driverVersion ||
+            memcmp(header.driverUUID, expected.driverUUID, VK_UUID_SIZE) != 0 ||
+            memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            reason = "different driver";
+        }
+        else if (header.dataSize != data.size() - sizeof(FileHeader))
+        {
+            reason = "truncated data";
+        }
+        else if (header.dataHash != Hash(data.data() + sizeof(FileHeader), static_cast<size_t>(header.dataSize)))
+        {
+            reason = "corrupted data";
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (reason == nullptr)
+    {
+        createInfo.initialDataSize = static_cast<size_t>(header.dataSize);
+        createInfo.pInitialData = data.data() + sizeof(FileHeader);
+    }
+
+    // The driver validates its own header as well and silently starts empty if it doesn't like it
+    VK_CHECK(vkCreatePipelineCache(m_device, &createInfo, nullptr, &m_cache));
+
+    m_loadedFromDisk = reason == nullptr;
+    if (m_loadedFromDisk)
+    {
+        std::cout << "Pipeline cache: loaded " << header.dataSize << " bytes from " << m_path << std::endl;
+    }
+    else
+    {
+        std::cout << "Pipeline cache: starting empty (" << reason << ")" << std::endl;
+    }
+}
+
+void PipelineCache::Save()
+{
+    if (m_cache == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    size_t dataSize = 0;
+    VK_CHECK(vkGetPipelineCacheData(m_device, m_cache, &dataSize, nullptr));
+
+    std::vector<char> data(sizeof(FileHeader) + dataSize);
+    VK_CHECK(vkGetPipelineCacheData(m_device, m_cache, &dataSize, data.data() + sizeof(FileHeader)));
+    data.resize(sizeof(FileHeader) + dataSize);
+
+    FileHeader header = MakeHeader();
+    header.dataSize = dataSize;
+    header.dataHash = Hash(data.data() + sizeof(FileHeader), dataSize);
+    memcpy(data.data(), &header, sizeof(header));
+
+    std::string error;
+    if (!WriteFileAtomically(m_path, data.data(), data.size(), &error))
+    {
+        std::cout << "Pipeline cache: " << error << std::endl;
+        return;
+    }
+
+    std::cout << "Pipeline cache: saved " << dataSize << " bytes to " << m_path << std::endl;
+}
+
+void PipelineCache::Release()
+{
+    vkDestroyPipelineCache(m_device, m_cache, nullptr);
+    m_cache = VK_NULL_HANDLE;
+}
+
+PipelineCache::FileHeader PipelineCache::MakeHeader() const
+{
+    FileHeader header{};
+    header.magic = Magic;
+    header.headerSize = sizeof(FileHeader);
+    header.vendorID = m_properties.vendorID;
+    header.deviceID = m_properties.deviceID;
+    header.driverVersion = m_properties.driverVersion;
+    memcpy(header.driverUUID, m_driverUUID, VK_UUID_SIZE);
+    memcpy(header.pipelineCacheUUID, m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
+uint64_t PipelineCache::Hash(const void* data, size_t size)
+{
+    // FNV-1a, only used to detect a damaged file
+    uint64_t hash = 14695981039346656037ull;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
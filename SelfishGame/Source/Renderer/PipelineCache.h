@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+/*
+ * VkPipelineCache that survives between runs.
+ *
+ * The blob returned by vkGetPipelineCacheData is only meaningful for the exact device and driver that produced it,
+ * so it is written with our own header in front: vendor and device ID, driver version, driverUUID (which tells
+ * two drivers for the same device apart, queried on Vulkan 1.1 devices and left zero on 1.0 ones) and
+ * pipelineCacheUUID (which the driver changes whenever its compiled pipelines become incompatible). A file that doesn't match
+ * the current device, is truncated or is corrupted is ignored and the cache starts out empty.
+ *
+ * The file is written to a temporary file first and then renamed over the old one, so a crash during Save()
+ * never leaves a half written cache behind.
+ */
+class PipelineCache
+{
+public:
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path);
+    void Save();
+    void Release();
+
+    VkPipelineCache Get() const { return m_cache; }
+
+    // True if the cache was created from the file on disk
+    bool WasLoadedFromDisk() const { return m_loadedFromDisk; }
+
+private:
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t headerSize;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t driverUUID[VK_UUID_SIZE];
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+
+    static constexpr uint32_t Magic = 0x50435653; // "SVCP"
+
+    FileHeader MakeHeader() const;
+    static uint64_t Hash(const void* data, size_t size);
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties m_properties{};
+    uint8_t m_driverUUID[VK_UUID_SIZE] = {};
+    VkPipelineCache m_cache = VK_NULL_HANDLE;
+    std::string m_path;
+    bool m_loadedFromDisk = false;
+};
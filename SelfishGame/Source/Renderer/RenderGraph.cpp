@@ -0,0 +1,613 @@
+#include "RenderGraph.h"
+
+#include <VulkanCheck.h>
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    struct UsageInfo
+    {
+        VkPipelineStageFlags stages;
+        VkAccessFlags readAccess;
+        VkAccessFlags writeAccess;
+        VkImageLayout layout;
+    };
+
+    UsageInfo GetUsageInfo(RenderGraphUsage usage)
+    {
+        switch (usage)
+        {
+        case RenderGraphUsage::ColorAttachment:
+            return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
+                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        case RenderGraphUsage::DepthStencilAttachment:
+            return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+        case RenderGraphUsage::DepthStencilReadOnly:
+            return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+        case RenderGraphUsage::FragmentSampled:
+            return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        case RenderGraphUsage::ComputeSampled:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        case RenderGraphUsage::ComputeStorageRead:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0, VK_IMAGE_LAYOUT_GENERAL };
+        case RenderGraphUsage::ComputeStorageWrite:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL };
+        case RenderGraphUsage::IndirectCommand:
+            return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED };
+        case RenderGraphUsage::VertexAttribute:
+            return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED };
+        case RenderGraphUsage::TransferRead:
+            return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, 0, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+        case RenderGraphUsage::TransferWrite:
+            return { VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+        case RenderGraphUsage::Present:
+            // Presentation is synchronized with a semaphore, the barrier only has to do the layout transition
+            return { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+        }
+
+        assert(false);
+        return {};
+    }
+}
+
+void RenderGraph::PassBuilder::Read(RenderGraphResource resource, RenderGraphUsage usage)
+{
+    m_accesses.push_back({ resource, usage, false });
+}
+
+void RenderGraph::PassBuilder::Write(RenderGraphResource resource, RenderGraphUsage usage)
+{
+    m_accesses.push_back({ resource, usage, true });
+}
+
+void RenderGraph::Init(VkDevice device, GpuMemoryAllocator& allocator)
+{
+    m_device = device;
+    m_allocator = &allocator;
+}
+
+void RenderGraph::Release()
+{
+    Clear();
+}
+
+void RenderGraph::Clear(DeferredDeletionQueue* deletionQueue)
+{
+    DestroyTransientImages(deletionQueue);
+
+    m_resources.clear();
+    m_passes.clear();
+    m_alivePasses.clear();
+    m_passBarriers.clear();
+    m_finalBarriers = {};
+    m_stats = {};
+}
+
+RenderGraphResource RenderGraph::ImportImage(const char* name, VkImageAspectFlags aspect, VkImageLayout initialLayout,
+    VkPipelineStageFlags initialStage)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = ResourceType::Image;
+    resource.imported = true;
+    resource.desc.aspect = aspect;
+    resource.initialLayout = initialLayout;
+    resource.initialStage = initialStage;
+
+    m_resources.push_back(resource);
+    return static_cast<RenderGraphResource>(m_resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::ImportBuffer(const char* name)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = ResourceType::Buffer;
+    resource.imported = true;
+
+    m_resources.push_back(resource);
+    return static_cast<RenderGraphResource>(m_resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::CreateImage(const char* name, const RenderGraphImageDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.type = ResourceType::Image;
+    resource.desc = desc;
+
+    m_resources.push_back(resource);
+    return static_cast<RenderGraphResource>(m_resources.size() - 1);
+}
+
+void RenderGraph::MarkOutput(RenderGraphResource resource, RenderGraphUsage finalUsage)
+{
+    m_resources[resource].output = true;
+    m_resources[resource].finalUsage = finalUsage;
+}
+
+void RenderGraph::AddPass(const char* name, const SetupFunction& setup, const ExecuteFunction& execute)
+{
+    PassBuilder builder;
+    setup(builder);
+
+    Pass pass;
+    pass.name = name;
+    pass.accesses = std::move(builder.m_accesses);
+    pass.sideEffects = builder.m_sideEffects;
+    pass.execute = execute;
+    m_passes.push_back(std::move(pass));
+}
+
+void RenderGraph::Compile()
+{
+    DestroyTransientImages(nullptr); // recompiling a graph in use needs a Clear with a deletion queue first
+    m_stats = {};
+    m_stats.passCount = static_cast<uint32_t>(m_passes.size());
+
+    CullPasses();
+    CreateTransientImages();
+    PlanBarriers();
+}
+
+void RenderGraph::CullPasses()
+{
+    // Walk backwards from the outputs: a pass is needed if it writes something a needed pass reads
+    std::vector<bool> neededResources(m_resources.size(), false);
+    for (size_t i = 0; i < m_resources.size(); ++i)
+    {
+        neededResources[i] = m_resources[i].output;
+    }
+
+    for (size_t i = m_passes.size(); i-- > 0;)
+    {
+        Pass& pass = m_passes[i];
+        pass.culled = !pass.sideEffects;
+        for (const PassBuilder::Access& access : pass.accesses)
+        {
+            if (access.write && neededResources[access.resource])
+            {
+                pass.culled = false;
+            }
+        }
+
+        if (pass.culled)
+        {
+            ++m_stats.culledPassCount;
+            continue;
+        }
+
+        // Writes count as reads too: a pass may only write parts of a resource, what's there before has to stay
+        for (const PassBuilder::Access& access : pass.accesses)
+        {
+            neededResources[access.resource] = true;
+        }
+    }
+
+    m_alivePasses.clear();
+    for (uint32_t i = 0; i < m_passes.size(); ++i)
+    {
+        if (!m_passes[i].culled)
+        {
+            m_alivePasses.push_back(i);
+        }
+    }
+}
+
+void RenderGraph::CreateTransientImages()
+{
+    // Lifetimes in terms of alive passes, images only used by culled passes aren't created at all
+    for (uint32_t alive = 0; alive < m_alivePasses.size(); ++alive)
+    {
+        for (const PassBuilder::Access& access : m_passes[m_alivePasses[alive]].accesses)
+        {
+            Resource& resource = m_resources[access.resource];
+            resource.firstPass = std::min(resource.firstPass, alive);
+            resource.lastPass = std::max(resource.lastPass, alive);
+        }
+    }
+
+    std::vector<RenderGraphResource> transients;
+    std::vector<VkMemoryRequirements> requirements(m_resources.size());
+    for (RenderGraphResource i = 0; i < m_resources.size(); ++i)
+    {
+        Resource& resource = m_resources[i];
+        if (resource.imported || resource.firstPass == ~0u)
+        {
+            continue;
+        }
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent = { resource.desc.extent.width, resource.desc.extent.height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = resource.desc.format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = resource.desc.usage;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_CHECK(vkCreateImage(m_device, &imageInfo, nullptr, &resource.image));
+
+        vkGetImageMemoryRequirements(m_device, resource.image, &requirements[i]);
+        m_stats.transientBytes += requirements[i].size;
+        transients.push_back(i);
+    }
+
+    /*
+     * Greedy aliasing, biggest images first: an image goes into the first memory slot with a compatible memory
+     * type whose occupants all live in other passes, or gets a new slot.
+     */
+    std::sort(transients.begin(), transients.end(), [&](RenderGraphResource a, RenderGraphResource b)
+        {
+            return requirements[a].size > requirements[b].size;
+        });
+
+    for (RenderGraphResource index : transients)
+    {
+        Resource& resource = m_resources[index];
+        const VkMemoryRequirements& imageRequirements = requirements[index];
+
+        MemorySlot* chosenSlot = nullptr;
+        for (MemorySlot& slot : m_memorySlots)
+        {
+            if ((slot.requirements.memoryTypeBits & imageRequirements.memoryTypeBits) == 0)
+            {
+                continue;
+            }
+
+            const bool overlaps = std::any_of(slot.occupants.begin(), slot.occupants.end(), [&](RenderGraphResource occupant)
+                {
+                    const Resource& other = m_resources[occupant];
+                    return resource.firstPass <= other.lastPass && other.firstPass <= resource.lastPass;
+                });
+            if (!overlaps)
+            {
+                chosenSlot = &slot;
+                break;
+            }
+        }
+
+        if (chosenSlot == nullptr)
+        {
+            m_memorySlots.emplace_back();
+            chosenSlot = &m_memorySlots.back();
+            chosenSlot->requirements = imageRequirements;
+        }
+        else
+        {
+            chosenSlot->requirements.size = std::max(chosenSlot->requirements.size, imageRequirements.size);
+            chosenSlot->requirements.alignment = std::max(chosenSlot->requirements.alignment, imageRequirements.alignment);
+            chosenSlot->requirements.memoryTypeBits &= imageRequirements.memoryTypeBits;
+        }
+
+        chosenSlot->occupants.push_back(index);
+        resource.memorySlot = static_cast<uint32_t>(chosenSlot - m_memorySlots.data());
+    }
+
+    for (MemorySlot& slot : m_memorySlots)
+    {
+        std::sort(slot.occupants.begin(), slot.occupants.end(), [&](RenderGraphResource a, RenderGraphResource b)
+            {
+                return m_resources[a].firstPass < m_resources[b].firstPass;
+            });
+
+        VK_CHECK(m_allocator->Allocate(slot.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuResourceKind::Optimal,
+            slot.allocation));
+        m_stats.allocatedBytes += slot.requirements.size;
+
+        for (RenderGraphResource occupant : slot.occupants)
+        {
+            Resource& resource = m_resources[occupant];
+            VK_CHECK(vkBindImageMemory(m_device, resource.image, slot.allocation.memory, slot.allocation.offset));
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = resource.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = resource.desc.format;
+            viewInfo.subresourceRange.aspectMask = resource.desc.aspect;
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.layerCount = 1;
+            VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &resource.view));
+        }
+    }
+}
+
+void RenderGraph::DestroyTransientImages(DeferredDeletionQueue* deletionQueue)
+{
+    for (MemorySlot& slot : m_memorySlots)
+    {
+        std::vector<VkImage> images;
+        std::vector<VkImageView> views;
+        for (RenderGraphResource occupant : slot.occupants)
+        {
+            Resource& resource = m_resources[occupant];
+            images.push_back(resource.image);
+            views.push_back(resource.view);
+            resource.view = VK_NULL_HANDLE;
+            resource.image = VK_NULL_HANDLE;
+        }
+
+        auto destroy = [device = m_device, allocator = m_allocator, images, views, allocation = slot.allocation]() mutable
+        {
+            for (size_t i = 0; i < images.size(); ++i)
+            {
+                vkDestroyImageView(device, views[i], nullptr);
+                vkDestroyImage(device, images[i], nullptr);
+            }
+            allocator->Free(allocation);
+        };
+
+        if (deletionQueue != nullptr)
+        {
+            deletionQueue->Push(std::move(destroy));
+        }
+        else
+        {
+            destroy();
+        }
+    }
+    m_memorySlots.clear();
+
+    for (Resource& resource : m_resources)
+    {
+        resource.firstPass = ~0u;
+        resource.lastPass = 0;
+        resource.memorySlot = ~0u;
+    }
+}
+
+void RenderGraph::PlanBarriers()
+{
+    /*
+     * Everything a transient image was used for, in any pass. Aliased memory is handed over from one occupant to
+     * the next, and from the last one back to the first in the next execution: the previous frame may still be
+     * using it on the GPU.
+     */
+    std::vector<VkPipelineStageFlags> usedStages(m_resources.size(), 0);
+    std::vector<VkAccessFlags> writtenAccess(m_resources.size(), 0);
+    for (uint32_t passIndex : m_alivePasses)
+    {
+        for (const PassBuilder::Access& access : m_passes[passIndex].accesses)
+        {
+            const UsageInfo info = GetUsageInfo(access.usage);
+            usedStages[access.resource] |= info.stages;
+            writtenAccess[access.resource] |= access.write ? info.writeAccess : 0;
+        }
+    }
+
+    std::vector<ResourceState> states(m_resources.size());
+    for (RenderGraphResource i = 0; i < m_resources.size(); ++i)
+    {
+        const Resource& resource = m_resources[i];
+        ResourceState& state = states[i];
+        state.layout = resource.imported ? resource.initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+        state.writeStages = resource.initialStage;
+
+        if (resource.memorySlot != ~0u)
+        {
+            const std::vector<RenderGraphResource>& occupants = m_memorySlots[resource.memorySlot].occupants;
+            const auto position = std::find(occupants.begin(), occupants.end(), i);
+            const RenderGraphResource previous = position == occupants.begin() ? occupants.back() : *(position - 1);
+            state.writeStages = usedStages[previous];
+            state.writeAccess = writtenAccess[previous];
+        }
+    }
+
+    m_passBarriers.assign(m_alivePasses.size(), {});
+    for (size_t alive = 0; alive < m_alivePasses.size(); ++alive)
+    {
+        for (const PassBuilder::Access& access : m_passes[m_alivePasses[alive]].accesses)
+        {
+            AddBarrier(m_passBarriers[alive], access.resource, states[access.resource], access.usage, access.write);
+        }
+    }
+
+    m_finalBarriers = {};
+    for (RenderGraphResource i = 0; i < m_resources.size(); ++i)
+    {
+        if (m_resources[i].output)
+        {
+            AddBarrier(m_finalBarriers, i, states[i], m_resources[i].finalUsage, false);
+        }
+    }
+
+    for (const BarrierBatch& batch : m_passBarriers)
+    {
+        m_stats.barrierBatchCount += batch.IsEmpty() ? 0 : 1;
+        m_stats.imageBarrierCount += static_cast<uint32_t>(batch.imageBarriers.size());
+        m_stats.bufferBarrierCount += static_cast<uint32_t>(batch.bufferBarriers.size());
+    }
+    m_stats.barrierBatchCount += m_finalBarriers.IsEmpty() ? 0 : 1;
+    m_stats.imageBarrierCount += static_cast<uint32_t>(m_finalBarriers.imageBarriers.size());
+}
+
+void RenderGraph::AddBarrier(BarrierBatch& batch, RenderGraphResource resource, ResourceState& state,
+    RenderGraphUsage usage, bool write)
+{
+    const UsageInfo info = GetUsageInfo(usage);
+    const bool isImage = m_resources[resource].type == ResourceType::Image;
+    const bool layoutChange = isImage && info.layout != state.layout;
+    const VkAccessFlags dstAccess = info.readAccess | (write ? info.writeAccess : 0);
+
+    VkPipelineStageFlags srcStages = 0;
+    VkAccessFlags srcAccess = 0;
+    if (write || layoutChange)
+    {
+        // Wait for the last write (and make it available) and for all reads since, they must not see the new data
+        srcStages = state.writeStages | state.readStages;
+        srcAccess = state.writeAccess;
+    }
+    else if ((info.stages & ~state.visibleStages) != 0 || (info.readAccess & ~state.visibleAccess) != 0)
+    {
+        // Read after write, unless an earlier barrier already made the write visible to this stage and access
+        srcStages = state.writeStages;
+        srcAccess = state.writeAccess;
+    }
+
+    // Nothing happened to it yet, and the contents stay as they are
+    if (srcStages == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT && srcAccess == 0 && !layoutChange)
+    {
+        srcStages = 0;
+    }
+
+    if (srcStages != 0)
+    {
+        batch.srcStages |= srcStages;
+        batch.dstStages |= info.stages;
+
+        if (layoutChange)
+        {
+            batch.imageBarriers.push_back({ resource, state.layout, info.layout, srcAccess, dstAccess });
+        }
+        else if (srcAccess != 0)
+        {
+            // Several usages of the same resource in one pass share one barrier
+            if (isImage)
+            {
+                const auto existing = std::find_if(batch.imageBarriers.begin(), batch.imageBarriers.end(),
+                    [&](const ImageBarrier& barrier) { return barrier.resource == resource; });
+                if (existing != batch.imageBarriers.end())
+                {
+                    existing->dstAccess |= dstAccess;
+                }
+                else
+                {
+                    batch.imageBarriers.push_back({ resource, state.layout, state.layout, srcAccess, dstAccess });
+                }
+            }
+            else
+            {
+                const auto existing = std::find_if(batch.bufferBarriers.begin(), batch.bufferBarriers.end(),
+                    [&](const BufferBarrier& barrier) { return barrier.resource == resource; });
+                if (existing != batch.bufferBarriers.end())
+                {
+                    existing->dstAccess |= dstAccess;
+                }
+                else
+                {
+                    batch.bufferBarriers.push_back({ resource, srcAccess, dstAccess });
+                }
+            }
+        }
+        // else: write after read, an execution dependency is enough
+    }
+
+    if (write || layoutChange)
+    {
+        // A layout transition is a write too, later usages in other stages have to wait for it
+        state.layout = isImage ? info.layout : state.layout;
+        state.writeStages = info.stages;
+        state.writeAccess = write ? info.writeAccess : 0;
+        state.readStages = write ? 0 : info.stages;
+        state.visibleStages = info.stages;
+        state.visibleAccess = info.readAccess;
+    }
+    else
+    {
+        state.readStages |= info.stages;
+        if (srcStages != 0)
+        {
+            state.visibleStages |= info.stages;
+            state.visibleAccess |= info.readAccess;
+        }
+    }
+}
+
+void RenderGraph::SetImportedImage(RenderGraphResource resource, VkImage image)
+{
+    assert(m_resources[resource].imported && m_resources[resource].type == ResourceType::Image);
+    m_resources[resource].image = image;
+}
+
+void RenderGraph::SetImportedBuffer(RenderGraphResource resource, VkBuffer buffer)
+{
+    assert(m_resources[resource].imported && m_resources[resource].type == ResourceType::Buffer);
+    m_resources[resource].buffer = buffer;
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer) const
+{
+    for (size_t alive = 0; alive < m_alivePasses.size(); ++alive)
+    {
+        RecordBatch(commandBuffer, m_passBarriers[alive]);
+        m_passes[m_alivePasses[alive]].execute(commandBuffer);
+    }
+
+    RecordBatch(commandBuffer, m_finalBarriers);
+}
+
+bool RenderGraph::IsPassCulled(const char* name) const
+{
+    const auto pass = std::find_if(m_passes.begin(), m_passes.end(), [&](const Pass& p) { return p.name == name; });
+    return pass == m_passes.end() || pass->culled;
+}
+
+void RenderGraph::RecordBatch(VkCommandBuffer commandBuffer, const BarrierBatch& batch) const
+{
+    if (batch.IsEmpty())
+    {
+        return;
+    }
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    imageBarriers.reserve(batch.imageBarriers.size());
+    bufferBarriers.reserve(batch.bufferBarriers.size());
+
+    // Imported resources without a handle this frame (e.g. nothing to cull) simply don't get their barrier
+    for (const ImageBarrier& planned : batch.imageBarriers)
+    {
+        const Resource& resource = m_resources[planned.resource];
+        if (resource.image == VK_NULL_HANDLE)
+        {
+            continue;
+        }
+
+        VkImageMemoryBarrier& barrier = imageBarriers.emplace_back();
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = planned.srcAccess;
+        barrier.dstAccessMask = planned.dstAccess;
+        barrier.oldLayout = planned.oldLayout;
+        barrier.newLayout = planned.newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = resource.desc.aspect;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    }
+
+    for (const BufferBarrier& planned : batch.bufferBarriers)
+    {
+        const Resource& resource = m_resources[planned.resource];
+        if (resource.buffer == VK_NULL_HANDLE)
+        {
+            continue;
+        }
+
+        VkBufferMemoryBarrier& barrier = bufferBarriers.emplace_back();
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = planned.srcAccess;
+        barrier.dstAccessMask = planned.dstAccess;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = resource.buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, batch.srcStages, batch.dstStages, 0,
+        0, nullptr, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+        static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
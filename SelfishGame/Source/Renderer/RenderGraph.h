@@ -0,0 +1,222 @@
+#pragma once
+
+#include <DeferredDeletionQueue.h>
+#include <GpuMemoryAllocator.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+// How a pass touches a resource, decides the pipeline stage, the access mask and the image layout
+enum class RenderGraphUsage : uint8_t
+{
+    ColorAttachment,
+    DepthStencilAttachment,
+    DepthStencilReadOnly,
+    FragmentSampled,
+    ComputeSampled,
+    ComputeStorageRead,
+    ComputeStorageWrite,
+    IndirectCommand,
+    VertexAttribute,
+    TransferRead,
+    TransferWrite,
+    Present,
+};
+
+using RenderGraphResource = uint32_t;
+
+struct RenderGraphImageDesc
+{
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    VkImageUsageFlags usage = 0;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+struct RenderGraphStats
+{
+    uint32_t passCount = 0;
+    uint32_t culledPassCount = 0;
+    uint32_t barrierBatchCount = 0; // vkCmdPipelineBarrier calls per execution
+    uint32_t imageBarrierCount = 0;
+    uint32_t bufferBarrierCount = 0;
+    VkDeviceSize transientBytes = 0; // what the transient images would need without aliasing
+    VkDeviceSize allocatedBytes = 0; // what they got
+};
+
+/*
+ * Frame graph: passes declare which resources they read and write, Compile works out the rest once and Execute
+ * replays it every frame.
+ *
+ *  - Passes that contribute neither to an output resource nor have side effects are culled.
+ *  - Barriers and layout transitions are derived from the declared usages. Everything a pass needs is batched into
+ *    a single vkCmdPipelineBarrier in front of it, reads following reads in the same layout need none.
+ *  - Transient images only live between their first and last use, the ones whose lifetimes don't overlap share
+ *    the same memory. The first use of an aliased image waits for the last use of the previous one.
+ *
+ * Imported resources are owned elsewhere and may change every frame (swap chain image, per-frame buffers),
+ * rebind them with SetImportedImage/SetImportedBuffer before Execute. Render passes keep their attachments in the
+ * attachment layouts, the graph does all transitions around them.
+ */
+class RenderGraph
+{
+public:
+    class PassBuilder
+    {
+    public:
+        void Read(RenderGraphResource resource, RenderGraphUsage usage);
+        void Write(RenderGraphResource resource, RenderGraphUsage usage);
+        // Never culled, for passes whose results leave the graph some other way (e.g. a readback)
+        void SetSideEffects() { m_sideEffects = true; }
+
+    private:
+        friend class RenderGraph;
+        struct Access
+        {
+            RenderGraphResource resource;
+            RenderGraphUsage usage;
+            bool write;
+        };
+        std::vector<Access> m_accesses;
+        bool m_sideEffects = false;
+    };
+
+    using SetupFunction = std::function<void(PassBuilder& builder)>;
+    using ExecuteFunction = std::function<void(VkCommandBuffer commandBuffer)>;
+
+    void Init(VkDevice device, GpuMemoryAllocator& allocator);
+    void Release();
+
+    // Drops all passes and resources, transient images included. The graph can be built again afterwards.
+    // With a deletion queue the transient images are destroyed once the frames in flight that use them are done.
+    void Clear(DeferredDeletionQueue* deletionQueue = nullptr);
+
+    // initialLayout is the layout at the start of every execution, UNDEFINED if the contents don't matter
+    RenderGraphResource ImportImage(const char* name, VkImageAspectFlags aspect, VkImageLayout initialLayout,
+        VkPipelineStageFlags initialStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    RenderGraphResource ImportBuffer(const char* name);
+    RenderGraphResource CreateImage(const char* name, const RenderGraphImageDesc& desc);
+
+    // Output resources keep their writers alive, after the last pass they are made ready for finalUsage
+    void MarkOutput(RenderGraphResource resource, RenderGraphUsage finalUsage);
+
+    void AddPass(const char* name, const SetupFunction& setup, const ExecuteFunction& execute);
+
+    // Culls passes, plans the barriers, creates and aliases the transient images
+    void Compile();
+
+    void SetImportedImage(RenderGraphResource resource, VkImage image);
+    void SetImportedBuffer(RenderGraphResource resource, VkBuffer buffer);
+
+    void Execute(VkCommandBuffer commandBuffer) const;
+
+    VkImage GetImage(RenderGraphResource resource) const { return m_resources[resource].image; }
+    VkImageView GetImageView(RenderGraphResource resource) const { return m_resources[resource].view; }
+    bool IsPassCulled(const char* name) const;
+    const RenderGraphStats& GetStats() const { return m_stats; }
+
+private:
+    enum class ResourceType : uint8_t
+    {
+        Image,
+        Buffer,
+    };
+
+    struct Resource
+    {
+        std::string name;
+        ResourceType type = ResourceType::Image;
+        bool imported = false;
+        bool output = false;
+        RenderGraphUsage finalUsage = RenderGraphUsage::Present;
+
+        RenderGraphImageDesc desc;
+        VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags initialStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+
+        // Lifetime in alive pass indices, transient images only
+        uint32_t firstPass = ~0u;
+        uint32_t lastPass = 0;
+        uint32_t memorySlot = ~0u;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        std::vector<PassBuilder::Access> accesses;
+        bool sideEffects = false;
+        bool culled = false;
+        ExecuteFunction execute;
+    };
+
+    struct ImageBarrier
+    {
+        RenderGraphResource resource;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+    };
+
+    struct BufferBarrier
+    {
+        RenderGraphResource resource;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+    };
+
+    // Everything that has to happen in front of one pass, or after the last one
+    struct BarrierBatch
+    {
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        std::vector<ImageBarrier> imageBarriers;
+        std::vector<BufferBarrier> bufferBarriers;
+
+        bool IsEmpty() const { return dstStages == 0; }
+    };
+
+    // Memory shared by transient images with disjoint lifetimes
+    struct MemorySlot
+    {
+        VkMemoryRequirements requirements{};
+        std::vector<RenderGraphResource> occupants; // in order of their lifetimes
+        GpuAllocation allocation;
+    };
+
+    // Where the resource was last touched while planning
+    struct ResourceState
+    {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        VkPipelineStageFlags readStages = 0;   // since the last write
+        VkAccessFlags visibleAccess = 0;       // read accesses the last write has been made visible to
+        VkPipelineStageFlags visibleStages = 0;
+    };
+
+    void CullPasses();
+    void CreateTransientImages();
+    void DestroyTransientImages(DeferredDeletionQueue* deletionQueue);
+    void PlanBarriers();
+    void AddBarrier(BarrierBatch& batch, RenderGraphResource resource, ResourceState& state, RenderGraphUsage usage, bool write);
+    void RecordBatch(VkCommandBuffer commandBuffer, const BarrierBatch& batch) const;
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* m_allocator = nullptr;
+
+    std::vector<Resource> m_resources;
+    std::vector<Pass> m_passes;
+    std::vector<uint32_t> m_alivePasses;      // indices into m_passes in execution order
+    std::vector<BarrierBatch> m_passBarriers; // one per alive pass
+    BarrierBatch m_finalBarriers;
+    std::vector<MemorySlot> m_memorySlots;
+
+    RenderGraphStats m_stats;
+};
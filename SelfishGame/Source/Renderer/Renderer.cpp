@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <set>
@@ -20,54 +21,125 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <stb_image/stb_image.h>
+#include <PhysicsWorld/PhysxWorld.h>
+#include <Profiler/Profiler.h>
+#include <Utilities.h>
+#include <VulkanCheck.h>
 
-void Renderer::Init(GLFWwindow* window)
+void Renderer::Init(GLFWwindow* window, GameWorld& gameWorld, const FramePacingSettings& pacing)
 {
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    m_pacingSettings = pacing;
+    m_framesInFlight = std::clamp(pacing.framesInFlight, 1u, FramePacer::MaxFramesInFlight);
+    m_framePacer.SetFrameRateLimit(pacing.frameRateLimit);
+
     m_window = window;
+    m_gameWorld = &gameWorld;
+    m_renderQuery = m_gameWorld->m_world.query<const Position, const Mesh, const ShapeOfSphere*>();
+    m_workerPool.Init();
+
     InitVulkan();
-    InitImGui();
-    InitImGuiResources();
+    if (!IsHeadless())
+    {
+        InitImGui();
+        InitImGuiResources();
+    }
+
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << "Renderer init took " << std::chrono::duration<double, std::milli>(endTime - startTime).count()
+        << " ms, scene pipeline " << m_pipelineCreationMs << " ms ("
+        << (m_pipelineCache.WasLoadedFromDisk() ? "warm" : "cold") << " pipeline cache)" << std::endl;
+}
+
+void Renderer::InitHeadless(GameWorld& gameWorld, VkExtent2D extent, float frameSeconds, const FramePacingSettings& pacing)
+{
+    m_headlessExtent = extent;
+    m_fixedFrameSeconds = frameSeconds;
+
+    // Benchmarks measure the renderer, not the validation layer, which may not even be installed
+    m_enableValidationLayers = false;
+
+    Init(nullptr, gameWorld, pacing);
 }
 
 void Renderer::InitVulkan()
 {
-    glfwSetWindowUserPointer(m_window, this);
-    glfwSetFramebufferSizeCallback(m_window, FramebufferResizeCallback);
+    if (!IsHeadless())
+    {
+        glfwSetWindowUserPointer(m_window, this);
+        glfwSetFramebufferSizeCallback(m_window, FramebufferResizeCallback);
+    }
 
     CreateInstance();
-    CreateSurface();
+    if (!IsHeadless())
+    {
+        CreateSurface();
+    }
     PickPhysicalDevice();
     CreateLogicalDevice();
-    CreateSwapChain();
+    m_allocator.Init(m_physicalDevice, m_device);
+    m_renderGraph.Init(m_device, m_allocator);
+    m_pipelineCache.Init(m_physicalDevice, m_device, "pipeline_cache.bin");
+    {
+        const QueueFamilyIndices indices = FindQueueFamiliesWithSurfaces(m_physicalDevice);
+        m_uploadManager.Init(m_device, m_allocator, indices.graphicsFamily.value(), m_graphicsQueue,
+            indices.transferFamily.value_or(indices.graphicsFamily.value()), m_transferQueue);
+    }
+    if (IsHeadless())
+    {
+        CreateOffscreenTargets();
+    }
+    else
+    {
+        CreateSwapChain();
+    }
     CreateImageViews();
     CreateRenderPass();
+    m_textureTable.Init(m_device, m_textureTableFeatures, m_framesInFlight);
     CreateDescriptorSetLayout();
     CreateGraphicsPipeline();
-    CreateCommandPool();
+    m_culler.Init(m_physicalDevice, m_device, m_allocator, m_pipelineCache.Get(), ReadFile("shaders/cull.spv"),
+        m_framesInFlight, m_cullerFeatures);
+    if (m_verifyGpuCulling)
+    {
+        m_culler.EnableReadback();
+    }
+    CreateCommandPools();
 
     ////////////////////////////// Create mesh buffers //////////////////////////////
-    CreateDepthResources();
+    BuildRenderGraph();
 
-    CreateFramebuffers(); // must come after depth resources are created
+    CreateFramebuffers(); // must come after the render graph created the depth buffer
 
-    m_objectTexture.CreateFromTextureFile(*this, "textures/golden_surface_albedo.jpg");
     CreateTextureSampler();
+    TextureStreamer::Settings streamingSettings;
+    streamingSettings.memoryBudget = VkDeviceSize(m_textureSettings.streamingBudgetMB) * 1024 * 1024;
+    m_textureStreamer.Init(*this, m_textureSampler, streamingSettings);
+    m_objectTexture = m_textureStreamer.Register({ "textures/golden_surface_albedo.jpg" })[0];
 
     LoadModel();
 
     CreateVertexBuffer();
     CreateIndexBuffer();
-    CreateUniformBuffers();
+    CreateFrameObjects();
 
     CreateDescriptorPool();
     CreateDescriptorSets();
 
     CreateCommandBuffers();
     CreateSyncObjects();
+    m_gpuProfiler.Init(m_physicalDevice, m_device, m_queueRenderFamily, m_framesInFlight);
+
+    // The textures went out with their own batch, vertex and index buffers are uploaded with a single submission.
+    // No need to wait for either, the frames are submitted to the graphics queue after them.
+    m_uploadManager.Flush();
 }
 
 void Renderer::DrawFrame()
 {
+    PROFILE_ZONE("Renderer::DrawFrame");
+
     /*
      * At a high level, rendering a frame in Vulkan consists of a common set of steps:
      *   Wait for the previous frame to finish
@@ -77,28 +149,71 @@ void Renderer::DrawFrame()
      *   Present the swap chain image
      */
 
+    // Minimized there is nothing to render into, try again next frame
+    if (m_swapChainOutOfDate && !RecreateSwapChain())
+    {
+        return;
+    }
+
     auto& frameObject = m_frameObjects[m_currentFrame];
 
-    vkWaitForFences(m_device, 1, &frameObject.inFlightFence, VK_TRUE, UINT64_MAX);
+    {
+        PROFILE_ZONE("wait for frame fence");
+        vkWaitForFences(m_device, 1, &frameObject.inFlightFence, VK_TRUE, UINT64_MAX);
+    }
 
-    uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, frameObject.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+    // Frames complete in submission order, everything submitted up to this one is done
+    m_completedFrameCount = std::max(m_completedFrameCount, frameObject.submittedFrameCount);
+    m_deletionQueue.Collect(m_completedFrameCount);
+
+    // The GPU is done with everything this frame wrote last time around
+    CollectGpuFrameTime(m_currentFrame);
+    if (m_verifyGpuCulling)
     {
-        m_framebufferResized = false;
-        RecreateSwapChain();
-        return;
+        // While the culling input is still in the ring buffer
+        VerifyGpuCulling(m_currentFrame);
     }
-    else
+    ReserveFrameRing();
+    m_frameRing.BeginFrame(m_currentFrame);
+    // The other frames' descriptor sets may still be in use, each one follows a grown ring when its frame comes around
+    WriteDescriptorSet(m_currentFrame);
+    m_uploadManager.CollectCompleted();
+    // Before the table's frame begins, without descriptor indexing slots added later would miss this frame
+    m_textureStreamer.Update();
+    m_textureTable.BeginFrame(m_currentFrame);
+    if (m_fontUploadTicket != 0 && m_uploadManager.IsComplete(m_fontUploadTicket))
     {
-        assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+        ImGui_ImplVulkan_DestroyFontUploadObjects();
+        m_fontUploadTicket = 0;
+    }
+
+    // Headless, every frame in flight has its own offscreen image and the fence is all the synchronization needed
+    uint32_t imageIndex = m_currentFrame;
+    VkResult result = VK_SUCCESS;
+    if (!IsHeadless())
+    {
+        PROFILE_ZONE("acquire swap chain image");
+        result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, frameObject.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            RecreateSwapChain();
+            return;
+        }
+        else
+        {
+            assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+        }
     }
 
     // Only reset the fence if we are submitting work
     // this should not be done during a window resize or window minimize, for example
     vkResetFences(m_device, 1, &frameObject.inFlightFence);
 
+    // The fence guarantees the GPU is done with the frame's command buffers, recycle all of them at once
+    frameObject.ResetCommandPools(m_device);
+
     UpdateUniformBuffer(m_currentFrame);
+    UpdateInstances(m_currentFrame);
 
     RecordCommandBuffer(frameObject.commandBuffer, imageIndex);
 
@@ -117,7 +232,22 @@ void Renderer::DrawFrame()
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    assert(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, frameObject.inFlightFence) == VK_SUCCESS);
+    if (IsHeadless())
+    {
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.signalSemaphoreCount = 0;
+    }
+
+    VK_CHECK(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, frameObject.inFlightFence));
+    ++m_submittedFrameCount;
+    m_deletionQueue.OnFrameSubmitted();
+    frameObject.submittedFrameCount = m_deletionQueue.GetSubmittedFrameCount();
+
+    if (IsHeadless())
+    {
+        m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
+        return;
+    }
 
     // Present the frame
 
@@ -132,8 +262,13 @@ void Renderer::DrawFrame()
     presentInfo.pImageIndices = &imageIndex;
     presentInfo.pResults = nullptr; // Optional
 
-    result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+    {
+        PROFILE_ZONE("present");
+        result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+    }
+    m_framePacer.MarkPresented();
+
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_swapChainOutOfDate)
     {
         RecreateSwapChain();
     }
@@ -142,19 +277,52 @@ void Renderer::DrawFrame()
         assert(result == VK_SUCCESS);
     }
 
-    m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT; // loop between 0 and max-1
+    m_currentFrame = (m_currentFrame + 1) % m_framesInFlight; // loop between 0 and max-1
 }
 
 void Renderer::OnExitMainLoop()
 {
     vkDeviceWaitIdle(m_device);
+
+    // m_currentFrame is the oldest frame still in flight
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
+    {
+        CollectGpuFrameTime((m_currentFrame + i) % m_framesInFlight);
+        if (m_verifyGpuCulling)
+        {
+            VerifyGpuCulling((m_currentFrame + i) % m_framesInFlight);
+        }
+    }
+}
+
+void Renderer::VerifyGpuCulling(uint32_t frameIndex)
+{
+    if (!m_culler.HasReadback(frameIndex))
+    {
+        return;
+    }
+
+    ++m_gpuCullingVerifiedCount;
+    std::string error;
+    if (!m_culler.VerifyReadback(frameIndex, m_frameObjects[frameIndex].cullInput, error))
+    {
+        ++m_gpuCullingMismatchCount;
+        std::cout << "GPU culling: differs from the CPU, " << error << std::endl;
+    }
+}
+
+std::string Renderer::GetDeviceName() const
+{
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    return properties.deviceName;
 }
 
 void Renderer::FramebufferResizeCallback(GLFWwindow* window, int width, int height)
 {
     if (Renderer* app = reinterpret_cast<Renderer*>(glfwGetWindowUserPointer(window)))
     {
-        app->m_framebufferResized = true;
+        app->m_swapChainOutOfDate = true;
     }
 }
 
@@ -168,28 +336,77 @@ void Renderer::CreateTextureSampler()
     samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT; // Repeat the texture when going beyond the image dimensions.
     samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 
-    samplerInfo.anisotropyEnable = VK_TRUE;
+    // Up to maxAnisotropy samples along the axis of the pixel footprint, for surfaces seen at grazing angles
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+    samplerInfo.maxAnisotropy = std::min(m_textureSettings.maxAnisotropy, properties.limits.maxSamplerAnisotropy);
+    samplerInfo.anisotropyEnable = samplerInfo.maxAnisotropy > 1.0f ? VK_TRUE : VK_FALSE;
 
     samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
     samplerInfo.unnormalizedCoordinates = VK_FALSE; // the texels are addressed using the [0, 1) range on all axes
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
 
+    // Trilinear: blend between the two closest mips. No upper LOD clamp, the image view limits it to the mips the
+    // texture actually has, so one sampler works for all of them.
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
-    assert(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_textureSampler) == VK_SUCCESS);
+    VK_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_textureSampler));
 }
 
-void Renderer::CreateDepthResources()
+void Renderer::BuildRenderGraph()
 {
-    m_depth.Release(*this);
-    m_depth.CreateDepthImage(*this, m_swapChainExtent);
+    // The old depth buffer may still be used by frames in flight
+    m_renderGraph.Clear(&m_deletionQueue);
+
+    // The image is acquired with a semaphore that is waited on at the color attachment output stage.
+    // Headless there is nothing to present, the offscreen image is left as a color attachment.
+    m_swapChainResource = m_renderGraph.ImportImage("swap chain", VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    m_renderGraph.MarkOutput(m_swapChainResource, IsHeadless() ? RenderGraphUsage::ColorAttachment : RenderGraphUsage::Present);
+
+    m_culledDrawsResource = m_renderGraph.ImportBuffer("culled draws");
+
+    RenderGraphImageDesc depthDesc;
+    depthDesc.format = FindDepthFormat();
+    depthDesc.extent = m_swapChainExtent;
+    depthDesc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT | (HasStencilComponent(depthDesc.format) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+    m_depthResource = m_renderGraph.CreateImage("depth", depthDesc);
+
+    m_renderGraph.AddPass("gpu culling",
+        [&](RenderGraph::PassBuilder& builder)
+        {
+            builder.Write(m_culledDrawsResource, RenderGraphUsage::ComputeStorageWrite);
+        },
+        [this](VkCommandBuffer commandBuffer)
+        {
+            GpuProfileScope scope(m_gpuProfiler, commandBuffer, "gpu culling");
+            m_culler.RecordCulling(commandBuffer, m_currentFrame, m_frameObjects[m_currentFrame].cullInput);
+        });
+
+    m_renderGraph.AddPass("scene",
+        [&](RenderGraph::PassBuilder& builder)
+        {
+            builder.Read(m_culledDrawsResource, RenderGraphUsage::IndirectCommand);
+            builder.Read(m_culledDrawsResource, RenderGraphUsage::VertexAttribute);
+            builder.Write(m_depthResource, RenderGraphUsage::DepthStencilAttachment);
+            builder.Write(m_swapChainResource, RenderGraphUsage::ColorAttachment);
+        },
+        [this](VkCommandBuffer commandBuffer)
+        {
+            RecordScenePass(commandBuffer);
+        });
+
+    m_renderGraph.Compile();
+
+    const RenderGraphStats& stats = m_renderGraph.GetStats();
+    std::cout << "Render graph: " << stats.passCount - stats.culledPassCount << " of " << stats.passCount << " passes, "
+        << stats.barrierBatchCount << " barrier batches, " << stats.allocatedBytes / 1024 << " KB of transient memory ("
+        << stats.transientBytes / 1024 << " KB without aliasing)" << std::endl;
 }
 
 bool Renderer::HasStencilComponent(VkFormat format)
@@ -241,7 +458,7 @@ VkImageView Renderer::CreateImageView(VkImage image, VkFormat format, VkImageAsp
     viewInfo.subresourceRange.layerCount = 1;
 
     VkImageView imageView;
-    assert(vkCreateImageView(m_device, &viewInfo, nullptr, &imageView) == VK_SUCCESS);
+    VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &imageView));
 
     return imageView;
 }
@@ -255,12 +472,14 @@ void Renderer::CreateInstance()
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "Selfish Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = VK_API_VERSION_1_1; // for vkGetPhysicalDeviceFeatures2, used to query descriptor indexing
 
     {
         VkInstanceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
         createInfo.pApplicationInfo = &appInfo;
+        // Headless needs no surface extensions
+        if (!IsHeadless())
         {
             uint32_t glfwExtensionCount = 0;
             const char** glfwExtensions;
@@ -307,7 +526,7 @@ void Renderer::CreateInstance()
 void Renderer::CreateSurface()
 {
     ////////////////////////////// Create m_surface //////////////////////////////
-    assert(glfwCreateWindowSurface(m_instance, m_window, nullptr, &m_surface) == VK_SUCCESS);
+    VK_CHECK(glfwCreateWindowSurface(m_instance, m_window, nullptr, &m_surface));
 
     uint32_t extensionCount = 0;
     vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
@@ -334,12 +553,22 @@ void Renderer::PickPhysicalDevice()
     std::vector<VkPhysicalDevice> devices(deviceCount);
     vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
 
+    // Headless takes any suitable device, a discrete GPU if there is one
+    VkPhysicalDeviceType physicalDeviceType = VK_PHYSICAL_DEVICE_TYPE_OTHER;
     for (const auto& device : devices)
     {
-        if (IsDeviceSuitable(device))
+        if (!IsDeviceSuitable(device))
+        {
+            continue;
+        }
+
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        if (physicalDevice == VK_NULL_HANDLE ||
+            (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && physicalDeviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU))
         {
             physicalDevice = device;
-            break;
+            physicalDeviceType = deviceProperties.deviceType;
         }
     }
 
@@ -353,7 +582,11 @@ void Renderer::CreateLogicalDevice()
     QueueFamilyIndices indices = FindQueueFamiliesWithSurfaces(m_physicalDevice);
     {
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::vector<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+        std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+        if (indices.transferFamily)
+        {
+            uniqueQueueFamilies.insert(*indices.transferFamily);
+        }
 
         if (indices.graphicsFamily)
         {
@@ -370,8 +603,101 @@ void Renderer::CreateLogicalDevice()
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = VK_TRUE;
+        deviceFeatures.drawIndirectFirstInstance = VK_TRUE; // the culled draws start at their mesh's instance range
+        deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+        deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC; // cooked textures, decoded images otherwise
+        m_cullerFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect == VK_TRUE;
+
+        // Optional extensions, the renderer has a fallback if they are missing. Headless doesn't need a swap chain.
+        std::vector<const char*> extensions;
+        if (!IsHeadless())
+        {
+            extensions = m_deviceExtensions;
+        }
+        {
+            uint32_t extensionCount;
+            vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, nullptr);
+
+            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+            vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+            for (const auto& extension : availableExtensions)
+            {
+                if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+                {
+                    extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+                    m_cullerFeatures.drawIndirectCount = true;
+                }
+                else if (strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+                {
+                    m_textureTableFeatures.descriptorIndexing = true;
+                }
+            }
+        }
+
+        /*
+         * The bindless texture table needs non-uniform indexing into a runtime sized array of sampled images
+         * that is partially bound and updated after being bound. Otherwise it falls back to a small fixed array.
+         */
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+        descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+        VkPhysicalDeviceProperties deviceProperties{};
+        vkGetPhysicalDeviceProperties(m_physicalDevice, &deviceProperties);
+        if (m_textureTableFeatures.descriptorIndexing && deviceProperties.apiVersion >= VK_API_VERSION_1_1)
+        {
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &descriptorIndexingFeatures;
+            vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features2);
+
+            VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties{};
+            descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+            VkPhysicalDeviceProperties2 properties2{};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &descriptorIndexingProperties;
+            vkGetPhysicalDeviceProperties2(m_physicalDevice, &properties2);
+
+            // Combined image samplers count against both the sampler and the sampled image limits
+            m_textureTableFeatures.maxTextures = std::min({
+                descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+                descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+                descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
+
+            m_textureTableFeatures.descriptorIndexing =
+                descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+                descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+                descriptorIndexingFeatures.descriptorBindingPartiallyBound &&
+                descriptorIndexingFeatures.runtimeDescriptorArray &&
+                m_textureTableFeatures.maxTextures >= BindlessTextureTable::FallbackTextureCount;
+        }
+        else
+        {
+            m_textureTableFeatures.descriptorIndexing = false;
+        }
+
+        // Only enable what the table uses
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledDescriptorIndexingFeatures{};
+        enabledDescriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        enabledDescriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        enabledDescriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        enabledDescriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        enabledDescriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+
+        if (m_textureTableFeatures.descriptorIndexing)
+        {
+            extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        }
+
+        // The fallback indexes its array with values that are uniform per draw
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
 
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -380,9 +706,10 @@ void Renderer::CreateLogicalDevice()
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
         createInfo.pEnabledFeatures = &deviceFeatures;
+        createInfo.pNext = m_textureTableFeatures.descriptorIndexing ? &enabledDescriptorIndexingFeatures : nullptr;
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(m_deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = m_deviceExtensions.data();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
 
         if (m_enableValidationLayers)
         {
@@ -394,10 +721,11 @@ void Renderer::CreateLogicalDevice()
             createInfo.enabledLayerCount = 0;
         }
 
-        assert(vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device) == VK_SUCCESS);
+        VK_CHECK(vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device));
 
         vkGetDeviceQueue(m_device, indices.graphicsFamily.value(), 0, &m_graphicsQueue);
         vkGetDeviceQueue(m_device, indices.presentFamily.value(), 0, &m_presentQueue);
+        vkGetDeviceQueue(m_device, indices.transferFamily.value_or(indices.graphicsFamily.value()), 0, &m_transferQueue);
     }
 }
 
@@ -412,7 +740,8 @@ void Renderer::CreateRenderPass()
     depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // Layout transitions happen outside of the render pass, see BuildRenderGraph
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference depthAttachmentRef{};
@@ -429,8 +758,9 @@ void Renderer::CreateRenderPass()
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // don't care what the format was before
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // The render graph moves the swap chain image into and out of the attachment layout
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -445,14 +775,10 @@ void Renderer::CreateRenderPass()
      */
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDependency dependency{};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // an implicit subpass that comes before the first user pass or after the last user pass
-    dependency.dstSubpass = 0; // index to our only subpass
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT /* We need to wait for the swap chain to finish reading from the image before we can access it */
-        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT /* depth buffer test */;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT /* depth buffer test */;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT /* depth buffer test */;
+    /*
+     * No subpass dependencies: waiting for the swap chain image and for the previous frame's depth test is
+     * done by the barriers the render graph puts in front of the render pass.
+     */
 
     const std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
 
@@ -462,17 +788,18 @@ void Renderer::CreateRenderPass()
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = 0;
+    renderPassInfo.pDependencies = nullptr;
 
-    assert(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass) == VK_SUCCESS);
+    VK_CHECK(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass));
 }
 
 void Renderer::CreateGraphicsPipeline()
 {////////////////////////////// Create pipeline layout //////////////////////////////
 
     auto vertShaderCode = ReadFile("shaders/vert.spv");
-    auto fragShaderCode = ReadFile("shaders/frag.spv");
+    // The fallback variant samples a fixed size texture array, see BindlessTextureTable
+    auto fragShaderCode = ReadFile(m_textureTable.IsBindless() ? "shaders/frag.spv" : "shaders/frag_fallback.spv");
 
     struct AutoShaderModule
     {
@@ -517,13 +844,13 @@ void Renderer::CreateGraphicsPipeline()
     dynamicState.pDynamicStates = dynamicStates.data();
 
     // vertex input
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    constexpr auto bindingDescriptions = GpuVertex::getBindingDescriptions();
+    constexpr auto attributeDescriptions = GpuVertex::getAttributeDescriptions();
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription; // Optional
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data(); // Optional
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); // Optional
 
@@ -601,12 +928,14 @@ void Renderer::CreateGraphicsPipeline()
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+    // Set 0: per frame uniforms, set 1: the texture table
+    const std::array<VkDescriptorSetLayout, 2> setLayouts = { m_descriptorSetLayout, m_textureTable.GetLayout() };
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
     pipelineLayoutInfo.pushConstantRangeCount = 1;
     pipelineLayoutInfo.pPushConstantRanges = &imGuiPushConstants;
 
-    assert(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) == VK_SUCCESS);
+    VK_CHECK(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout));
 
 
     ////////////////////////////// Create graphics pipeline //////////////////////////////
@@ -645,37 +974,99 @@ void Renderer::CreateGraphicsPipeline()
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    assert(vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipeline) == VK_SUCCESS);
+    // With a warm cache the driver skips compiling the shaders to its own ISA
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    VK_CHECK(vkCreateGraphicsPipelines(m_device, m_pipelineCache.Get(), 1, &pipelineInfo, nullptr, &m_graphicsPipeline));
+    m_pipelineCreationMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    if (IsHeadless())
+    {
+        MeasurePipelineCache(pipelineInfo);
+    }
+}
+
+void Renderer::MeasurePipelineCache(const VkGraphicsPipelineCreateInfo& pipelineInfo)
+{
+    /*
+     * One run only sees either a cold or a warm cache, benchmarks create the scene pipeline twice more to get both:
+     * once with an empty cache and once with ours, which has it by now. Drivers with their own shader cache on disk
+     * (Mesa, NVIDIA) can make the cold number look warm, clear that cache to see the real compile.
+     */
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    VkPipelineCache emptyCache;
+    VK_CHECK(vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &emptyCache));
+
+    VkPipeline pipeline;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    VK_CHECK(vkCreateGraphicsPipelines(m_device, emptyCache, 1, &pipelineInfo, nullptr, &pipeline));
+    m_pipelineColdMs = MillisecondsSince(startTime);
+    vkDestroyPipeline(m_device, pipeline, nullptr);
+    vkDestroyPipelineCache(m_device, emptyCache, nullptr);
+
+    startTime = std::chrono::high_resolution_clock::now();
+    VK_CHECK(vkCreateGraphicsPipelines(m_device, m_pipelineCache.Get(), 1, &pipelineInfo, nullptr, &pipeline));
+    m_pipelineWarmMs = MillisecondsSince(startTime);
+    vkDestroyPipeline(m_device, pipeline, nullptr);
+
+    std::cout << "Pipeline cache: scene pipeline " << m_pipelineColdMs << " ms cold, " << m_pipelineWarmMs << " ms warm"
+        << std::endl;
 }
 
-void Renderer::CreateCommandPool()
+void Renderer::CreateCommandPools()
 {
-    ////////////////////////////// Create command pool //////////////////////////////
+    ////////////////////////////// Create command pools //////////////////////////////
 
     const QueueFamilyIndices queueFamilyIndices = FindQueueFamiliesWithSurfaces(m_physicalDevice);
 
+    /*
+     * No VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT: buffers are never reset one by one, the whole pool is
+     * reset once per frame, which lets the driver recycle the memory of all its buffers in one go.
+     */
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // re-recorded every frame
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-    assert(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) == VK_SUCCESS);
+    m_frameObjects.resize(m_framesInFlight);
+
+    // The main thread records too
+    const uint32_t recordingThreadCount = std::min(m_workerPool.GetThreadCount() + 1, MaxRecordingPartitions);
+
+    for (FrameObjects& frame : m_frameObjects)
+    {
+        VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &frame.commandPool));
+
+        frame.drawCommandPools.resize(recordingThreadCount);
+        for (VkCommandPool& pool : frame.drawCommandPools)
+        {
+            VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &pool));
+        }
+    }
 }
 
 void Renderer::CreateCommandBuffers()
 {
-    ////////////////////////////// Create command buffer //////////////////////////////
+    ////////////////////////////// Create command buffers //////////////////////////////
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = 1;
 
-    m_frameObjects.resize(MAX_FRAMES_IN_FLIGHT);
-
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for (FrameObjects& frame : m_frameObjects)
     {
-        assert(vkAllocateCommandBuffers(m_device, &allocInfo, &m_frameObjects[i].commandBuffer) == VK_SUCCESS);
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &frame.commandBuffer));
+
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &frame.imGuiCommandBuffer));
+
+        frame.drawCommandBuffers.resize(frame.drawCommandPools.size());
+        for (size_t i = 0; i < frame.drawCommandPools.size(); ++i)
+        {
+            allocInfo.commandPool = frame.drawCommandPools[i];
+            VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &frame.drawCommandBuffers[i]));
+        }
     }
 }
 
@@ -689,16 +1080,24 @@ void Renderer::CreateSyncObjects()
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // so that the first frame waiting on it returns instead of blocking
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
     {
-        assert(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_frameObjects[i].imageAvailableSemaphore) == VK_SUCCESS);
-        assert(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_frameObjects[i].renderFinishedSemaphore) == VK_SUCCESS);
-        assert(vkCreateFence(m_device, &fenceInfo, nullptr, &m_frameObjects[i].inFlightFence) == VK_SUCCESS);
+        VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_frameObjects[i].imageAvailableSemaphore));
+        VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_frameObjects[i].renderFinishedSemaphore));
+        VK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &m_frameObjects[i].inFlightFence));
+    }
+}
+
+void Renderer::CollectGpuFrameTime(uint32_t frameIndex)
+{
+    if (m_gpuProfiler.BeginFrame(frameIndex))
+    {
+        m_gpuFrameTimesMs.push_back(m_gpuProfiler.GetResults().front().ms);
     }
 }
 
 void Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-    VkImage& image, VkDeviceMemory& imageMemory)
+    VkImage& image, GpuAllocation& imageAllocation, uint32_t mipLevels)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -706,7 +1105,7 @@ void Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkI
     imageInfo.extent.width = static_cast<uint32_t>(width);
     imageInfo.extent.height = static_cast<uint32_t>(height);
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
@@ -715,51 +1114,9 @@ void Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkI
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.flags = 0; // Optional
-    assert(vkCreateImage(m_device, &imageInfo, nullptr, &image) == VK_SUCCESS);
+    VK_CHECK(vkCreateImage(m_device, &imageInfo, nullptr, &image));
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(m_device, image, &memRequirements);
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-    assert(vkAllocateMemory(m_device, &allocInfo, nullptr, &imageMemory) == VK_SUCCESS);
-    vkBindImageMemory(m_device, image, imageMemory, 0);
-}
-
-void Renderer::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
-{
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(m_graphicsQueue);
-
-    vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
-}
-
-VkCommandBuffer Renderer::BeginSingleTimeCommands()
-{
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    assert(vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer) == VK_SUCCESS);
-
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    assert(vkBeginCommandBuffer(commandBuffer, &beginInfo) == VK_SUCCESS);
-
-    return commandBuffer;
+    VK_CHECK(m_allocator.AllocateForImage(image, tiling, properties, imageAllocation));
 }
 
 void Renderer::InitImGui()
@@ -794,26 +1151,22 @@ void Renderer::InitImGuiResources()
     init_info.QueueFamily = families.graphicsFamily.value();
 
     init_info.Queue = m_graphicsQueue;
-    init_info.PipelineCache = VK_NULL_HANDLE;
+    init_info.PipelineCache = m_pipelineCache.Get();
     init_info.DescriptorPool = m_descriptorPool;
     init_info.Subpass = 0;
-    init_info.MinImageCount = MAX_FRAMES_IN_FLIGHT;
-    init_info.ImageCount = MAX_FRAMES_IN_FLIGHT;
+    // ImGui keeps a vertex buffer per image count, it must not overwrite the ones of frames in flight
+    init_info.MinImageCount = std::max(m_framesInFlight, 2u);
+    init_info.ImageCount = std::max(m_framesInFlight, 2u);
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     init_info.Allocator = nullptr;
     init_info.CheckVkResultFn = nullptr;
     ImGui_ImplVulkan_Init(&init_info, m_renderPass);
 
-    // Upload Fonts
+    // Upload Fonts, the staging objects are destroyed in DrawFrame once the upload is done
     {
-        // Use any command queue
-        const VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-        ImGui_ImplVulkan_CreateFontsTexture(commandBuffer);
-
-        EndSingleTimeCommands(commandBuffer);
+        ImGui_ImplVulkan_CreateFontsTexture(m_uploadManager.GetGraphicsCommandBuffer());
 
-        ImGui_ImplVulkan_DestroyFontUploadObjects();
+        m_fontUploadTicket = m_uploadManager.Flush();
     }
 }
 
@@ -824,16 +1177,21 @@ void Renderer::UpdateUniformBuffer(uint32_t currentImage)
 
     auto currentTime = std::chrono::high_resolution_clock::now();
     float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+    if (m_fixedFrameSeconds > 0.0f)
+    {
+        time = m_fixedFrameSeconds * static_cast<float>(m_submittedFrameCount);
+    }
 
-    UniformBufferObject ubo{};
-    ubo.model = glm::rotate(glm::mat4(1.0f) /*identity matrix*/,
-        time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    // Slowly circle around the middle of the ball spiral that GameWorld::CreateWorld spawns
+    const glm::vec3 target(250.0f, 200.0f, 0.0f);
+    const float angle = time * glm::radians(5.0f);
+    const glm::vec3 eye = target + glm::vec3(cosf(angle) * 600.0f, sinf(angle) * 600.0f, 250.0f);
 
-    ubo.view = glm::lookAt(glm::vec3(14.f, 2.0f, 2.0f),
-        glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    UniformBufferObject ubo{};
+    ubo.view = glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f));
 
     ubo.proj = glm::perspective(glm::radians(45.0f),
-        static_cast<float>(m_swapChainExtent.width) / static_cast<float>(m_swapChainExtent.height), 0.1f, 100.0f);
+        static_cast<float>(m_swapChainExtent.width) / static_cast<float>(m_swapChainExtent.height), 1.0f, 2000.0f);
 
     /*
      * GLM was originally designed for OpenGL, where the Y coordinate of the clip coordinates is inverted.
@@ -842,10 +1200,15 @@ void Renderer::UpdateUniformBuffer(uint32_t currentImage)
      */
     ubo.proj[1][1] *= -1;
 
-    memcpy(m_frameObjects[currentImage].uniformBuffersMapped, &ubo, sizeof(ubo));
+    m_screenScale = 0.5f * std::abs(ubo.proj[1][1]) * static_cast<float>(m_swapChainExtent.height);
+
+    m_frameObjects[currentImage].viewProjection = ubo.proj * ubo.view;
+
+    const FrameAllocation uniforms = m_frameRing.Push(ubo);
+    m_frameObjects[currentImage].uniformBufferOffset = static_cast<uint32_t>(uniforms.offset);
 }
 
-void Renderer::CreateSwapChain()
+void Renderer::CreateSwapChain(VkSwapchainKHR oldSwapChain)
 {
     SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(m_physicalDevice);
 
@@ -853,8 +1216,17 @@ void Renderer::CreateSwapChain()
     VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presentModes);
     VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities, m_window);
 
-    uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    m_supportedPresentModes = swapChainSupport.presentModes;
+    m_presentMode = presentMode;
+
+    /*
+     * More images let the CPU and GPU run further ahead of the display, which adds latency with FIFO. MAILBOX needs
+     * at least three to always have a free image to render into.
+     */
+    uint32_t imageCount = m_pacingSettings.swapChainImageCount > 0 ?
+        m_pacingSettings.swapChainImageCount : swapChainSupport.capabilities.minImageCount + 1;
 
+    imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
     if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
     {
         imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -876,8 +1248,8 @@ void Renderer::CreateSwapChain()
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
-    assert(vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain) == VK_SUCCESS);
+    createInfo.oldSwapchain = oldSwapChain; // lets the driver hand over resources, the old one can't acquire anymore
+    VK_CHECK(vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain));
 
     ////////////////////////////// Create swap chain images //////////////////////////////
     vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, nullptr);
@@ -888,6 +1260,22 @@ void Renderer::CreateSwapChain()
     m_swapChainExtent = extent;
 }
 
+void Renderer::CreateOffscreenTargets()
+{
+    // One image per frame in flight, a frame only renders into its own so the in flight fences are enough
+    m_swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM; // color attachment support is mandatory for it
+    m_swapChainExtent = m_headlessExtent;
+
+    m_swapChainImages.resize(m_framesInFlight);
+    m_offscreenImageAllocations.resize(m_framesInFlight);
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
+    {
+        CreateImage(m_swapChainExtent.width, m_swapChainExtent.height, m_swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            m_swapChainImages[i], m_offscreenImageAllocations[i]);
+    }
+}
+
 void Renderer::CreateImageViews()
 {
     /*if (m_swapChainImageViews.empty() == false)
@@ -917,7 +1305,7 @@ void Renderer::CreateFramebuffers()
         std::array<VkImageView, 2> attachments =
         {
             m_swapChainImageViews[i],
-            m_depth.m_view
+            m_renderGraph.GetImageView(m_depthResource)
         };
 
         VkFramebufferCreateInfo framebufferInfo{};
@@ -929,12 +1317,12 @@ void Renderer::CreateFramebuffers()
         framebufferInfo.height = m_swapChainExtent.height;
         framebufferInfo.layers = 1;
 
-        assert(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_swapChainFramebuffers[i]) == VK_SUCCESS);
+        VK_CHECK(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_swapChainFramebuffers[i]));
     }
 }
 
 void Renderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-    VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+    VkBuffer& buffer, GpuAllocation& bufferAllocation)
 {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -942,78 +1330,354 @@ void Renderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemor
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // only used by graphics queue
 
-    assert(vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer) == VK_SUCCESS);
+    VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer));
+
+    VK_CHECK(m_allocator.AllocateForBuffer(buffer, properties, bufferAllocation));
+}
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
+void Renderer::DestroyBuffer(VkBuffer& buffer, GpuAllocation& bufferAllocation)
+{
+    vkDestroyBuffer(m_device, buffer, nullptr);
+    m_allocator.Free(bufferAllocation);
+    buffer = VK_NULL_HANDLE;
+}
+
+/*
+ * Importing the FBX file takes seconds: the SDK's importer, LOD generation and mesh optimization. What comes out
+ * of it is cooked into a MeshContainer next to the source, later starts only hash the source and read the cooked
+ * file. The import runs again when the source, the importer, the LOD settings or the vertex layout changed.
+ */
+void Renderer::LoadModel()
+{
+    const std::string sourcePath = "objects/model.fbx";
+    const std::string cachePath = "objects/model.smesh";
+    const MeshLodSettings lodSettings;
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Without a key there is nothing to tell this source's cache entry apart from any other unreadable source's,
+    // so the cache is neither read nor written
+    MeshContainer::Key key{};
+    const bool hasKey = MeshContainer::MakeKey(sourcePath, lodSettings, key);
+    const char* reason = "source not readable, cache skipped";
+    if (hasKey && m_meshContainer.Load(cachePath, key, &reason))
+    {
+        std::cout << "Mesh cache: loaded " << m_meshContainer.GetMeshCount() << " meshes from " << cachePath << " in "
+            << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()
+            << " ms" << std::endl;
+        return;
+    }
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+    std::cout << "Mesh cache: importing " << sourcePath << " (" << reason << ")" << std::endl;
+    {
+        const Asset::FbxLoader loader(sourcePath.c_str(), lodSettings);
+        m_meshContainer.Build(loader.GetMeshes(), key);
+    }
 
-    assert(vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory) == VK_SUCCESS);
+    if (hasKey && !m_meshContainer.Write(cachePath))
+    {
+        std::cout << "Mesh cache: failed to write " << cachePath << std::endl;
+    }
 
-    vkBindBufferMemory(m_device, buffer, bufferMemory, 0);
+    std::cout << "Mesh cache: imported " << m_meshContainer.GetMeshCount() << " meshes in "
+        << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()
+        << " ms" << std::endl;
 }
 
-void Renderer::LoadModel()
+void Renderer::UpdateInstances(uint32_t currentImage)
+{
+    PROFILE_ZONE("Renderer::UpdateInstances");
+
+    FrameObjects& frame = m_frameObjects[currentImage];
+
+    CullInput& cull = frame.cullInput;
+    cull = {};
+    cull.viewProjection = frame.viewProjection;
+
+    const auto cullStartTime = std::chrono::high_resolution_clock::now();
+
+    // Gather the bounds of everything that can be drawn into SoA arrays, reused from frame to frame
+    m_cullSpheres.Clear();
+    m_cullMeshIndices.clear();
+    m_renderQuery.each([this](const Position& position, const Mesh& mesh, const ShapeOfSphere* shape)
+        {
+            if (mesh.meshIndex >= m_meshDraws.size())
+            {
+                return;
+            }
+
+            // The physics shape and the drawn mesh don't have to agree, whichever is bigger
+            float radius = m_meshDraws[mesh.meshIndex].boundingRadius;
+            if (shape != nullptr)
+            {
+                radius = std::max(radius, shape->sphereRadius);
+            }
+
+            m_cullSpheres.Add(position.x, position.y, position.z, radius);
+            m_cullMeshIndices.push_back(mesh.meshIndex);
+        });
+
+    const uint32_t visibleCount = FrustumCuller::Cull(&m_workerPool, Frustum::FromViewProjection(frame.viewProjection),
+        m_cullSpheres, m_cullVisible);
+
+    m_cullStats.entityCount = m_cullSpheres.Size();
+    m_cullStats.visibleCount = visibleCount;
+    m_cullStats.cpuCullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cullStartTime).count();
+
+    /*
+     * Every visible instance picks its mesh LOD: the coarsest one whose error, projected at the instance's
+     * distance, covers no more than m_lodErrorPixels. The closest instance also decides which mips the mesh's
+     * texture needs, from the mesh's projected diameter.
+     */
+    m_cullLods.resize(m_cullVisible.size());
+    m_cullStats.triangleCount = 0;
+    m_cullStats.fullDetailTriangleCount = 0;
+    std::vector<float> screenSizes(m_meshDraws.size(), 0.0f);
+    for (size_t i = 0; i < m_cullVisible.size(); ++i)
+    {
+        const uint32_t visible = m_cullVisible[i];
+        const MeshDrawInfo& draw = m_meshDraws[m_cullMeshIndices[visible]];
+
+        const glm::vec4 clip = frame.viewProjection * glm::vec4(m_cullSpheres.x[visible], m_cullSpheres.y[visible], m_cullSpheres.z[visible], 1.0f);
+        const float pixelsPerUnit = m_screenScale / std::max(clip.w, 1.0f);
+
+        uint32_t lod = 0;
+        while (lod + 1 < draw.lods.size() && draw.lods[lod + 1].error * pixelsPerUnit <= m_lodErrorPixels)
+        {
+            ++lod;
+        }
+
+        m_cullLods[i] = lod;
+        m_cullStats.triangleCount += draw.lods[lod].indexCount / 3;
+        m_cullStats.fullDetailTriangleCount += draw.lods[0].indexCount / 3;
+
+        float& screenSize = screenSizes[m_cullMeshIndices[visible]];
+        screenSize = std::max(screenSize, 2.0f * draw.boundingRadius * pixelsPerUnit);
+    }
+
+    for (size_t i = 0; i < m_meshDraws.size(); ++i)
+    {
+        if (screenSizes[i] > 0.0f)
+        {
+            m_textureStreamer.RequestScreenSize(m_meshDraws[i].texture, screenSizes[i]);
+        }
+    }
+
+    /*
+     * Only the visible instances go to the GPU, grouped by draw slot (part of a mesh LOD): count them per slot,
+     * then write each one straight into its slot's range of the ring buffer, once for every part of its LOD. No
+     * sorting and no per-object draw call or descriptor update, building the draws happens on the GPU. The CPU
+     * still visits every entity each frame though: gathering, culling, picking the LOD and packing above are linear
+     * in the entity count, cull.comp only repeats the frustum test on what is left.
+     */
+    std::vector<uint32_t> writeIndex(m_drawSlotCount, 0);
+    for (size_t i = 0; i < m_cullVisible.size(); ++i)
+    {
+        const MeshDrawInfo& draw = m_meshDraws[m_cullMeshIndices[m_cullVisible[i]]];
+        const MeshLodInfo& lod = draw.lods[m_cullLods[i]];
+        for (uint32_t part = lod.firstPart; part < lod.firstPart + lod.partCount; ++part)
+        {
+            ++writeIndex[draw.firstDrawSlot + part];
+        }
+    }
+
+    uint32_t instanceCount = 0;
+    for (uint32_t& start : writeIndex)
+    {
+        const uint32_t count = start;
+        start = instanceCount;
+        instanceCount += count;
+    }
+
+    if (instanceCount == 0)
+    {
+        return;
+    }
+
+    cull.instances = m_frameRing.Allocate(sizeof(InstanceData) * instanceCount);
+    cull.instanceMeshes = m_frameRing.Allocate(sizeof(uint32_t) * instanceCount);
+    cull.meshes = m_frameRing.Allocate(sizeof(GpuMeshInfo) * m_drawSlotCount);
+    if (!cull.instances.IsValid() || !cull.instanceMeshes.IsValid() || !cull.meshes.IsValid())
+    {
+        // ReserveFrameRing sized it for every entity, this is a bug
+        std::cout << "Renderer: frame ring out of space for " << instanceCount << " instances, nothing is drawn" << std::endl;
+        return;
+    }
+
+    GpuMeshInfo* meshes = static_cast<GpuMeshInfo*>(cull.meshes.mapped);
+    for (MeshDrawInfo& draw : m_meshDraws)
+    {
+        draw.textureSlot = m_textureStreamer.GetSlot(draw.texture);
+        for (uint32_t part = 0; part < draw.parts.size(); ++part)
+        {
+            const uint32_t slot = draw.firstDrawSlot + part;
+            const MeshPartInfo& meshPart = draw.parts[part];
+
+            // Every field, the padding included: the ring memory still holds an older frame's data
+            GpuMeshInfo& info = meshes[slot];
+            info.indexCount = meshPart.indexCount;
+            info.firstIndex = meshPart.firstIndex;
+            info.vertexOffset = meshPart.vertexOffset;
+            info.firstInstance = writeIndex[slot];
+            info.boundingRadius = draw.boundingRadius;
+            info.padding[0] = info.padding[1] = info.padding[2] = 0.0f;
+            info.positionDequantize = glm::vec4(draw.quantization.positionOffset, draw.quantization.positionScale);
+            info.texCoordDequantize = glm::vec4(draw.quantization.texCoordOffset, draw.quantization.texCoordScale, 0.0f);
+        }
+    }
+
+    InstanceData* instances = static_cast<InstanceData*>(cull.instances.mapped);
+    uint32_t* instanceMeshes = static_cast<uint32_t*>(cull.instanceMeshes.mapped);
+    for (size_t i = 0; i < m_cullVisible.size(); ++i)
+    {
+        const uint32_t visible = m_cullVisible[i];
+        const MeshDrawInfo& draw = m_meshDraws[m_cullMeshIndices[visible]];
+        const MeshLodInfo& lod = draw.lods[m_cullLods[i]];
+        for (uint32_t part = lod.firstPart; part < lod.firstPart + lod.partCount; ++part)
+        {
+            const uint32_t slot = draw.firstDrawSlot + part;
+            const uint32_t index = writeIndex[slot]++;
+            instances[index].positionAndScale = glm::vec4(m_cullSpheres.x[visible], m_cullSpheres.y[visible], m_cullSpheres.z[visible], 1.0f);
+            instances[index].textureIndex = draw.textureSlot;
+            instanceMeshes[index] = slot;
+        }
+    }
+
+    cull.instanceCount = instanceCount;
+    cull.meshCount = m_drawSlotCount;
+}
+
+void Renderer::DrawCullingImGui()
 {
-    if (!m_meshLoader)
+    ImGui::Begin("Culling");
+
+    ImGui::Text("%u of %u entities visible", m_cullStats.visibleCount, m_cullStats.entityCount);
+    ImGui::Text("CPU culling %.3f ms (%s, %u worker threads)", m_cullStats.cpuCullMs,
+        FrustumCuller::GetPathName(FrustumCuller::GetBestPath()), m_workerPool.GetThreadCount());
+
+    ImGui::Text("%llu triangles, %llu at full detail", static_cast<unsigned long long>(m_cullStats.triangleCount),
+        static_cast<unsigned long long>(m_cullStats.fullDetailTriangleCount));
+    ImGui::SliderFloat("LOD error pixels", &m_lodErrorPixels, 0.0f, 8.0f, "%.1f");
+
+    if (ImGui::Button("Benchmark 1M spheres"))
     {
-        m_meshLoader = std::make_unique<Asset::FbxLoader>("objects/model.fbx");
+        m_cullBenchmark = FrustumCuller::RunBenchmark(&m_workerPool, 1000000);
     }
+
+    if (m_cullBenchmark.sphereCount > 0)
+    {
+        const auto matches = [](bool match) { return match ? "" : ", DOES NOT MATCH scalar"; };
+        ImGui::Text("%u spheres, %u visible", m_cullBenchmark.sphereCount, m_cullBenchmark.visibleCount);
+        ImGui::Text("scalar   %.3f ms", m_cullBenchmark.scalarMs);
+        ImGui::Text("SSE      %.3f ms%s", m_cullBenchmark.sseMs, matches(m_cullBenchmark.sseMatches));
+        ImGui::Text("AVX2     %.3f ms%s", m_cullBenchmark.avx2Ms, matches(m_cullBenchmark.avx2Matches));
+        ImGui::Text("parallel %.3f ms%s", m_cullBenchmark.parallelMs, matches(m_cullBenchmark.parallelMatches));
+        ImGui::Text("single core %.3f ms per 1M spheres, target under %.1f ms",
+            m_cullBenchmark.GetBestSingleCoreMsPerMillionSpheres(), CullingBenchmarkResult::TargetMsPerMillionSpheres);
+    }
+
+    ImGui::End();
 }
 
-void Renderer::CreateVertexBuffer()
+void Renderer::DrawFramePacingImGui()
 {
-    auto& vertices = m_meshLoader->GetMeshes()[0].m_vertices;
-    const auto verticesCount = vertices.size();
+    ImGui::Begin("Frame Pacing");
 
-    const VkDeviceSize bufferSize = sizeof(vertices[0]) * verticesCount;
+    if (ImGui::BeginCombo("present mode", GetPresentModeName(m_presentMode)))
+    {
+        for (const VkPresentModeKHR mode : m_supportedPresentModes)
+        {
+            if (ImGui::Selectable(GetPresentModeName(mode), mode == m_presentMode) && mode != m_presentMode)
+            {
+                m_pacingSettings.presentMode = mode;
+                m_swapChainOutOfDate = true;
+            }
+        }
+        ImGui::EndCombo();
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    int imageCount = static_cast<int>(m_swapChainImages.size());
+    if (ImGui::SliderInt("swap chain images", &imageCount, 1, 8) && imageCount != static_cast<int>(m_swapChainImages.size()))
+    {
+        m_pacingSettings.swapChainImageCount = static_cast<uint32_t>(imageCount);
+        m_swapChainOutOfDate = true;
+    }
 
-    void* data;
-    vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), bufferSize);
-    vkUnmapMemory(m_device, stagingBufferMemory);
+    float frameRateLimit = static_cast<float>(m_framePacer.GetFrameRateLimit());
+    if (ImGui::DragFloat("fps limit", &frameRateLimit, 1.0f, 0.0f, 1000.0f, frameRateLimit > 0.0f ? "%.0f" : "off"))
+    {
+        m_framePacer.SetFrameRateLimit(frameRateLimit);
+    }
 
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // vertex buffer type
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertexBuffer, m_vertexBufferMemory);
+    ImGui::Text("%u frames in flight (fixed at startup)", m_framesInFlight);
 
-    CopyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
+    const FramePacer::LatencyStats latency = m_framePacer.GetLatencyStats();
+    ImGui::Text("input to present %.2f ms, max %.2f ms", latency.averageMs, latency.maxMs);
 
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    ImGui::End();
 }
 
-void Renderer::CreateIndexBuffer()
+void Renderer::CreateVertexBuffer()
 {
-    auto& indices = m_meshLoader->GetMeshes()[0].m_indices;
+    // The cooked vertices are GpuVertex already, every mesh quantized on its own. The culling pass hands the
+    // dequantization to the vertex shader.
+    m_meshDraws.clear();
 
-    const VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    for (uint32_t meshIndex = 0; meshIndex < m_meshContainer.GetMeshCount(); ++meshIndex)
+    {
+        const MeshContainer::Mesh& mesh = m_meshContainer.GetMesh(meshIndex);
+        MeshDrawInfo draw;
+        draw.vertexOffset = mesh.vertexOffset;
+        draw.boundingRadius = mesh.boundingRadius;
+        draw.quantization = mesh.quantization;
+        draw.texture = m_objectTexture;
+        draw.textureSlot = m_textureStreamer.GetSlot(m_objectTexture);
+        m_meshDraws.push_back(draw);
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    const VkDeviceSize bufferSize = m_meshContainer.GetVertexDataSize();
 
-    void* data;
-    vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(m_device, stagingBufferMemory);
+    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // vertex buffer type
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertexBuffer, m_vertexBufferAllocation);
 
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, // index buffer type
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indexBuffer, m_indexBufferMemory);
+    m_uploadManager.UploadBuffer(m_vertexBuffer, m_meshContainer.GetVertexData(), bufferSize, 0,
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+}
+
+void Renderer::CreateIndexBuffer()
+{
+    // Indices stay relative to their own part, the draw adds the part's vertexOffset. CreateVertexBuffer added the draws.
+    m_drawSlotCount = 0;
+    m_maxLodPartCount = 1;
+
+    for (uint32_t meshIndex = 0; meshIndex < m_meshContainer.GetMeshCount(); ++meshIndex)
+    {
+        const MeshContainer::Mesh& mesh = m_meshContainer.GetMesh(meshIndex);
+        MeshDrawInfo& draw = m_meshDraws[meshIndex];
+        draw.firstDrawSlot = m_drawSlotCount;
+        draw.parts.clear();
+        for (uint32_t part = 0; part < mesh.partCount; ++part)
+        {
+            const MeshContainer::Part& cooked = m_meshContainer.GetPart(mesh.firstPart + part);
+            draw.parts.push_back({ cooked.indexCount, cooked.firstIndex, cooked.vertexOffset });
+        }
+        draw.lods.clear();
+        for (uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+        {
+            const MeshContainer::Lod& cooked = m_meshContainer.GetLod(mesh.firstLod + lod);
+            draw.lods.push_back({ cooked.firstPart, cooked.partCount, cooked.indexCount, cooked.error });
+            m_maxLodPartCount = std::max(m_maxLodPartCount, cooked.partCount);
+        }
+        m_drawSlotCount += static_cast<uint32_t>(draw.parts.size());
+    }
 
-    CopyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
+    const VkDeviceSize bufferSize = m_meshContainer.GetIndexDataSize();
 
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, // index buffer type
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indexBuffer, m_indexBufferAllocation);
+
+    m_uploadManager.UploadBuffer(m_indexBuffer, m_meshContainer.GetIndexData(), bufferSize, 0,
+        VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 }
 
 void Renderer::CreateDescriptorPool()
@@ -1022,15 +1686,15 @@ void Renderer::CreateDescriptorPool()
 
     //std::array<VkDescriptorPoolSize, 2> poolSizes{};
     //poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    //poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    //poolSizes[0].descriptorCount = static_cast<uint32_t>(m_framesInFlight);
     //poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    //poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) + 1 /* for ImGui runtime texture*/;
+    //poolSizes[1].descriptorCount = static_cast<uint32_t>(m_framesInFlight) + 1 /* for ImGui runtime texture*/;
 
     //VkDescriptorPoolCreateInfo poolInfo{};
     //poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     //poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     //poolInfo.pPoolSizes = poolSizes.data();
-    //poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    //poolInfo.maxSets = static_cast<uint32_t>(m_framesInFlight);
 
     //assert(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool) == VK_SUCCESS);
 
@@ -1056,188 +1720,68 @@ void Renderer::CreateDescriptorPool()
     pool_info.maxSets = 1000 * IM_ARRAYSIZE(pool_sizes);
     pool_info.poolSizeCount = static_cast<uint32_t>(IM_ARRAYSIZE(pool_sizes));
     pool_info.pPoolSizes = pool_sizes;
-    const VkResult err = vkCreateDescriptorPool(m_device, &pool_info, nullptr, &m_descriptorPool);
-    assert(err == VK_SUCCESS);
+    VK_CHECK(vkCreateDescriptorPool(m_device, &pool_info, nullptr, &m_descriptorPool));
 }
 
 void Renderer::CreateDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(m_framesInFlight, m_descriptorSetLayout);
 
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = m_descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(m_framesInFlight);
     allocInfo.pSetLayouts = layouts.data();
 
     std::vector<VkDescriptorSet> descriptorSets;
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    assert(vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()) == VK_SUCCESS);
+    descriptorSets.resize(m_framesInFlight);
+    VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()));
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
     {
-        auto& frame = m_frameObjects[i];
-        frame.descriptorSet = descriptorSets[i];
-
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = frame.uniformBuffer;
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = descriptorSets[i];
-        descriptorWrites[0].dstBinding = 0; // Reminder from .vert: layout(binding = 0) uniform UniformBufferObject
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-        // add object texture reference
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = m_objectTexture.m_view;
-        imageInfo.sampler = m_textureSampler;
-
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = descriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
-
-        vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        m_frameObjects[i].descriptorSet = descriptorSets[i];
+        WriteDescriptorSet(i);
     }
 }
 
-void Renderer::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
-{
-    /*
-     * Memory transfer operations are executed using command buffers, just like drawing commands.
-     * Therefore we must first allocate a temporary command buffer. You may wish to create a separate
-     * command pool for these kinds of short-lived buffers, because the implementation may be able to
-     * apply memory allocation optimizations. You should use the VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
-     * flag during command pool generation in that case.
-     */
-
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-    VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0; // Optional
-    copyRegion.dstOffset = 0; // Optional
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    EndSingleTimeCommands(commandBuffer);
-}
-
-void Renderer::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+void Renderer::WriteDescriptorSet(uint32_t frameIndex)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1; // no mipmaps levels
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1; // image is not an array
-
-    barrier.srcAccessMask = 0; // TODO
-    barrier.dstAccessMask = 0; // TODO
-
-    VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_NONE;
-    VkPipelineStageFlags destinationStage = VK_PIPELINE_STAGE_NONE;
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    FrameObjects& frame = m_frameObjects[frameIndex];
+    if (!frame.descriptorSetOutdated)
     {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        return;
     }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    frame.descriptorSetOutdated = false;
 
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }
-    else
-    {
-        assert(false); // unsupported layout transition
-    }
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = m_frameRing.GetBuffer();
+    bufferInfo.offset = 0; // the actual offset is given with vkCmdBindDescriptorSets every frame
+    bufferInfo.range = sizeof(UniformBufferObject);
 
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        sourceStage, destinationStage,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
+    std::array<VkWriteDescriptorSet, 1> descriptorWrites{};
 
-    EndSingleTimeCommands(commandBuffer);
-}
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = frame.descriptorSet;
+    descriptorWrites[0].dstBinding = 0; // Reminder from .vert: layout(binding = 0) uniform UniformBufferObject
+    descriptorWrites[0].dstArrayElement = 0;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pBufferInfo = &bufferInfo;
 
-void Renderer::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    // Textures are not part of this set, they live in the texture table bound as set 1
 
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-
-    region.imageOffset = { 0, 0, 0 };
-    region.imageExtent = {
-        width,
-        height,
-        1
-    };
-
-    vkCmdCopyBufferToImage(
-        commandBuffer,
-        buffer,
-        image,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &region
-    );
-
-    EndSingleTimeCommands(commandBuffer);
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 void Renderer::CreateDescriptorSetLayout()
 {
     VkDescriptorSetLayoutBinding uboLayoutBinding{};
     uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.descriptorCount = 1;
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     uboLayoutBinding.pImmutableSamplers = nullptr; // Useful for textures, null for MVP stuff, though
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.descriptorCount = 1;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT; // to be used in fragment shaders
-
     VkDescriptorSetLayoutBinding imGuiSamplerLayoutBinding{};
     imGuiSamplerLayoutBinding.binding = 2;
     imGuiSamplerLayoutBinding.descriptorCount = 1;
@@ -1246,34 +1790,98 @@ void Renderer::CreateDescriptorSetLayout()
     imGuiSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT; // to be used in fragment shaders
 
 
-    const std::array<VkDescriptorSetLayoutBinding, 3> bindings = { uboLayoutBinding, samplerLayoutBinding, imGuiSamplerLayoutBinding };
+    // Binding 1 used to be the object texture, scene textures are in the BindlessTextureTable now
+    const std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, imGuiSamplerLayoutBinding };
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
     layoutInfo.pBindings = bindings.data();
 
-    assert(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout) == VK_SUCCESS);
+    VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout));
 }
 
 void Renderer::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 {
-    vkResetCommandBuffer(commandBuffer, 0);
+    PROFILE_ZONE("Renderer::RecordCommandBuffer");
+
+    // No vkResetCommandBuffer, the frame's command pools were reset as a whole in DrawFrame
+
+    const FrameObjects& frame = m_frameObjects[m_currentFrame];
+
+    // Sizes this frame's draw buffer, the draws recorded below need it
+    m_culler.Prepare(m_currentFrame, frame.cullInput);
+
+    /*
+     * The draw slots are split into ranges, each recorded into a secondary command buffer from its own pool by the
+     * worker pool, the main thread included. Only the draws are worth splitting: a range costs its state setup and
+     * a wake-up, so there are as many ranges as the measured draw recording time pays for. With multi draw indirect
+     * a range is a single draw whatever its size, the scene then stays in one secondary.
+     */
+    const uint32_t drawSlotCount = m_culler.GetDrawSlotCount(m_currentFrame);
+    const uint32_t maxPartitions = static_cast<uint32_t>(frame.drawCommandBuffers.size());
+    uint32_t partitionCount = 1;
+    if (m_culler.RecordsDrawPerSlot())
+    {
+        const double estimatedMs = m_recordingMsPerDraw * drawSlotCount;
+        partitionCount = std::max(1u, std::min(maxPartitions, static_cast<uint32_t>(estimatedMs / MinRecordingMsPerThread)));
+    }
+    const uint32_t slotsPerPartition = (drawSlotCount + partitionCount - 1) / partitionCount;
+
+    std::array<double, MaxRecordingPartitions> drawRecordingMs{};
+    m_workerPool.ParallelFor(partitionCount, 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t partition = begin; partition < end; ++partition)
+            {
+                drawRecordingMs[partition] = RecordSceneCommands(frame.drawCommandBuffers[partition], imageIndex,
+                    partition * slotsPerPartition, slotsPerPartition);
+            }
+        });
+
+    // Smoothed, a single frame's timing is too noisy to pick the next frame's split from
+    if (m_culler.RecordsDrawPerSlot() && drawSlotCount > 0)
+    {
+        double recordingMs = 0.0;
+        for (uint32_t partition = 0; partition < partitionCount; ++partition)
+        {
+            recordingMs += drawRecordingMs[partition];
+        }
+        const double msPerDraw = recordingMs / drawSlotCount;
+        m_recordingMsPerDraw = m_recordingMsPerDraw == 0.0 ? msPerDraw : m_recordingMsPerDraw * 0.9 + msPerDraw * 0.1;
+    }
+
+    m_recordingImageIndex = imageIndex;
+    m_sceneSecondaryCommandBuffers.assign(frame.drawCommandBuffers.begin(), frame.drawCommandBuffers.begin() + partitionCount);
 
     ////////////////////////////// Begin command buffer recording //////////////////////////////
 
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0; // Optional
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     beginInfo.pInheritanceInfo = nullptr; // Optional
 
-    assert(vkBeginCommandBuffer(commandBuffer, &beginInfo) == VK_SUCCESS);
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+    m_gpuProfiler.ResetQueries(commandBuffer);
+    {
+        GpuProfileScope frameScope(m_gpuProfiler, commandBuffer, "frame");
+
+        // Culling, then the scene pass, with the barriers and layout transitions the render graph worked out
+        m_renderGraph.SetImportedImage(m_swapChainResource, m_swapChainImages[imageIndex]);
+        m_renderGraph.SetImportedBuffer(m_culledDrawsResource, m_culler.GetOutputBuffer(m_currentFrame));
+        m_renderGraph.Execute(commandBuffer);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+}
 
+void Renderer::RecordScenePass(VkCommandBuffer commandBuffer)
+{
     ////////////////////////////// Starting a render pass //////////////////////////////
 
     VkRenderPassBeginInfo renderPassBeginInfo{};
     renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassBeginInfo.renderPass = m_renderPass;
-    renderPassBeginInfo.framebuffer = m_swapChainFramebuffers[imageIndex];
+    renderPassBeginInfo.framebuffer = m_swapChainFramebuffers[m_recordingImageIndex];
     renderPassBeginInfo.renderArea.offset = { 0, 0 };
     renderPassBeginInfo.renderArea.extent = m_swapChainExtent;
 
@@ -1284,70 +1892,125 @@ void Renderer::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t image
     renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassBeginInfo.pClearValues = clearValues.data();
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    GpuProfileScope scope(m_gpuProfiler, commandBuffer, "scene");
+
+    /*
+     * ImGui isn't thread safe, it is recorded here on the main thread after the scene draws. Recording it this late
+     * nests its profiler scope in the scene's. There is no ui headless.
+     */
+    if (!IsHeadless())
     {
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+        const FrameObjects& frame = m_frameObjects[m_currentFrame];
+        RecordImGuiCommands(frame.imGuiCommandBuffer, m_recordingImageIndex);
+        m_sceneSecondaryCommandBuffers.push_back(frame.imGuiCommandBuffer);
+    }
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = static_cast<float>(m_swapChainExtent.width);
-        viewport.height = static_cast<float>(m_swapChainExtent.height);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(m_sceneSecondaryCommandBuffers.size()),
+        m_sceneSecondaryCommandBuffers.data());
+    vkCmdEndRenderPass(commandBuffer);
+}
 
-        VkRect2D scissor{};
-        scissor.offset = { 0, 0 };
-        scissor.extent = m_swapChainExtent;
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+void Renderer::BeginSecondaryCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    // Secondary buffers executed inside of a render pass have to know which one
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = m_renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = m_swapChainFramebuffers[imageIndex];
 
-        VkBuffer vertexBuffers[] = { m_vertexBuffer };
-        VkDeviceSize offsets[] = { 0 };
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-        /*
-         *  Driver developers recommend that you also store multiple buffers, like the vertex and index buffer,
-         *  into a single VkBuffer and use offsets in commands like vkCmdBindVertexBuffers. The advantage is
-         *  that your data is more cache friendly in that case, because it's closer together.
-         */
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+}
 
-        vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0,
-            VK_INDEX_TYPE_UINT16 /* or VK_INDEX_TYPE_UINT32 for more than 65k vertices*/);
+double Renderer::RecordSceneCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t firstDrawSlot, uint32_t drawSlotCount)
+{
+    PROFILE_ZONE("Renderer::RecordSceneCommands");
 
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
-            &m_frameObjects[m_currentFrame].descriptorSet, 0, nullptr);
+    BeginSecondaryCommandBuffer(commandBuffer, imageIndex);
 
-        auto& indices = m_meshLoader->GetMeshes()[0].m_indices;
+    // Nothing is inherited from the primary buffer but the render pass, every secondary sets up its own state
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
 
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(m_swapChainExtent.width);
+    viewport.height = static_cast<float>(m_swapChainExtent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
+    VkRect2D scissor{};
+    scissor.offset = { 0, 0 };
+    scissor.extent = m_swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        // ImGui
-        {
-            // Start the Dear ImGui frame
-            ImGui_ImplVulkan_NewFrame();
-            ImGui_ImplGlfw_NewFrame();
-            ImGui::NewFrame();
+    VkBuffer vertexBuffers[] = { m_vertexBuffer };
+    VkDeviceSize offsets[] = { 0 };
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 
-            ImGui::ShowDemoWindow();
+    /*
+     *  Driver developers recommend that you also store multiple buffers, like the vertex and index buffer,
+     *  into a single VkBuffer and use offsets in commands like vkCmdBindVertexBuffers. The advantage is
+     *  that your data is more cache friendly in that case, because it's closer together.
+     */
 
-            
+    // All draws use 16 bit indices, the importer splits meshes with more vertices into parts with their own
+    // vertexOffset (base vertex) instead of doubling the index bandwidth of every mesh
+    vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT16);
 
-            // Rendering
-            ImGui::Render();
-            ImDrawData* draw_data = ImGui::GetDrawData();
-            const bool is_minimized = (draw_data->DisplaySize.x <= 0.0f || draw_data->DisplaySize.y <= 0.0f);
-            if (!is_minimized)
-            {
-                // Record dear imgui primitives into command buffer
-                ImGui_ImplVulkan_RenderDrawData(draw_data, commandBuffer);
-            }
-        }
+    const FrameObjects& frame = m_frameObjects[m_currentFrame];
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+        &frame.descriptorSet, 1, &frame.uniformBufferOffset);
+
+    // All textures at once, draws pick theirs by index and never rebind
+    const VkDescriptorSet textureTable = m_textureTable.GetDescriptorSet(m_currentFrame);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 1, 1,
+        &textureTable, 0, nullptr);
+
+    // One indirect instanced draw per visible mesh, firstInstance points at the mesh's range of visible instances
+    const auto drawStartTime = std::chrono::high_resolution_clock::now();
+    m_culler.RecordDraws(commandBuffer, m_currentFrame, firstDrawSlot, drawSlotCount);
+    const double drawRecordingMs = MillisecondsSince(drawStartTime);
+
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+    return drawRecordingMs;
+}
+
+void Renderer::RecordImGuiCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    BeginSecondaryCommandBuffer(commandBuffer, imageIndex);
+
+    // Start the Dear ImGui frame
+    ImGui_ImplVulkan_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+
+    ImGui::ShowDemoWindow();
+    m_gameWorld->DrawImGui();
+    m_gpuProfiler.DrawImGui();
+    m_textureStreamer.DrawImGui();
+    DrawFramePacingImGui();
+    DrawCullingImGui();
+
+    // Rendering
+    ImGui::Render();
+    ImDrawData* draw_data = ImGui::GetDrawData();
+    const bool is_minimized = (draw_data->DisplaySize.x <= 0.0f || draw_data->DisplaySize.y <= 0.0f);
+    if (!is_minimized)
+    {
+        // Record dear imgui primitives into command buffer
+        GpuProfileScope scope(m_gpuProfiler, commandBuffer, "imgui");
+        ImGui_ImplVulkan_RenderDrawData(draw_data, commandBuffer);
     }
-    vkCmdEndRenderPass(commandBuffer);
 
-    assert(vkEndCommandBuffer(commandBuffer) == VK_SUCCESS);
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
 }
 
 bool Renderer::IsDeviceSuitable(VkPhysicalDevice device)
@@ -1358,6 +2021,18 @@ bool Renderer::IsDeviceSuitable(VkPhysicalDevice device)
     VkPhysicalDeviceFeatures deviceFeatures;
     vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+
+    const bool hasGraphicsQueue = FindQueueFamiliesWithSurfaces(device).graphicsFamily.has_value();
+
+    // Nothing is presented headless, integrated, virtual and CPU devices are fine too
+    if (IsHeadless())
+    {
+        return hasGraphicsQueue && supportedFeatures.samplerAnisotropy && supportedFeatures.drawIndirectFirstInstance &&
+            supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+    }
+
     const bool extensionsSupported = CheckDeviceExtensionSupport(device);
 
     bool swapChainAdequate = false;
@@ -1366,11 +2041,9 @@ bool Renderer::IsDeviceSuitable(VkPhysicalDevice device)
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
 
-    VkPhysicalDeviceFeatures supportedFeatures;
-    vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
-
     return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-        deviceFeatures.geometryShader && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+        deviceFeatures.geometryShader && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy &&
+        supportedFeatures.drawIndirectFirstInstance && supportedFeatures.shaderSampledImageArrayDynamicIndexing;
 }
 
 bool Renderer::CheckDeviceExtensionSupport(VkPhysicalDevice device)
@@ -1408,12 +2081,15 @@ VkPresentModeKHR Renderer::ChooseSwapPresentMode(const std::vector<VkPresentMode
 {
     for (const auto& availablePresentMode : availablePresentModes)
     {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+        if (availablePresentMode == m_pacingSettings.presentMode)
         {
             return availablePresentMode;
         }
     }
 
+    // The only mode every surface supports
+    std::cout << "Present mode " << GetPresentModeName(m_pacingSettings.presentMode)
+        << " is not supported, using fifo" << std::endl;
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -1482,13 +2158,24 @@ QueueFamilyIndices Renderer::FindQueueFamiliesWithSurfaces(VkPhysicalDevice devi
     int i = 0;
     for (const auto& queueFamily : queueFamilies)
     {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        // Culling runs as compute on the graphics queue
+        if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
         {
             indices.graphicsFamily = i;
         }
 
+        // A family that can only transfer is usually backed by a separate copy engine
+        if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            (queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0)
+        {
+            indices.transferFamily = i;
+        }
+
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+        if (m_surface != VK_NULL_HANDLE)
+        {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+        }
         if (presentSupport)
         {
             indices.presentFamily = i;
@@ -1497,47 +2184,96 @@ QueueFamilyIndices Renderer::FindQueueFamiliesWithSurfaces(VkPhysicalDevice devi
         i++;
     }
 
+    // Headless nothing is presented, the "present" queue is the graphics queue
+    if (IsHeadless())
+    {
+        indices.presentFamily = indices.graphicsFamily;
+    }
+
     return indices;
 }
 
-void Renderer::RecreateSwapChain()
+bool Renderer::RecreateSwapChain()
 {
-    // If we are minimized, block and wait.
+    // Minimized, a swap chain can't have an empty extent. Keep the old one until the window comes back.
     int width = 0, height = 0;
-    do
+    glfwGetFramebufferSize(m_window, &width, &height);
+    m_minimized = width == 0 || height == 0;
+    if (m_minimized)
     {
-        glfwGetFramebufferSize(m_window, &width, &height);
-        glfwWaitEvents();
-    } while (width == 0 || height == 0);
+        m_swapChainOutOfDate = true;
+        return false;
+    }
+    m_swapChainOutOfDate = false;
 
-    vkDeviceWaitIdle(m_device);
+    PROFILE_ZONE("Renderer::RecreateSwapChain");
 
-    CleanupSwapChain();
-    CreateSwapChain();
+    /*
+     * No vkDeviceWaitIdle: the frames in flight may still render into the old images and present them. The old
+     * swap chain, its views and framebuffers are destroyed once those frames have completed.
+     */
+    const VkSwapchainKHR oldSwapChain = m_swapChain;
+    m_deletionQueue.Push([device = m_device, oldSwapChain, views = std::move(m_swapChainImageViews),
+        framebuffers = std::move(m_swapChainFramebuffers)]()
+        {
+            for (VkFramebuffer framebuffer : framebuffers)
+            {
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            }
+            for (VkImageView view : views)
+            {
+                vkDestroyImageView(device, view, nullptr);
+            }
+            vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+        });
+    m_swapChainImageViews.clear();
+    m_swapChainFramebuffers.clear();
+
+    CreateSwapChain(oldSwapChain);
 
     CreateImageViews();
-    CreateDepthResources();
+    BuildRenderGraph(); // the depth buffer follows the swap chain extent
     CreateFramebuffers();
+    return true;
 }
 
-void Renderer::CreateUniformBuffers()
+void Renderer::CreateFrameObjects()
 {
-    const VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-    if (m_frameObjects.size() < MAX_FRAMES_IN_FLIGHT)
+    if (m_frameObjects.size() < m_framesInFlight)
     {
-        m_frameObjects.resize(MAX_FRAMES_IN_FLIGHT);
+        m_frameObjects.resize(m_framesInFlight);
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    // One partition per frame in flight, the uniforms of every frame are sub-allocated from it
+    m_frameRing.Init(m_physicalDevice, m_device, m_allocator, m_framesInFlight, FrameRingBaseBytesPerFrame);
+}
+
+void Renderer::ReserveFrameRing()
+{
+    // Every entity may be visible, each one is written once per part of its LOD: InstanceData and its draw slot
+    const VkDeviceSize entityCount = static_cast<VkDeviceSize>(m_renderQuery.count());
+    const VkDeviceSize requiredBytes = FrameRingBaseBytesPerFrame + sizeof(GpuMeshInfo) * m_drawSlotCount +
+        entityCount * m_maxLodPartCount * (sizeof(InstanceData) + sizeof(uint32_t));
+    if (requiredBytes <= m_frameRing.GetBytesPerFrame())
     {
-        auto& frame = m_frameObjects[i];
+        return;
+    }
+
+    // Half again as much, so a world that keeps spawning doesn't grow it every frame
+    const VkDeviceSize bytesPerFrame = std::max(requiredBytes, m_frameRing.GetBytesPerFrame() * 3 / 2);
+    std::cout << "Renderer: growing the frame ring to " << bytesPerFrame / 1024 << " KB per frame for " << entityCount
+        << " entities" << std::endl;
 
-        CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            frame.uniformBuffer, frame.uniformBuffersMemory);
+    // The frames still in flight read the old buffer, it goes once they are done
+    m_deletionQueue.Push([retired = m_frameRing]() mutable { retired.Release(); });
+    m_frameRing.Init(m_physicalDevice, m_device, m_allocator, m_framesInFlight, bytesPerFrame);
 
-        vkMapMemory(m_device, frame.uniformBuffersMemory, 0, bufferSize, 0, &frame.uniformBuffersMapped);
+    // Their culling input points into the old buffer as well, there is nothing left to verify their readback against
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
+    {
+        m_frameObjects[i].cullInput = {};
+        m_frameObjects[i].descriptorSetOutdated = true;
+        m_culler.DiscardReadback(i);
     }
 }
 
@@ -1568,28 +2304,11 @@ VkShaderModule Renderer::CreateShaderModule(const std::vector<char>& code)
     createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data()); // careful with alignment requirements
 
     VkShaderModule shaderModule;
-    assert(vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) == VK_SUCCESS);
+    VK_CHECK(vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule));
 
     return shaderModule;
 }
 
-uint32_t Renderer::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-    {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-        {
-            return i;
-        }
-    }
-
-    assert(false);
-    return 0;
-}
-
 void Renderer::CleanupSwapChain()
 {
     for (size_t i = 0; i < m_swapChainFramebuffers.size(); i++)
@@ -1602,52 +2321,107 @@ void Renderer::CleanupSwapChain()
         vkDestroyImageView(m_device, m_swapChainImageViews[i], nullptr);
     }
 
+    if (IsHeadless())
+    {
+        for (size_t i = 0; i < m_swapChainImages.size(); i++)
+        {
+            vkDestroyImage(m_device, m_swapChainImages[i], nullptr);
+            m_allocator.Free(m_offscreenImageAllocations[i]);
+        }
+        m_swapChainImages.clear();
+        m_offscreenImageAllocations.clear();
+        return;
+    }
+
     vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
 }
 
+void FrameObjects::ResetCommandPools(VkDevice device)
+{
+    vkResetCommandPool(device, commandPool, 0);
+    for (VkCommandPool pool : drawCommandPools)
+    {
+        vkResetCommandPool(device, pool, 0);
+    }
+}
+
 void FrameObjects::CleanUp(VkDevice device)
 {
+    // Command buffers are freed by their pools
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    for (VkCommandPool pool : drawCommandPools)
+    {
+        vkDestroyCommandPool(device, pool, nullptr);
+    }
+
     vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
     vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
     vkDestroyFence(device, inFlightFence, nullptr);
-
-    vkDestroyBuffer(device, uniformBuffer, nullptr);
-    vkFreeMemory(device, uniformBuffersMemory, nullptr);
 }
 
 void Renderer::Cleanup()
 {
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
+    m_renderQuery.destruct();
+    m_workerPool.Release();
+
+    // The device went idle in OnExitMainLoop
+    m_deletionQueue.Flush();
+
+    m_uploadManager.Release();
+    if (m_fontUploadTicket != 0)
+    {
+        ImGui_ImplVulkan_DestroyFontUploadObjects();
+    }
+
+    if (!IsHeadless())
+    {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+    }
 
     CleanupSwapChain();
 
-    m_depth.Release(*this);
+    m_renderGraph.Release();
 
     vkDestroySampler(m_device, m_textureSampler, nullptr);
-    m_objectTexture.Release(*this);
+    m_textureStreamer.Release();
 
     vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr); // cleans up descriptor sets
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+    m_textureTable.Release();
 
-    vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
-    vkFreeMemory(m_device, m_indexBufferMemory, nullptr);
-
-    vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
-    vkFreeMemory(m_device, m_vertexBufferMemory, nullptr);
+    DestroyBuffer(m_indexBuffer, m_indexBufferAllocation);
+    DestroyBuffer(m_vertexBuffer, m_vertexBufferAllocation);
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for (uint32_t i = 0; i < m_framesInFlight; ++i)
     {
         m_frameObjects[i].CleanUp(m_device);
     }
     m_frameObjects.clear();
+    m_gpuProfiler.Release();
+    std::cout << "Frame ring buffer peak usage: " << m_frameRing.GetPeakUsedBytes() << " of "
+        << m_frameRing.GetBytesPerFrame() << " bytes per frame" << std::endl;
+    m_frameRing.Release();
 
-    vkDestroyCommandPool(m_device, m_commandPool, nullptr); // command buffers are freed by the pool
+    m_culler.Release();
     vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+
+    m_pipelineCache.Save();
+    m_pipelineCache.Release();
     vkDestroyRenderPass(m_device, m_renderPass, nullptr);
-    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    if (m_surface != VK_NULL_HANDLE)
+    {
+        vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    }
+
+    const GpuMemoryStats memoryStats = m_allocator.GetStats();
+    std::cout << "Gpu memory at shutdown: " << memoryStats.allocationCount << " allocation(s) in "
+        << memoryStats.blockCount << " block(s), " << memoryStats.usedBytes << " of " << memoryStats.reservedBytes
+        << " bytes used" << std::endl;
+    m_allocator.Release();
+
     vkDestroyDevice(m_device, nullptr);
     vkDestroyInstance(m_instance, nullptr);
 }
@@ -10,10 +10,25 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
 #include <GpuImage.h>
+#include <GpuMemoryAllocator.h>
 #include <memory>
 #include <optional>
+#include <string>
 #include <vector>
-#include <Fbx/FbxLoader.h>
+#include <BindlessTextureTable.h>
+#include <DeferredDeletionQueue.h>
+#include <FramePacer.h>
+#include <FrameRingBuffer.h>
+#include <FrustumCuller.h>
+#include <GpuCuller.h>
+#include <GpuProfiler.h>
+#include <MeshContainer.h>
+#include <PipelineCache.h>
+#include <RenderGraph.h>
+#include <TextureStreamer.h>
+#include <UploadManager.h>
+#include <WorkerPool.h>
+#include <Flecs/GameWorld.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/mat4x4.hpp>
@@ -23,6 +38,7 @@ struct QueueFamilyIndices
 {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily; // only set for a transfer-only family (DMA engine)
 };
 
 struct SwapChainSupportDetails
@@ -45,34 +61,89 @@ struct UniformBufferObject
     // glm::vec2 foo;
     // alignas(16) glm::mat4 model;
 
-    alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
 };
 
+struct ShapeOfSphere;
+
+// One draw: a range of the shared 16 bit index buffer, relative to vertexOffset in the shared vertex buffer
+struct MeshPartInfo
+{
+    uint32_t indexCount = 0;
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+};
+
+// One level of detail of a mesh, a range of its parts. Meshes too big for 16 bit indices have several.
+struct MeshLodInfo
+{
+    uint32_t firstPart = 0;
+    uint32_t partCount = 0;
+    uint32_t indexCount = 0; // of all its parts
+    float error = 0.0f; // largest distance from the full detail surface, in mesh units
+};
+
+// Where a mesh lives inside of the shared vertex and index buffers
+struct MeshDrawInfo
+{
+    int32_t vertexOffset = 0;
+    float boundingRadius = 0.0f; // around the mesh origin
+    VertexQuantization quantization; // of the mesh's GpuVertex data
+    StreamedTextureHandle texture = 0;
+    uint32_t textureSlot = 0;    // in the texture table, the same for all instances so draws stay dynamically uniform
+    uint32_t firstDrawSlot = 0;  // every part is its own draw slot for the culler, parts[i] is slot firstDrawSlot + i
+    std::vector<MeshPartInfo> parts;
+    std::vector<MeshLodInfo> lods; // lods[0] is the full detail mesh
+};
+
 // Command buffer and synchronization objects per frame in the swap chain
 struct FrameObjects
 {
+    // Primary and ImGui command buffer, recorded on the main thread. Reset together once per frame.
+    VkCommandPool commandPool;
     VkCommandBuffer commandBuffer;
+    VkCommandBuffer imGuiCommandBuffer;
+
+    // One pool per recording thread so they never have to be synchronized, each with a secondary buffer for scene draws
+    std::vector<VkCommandPool> drawCommandPools;
+    std::vector<VkCommandBuffer> drawCommandBuffers;
+    // m_deletionQueue's submitted frame count right after this frame's last submission, 0 if never submitted
+    uint64_t submittedFrameCount = 0;
+
     VkSemaphore imageAvailableSemaphore;
     VkSemaphore renderFinishedSemaphore;
     VkFence inFlightFence;
 
-    // Uniform attribute/data stuff
-    VkBuffer uniformBuffer;
-    VkDeviceMemory uniformBuffersMemory;
-    void* uniformBuffersMapped;
+    // Uniform attribute/data stuff, lives in the frame ring buffer
+    uint32_t uniformBufferOffset = 0; // dynamic offset of binding 0
+    glm::mat4 viewProjection{ 1.0f };
+
+    // Instances of all meshes for this frame, culled and turned into draws on the GPU
+    CullInput cullInput;
 
     VkDescriptorSet descriptorSet;
+    bool descriptorSetOutdated = true; // binding 0 doesn't point at the current frame ring buffer yet
 
     void CleanUp(VkDevice device);
+    void ResetCommandPools(VkDevice device);
 };
 
 class Renderer
 {
     friend class GpuImage;
+    friend class TextureStreamer;
 public:
-    void Init(GLFWwindow* window);
+    void Init(GLFWwindow* window, GameWorld& gameWorld, const FramePacingSettings& pacing = {});
+
+    /*
+     * No window, no surface and no swap chain: frames are rendered into offscreen images of the given size and
+     * never presented. The camera advances by frameSeconds every frame, so runs are repeatable.
+     * Any device type will do, software rasterizers included. Headless only drops the window: the game still
+     * needs PhysX and the FBX SDK, which it links as Windows libraries.
+     */
+    void InitHeadless(GameWorld& gameWorld, VkExtent2D extent, float frameSeconds, const FramePacingSettings& pacing = {});
+    bool IsHeadless() const { return m_window == nullptr; }
 
     void Cleanup();
 
@@ -82,6 +153,37 @@ public:
 
     static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
 
+    // GPU time of every completed frame in submission order, empty if the graphics queue has no timestamps.
+    // The last frames in flight are only added by OnExitMainLoop.
+    const std::vector<double>& GetGpuFrameTimesMs() const { return m_gpuFrameTimesMs; }
+    std::string GetDeviceName() const;
+    VkExtent2D GetExtent() const { return m_swapChainExtent; }
+
+    // Scene pipeline creation without and with the pipeline cache, only measured by headless runs
+    double GetPipelineColdMs() const { return m_pipelineColdMs; }
+    double GetPipelineWarmMs() const { return m_pipelineWarmMs; }
+
+    // Has to be called before Init. Checks the GPU culling of every frame against the CPU, see GpuCuller::VerifyReadback
+    void SetVerifyGpuCulling(bool verify) { m_verifyGpuCulling = verify; }
+    uint32_t GetGpuCullingVerifiedCount() const { return m_gpuCullingVerifiedCount; }
+    uint32_t GetGpuCullingMismatchCount() const { return m_gpuCullingMismatchCount; }
+
+    // The main loop waits on it before sampling input, the renderer reports the presents
+    FramePacer& GetFramePacer() { return m_framePacer; }
+
+    // Nothing is rendered while the window has no area, the game keeps running
+    bool IsMinimized() const { return m_minimized; }
+
+    // Has to be called before Init, textures and samplers are created with it
+    void SetTextureSettings(const TextureSettings& settings) { m_textureSettings = settings; }
+    const TextureSettings& GetTextureSettings() const { return m_textureSettings; }
+
+    // Instances use the coarsest mesh LOD whose error covers at most this many pixels on screen, 0 disables LODs
+    void SetLodErrorPixels(float pixels) { m_lodErrorPixels = pixels; }
+
+    // Device memory of all loaded textures, mips included
+    VkDeviceSize GetTextureMemorySize() const { return m_textureStreamer.GetStats().residentBytes + m_textureStreamer.GetStats().fallbackBytes; }
+
 private:
     void InitVulkan();
     void InitImGui();
@@ -89,7 +191,7 @@ private:
 
     VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
     void CreateTextureSampler();
-    void CreateDepthResources();
+    void BuildRenderGraph();
     bool HasStencilComponent(VkFormat format);
     VkFormat FindDepthFormat();
     VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling,
@@ -102,18 +204,28 @@ private:
     void CreateLogicalDevice();
     void CreateRenderPass();
     void CreateGraphicsPipeline();
-    void CreateCommandPool();
+    void MeasurePipelineCache(const VkGraphicsPipelineCreateInfo& pipelineInfo);
+    void CreateCommandPools();
     void CreateCommandBuffers();
     void CreateSyncObjects();
+    void CollectGpuFrameTime(uint32_t frameIndex);
+    void VerifyGpuCulling(uint32_t frameIndex);
+    void CreateOffscreenTargets();
 
     void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-        VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-    VkCommandBuffer BeginSingleTimeCommands();
-    void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+        VkMemoryPropertyFlags properties, VkImage& image, GpuAllocation& imageAllocation, uint32_t mipLevels = 1);
 
 
     void UpdateUniformBuffer(uint32_t currentImage);
+    void UpdateInstances(uint32_t currentImage);
+    void DrawCullingImGui();
+    void DrawFramePacingImGui();
     void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    // Returns how long recording the draws took in milliseconds, the part of it that splitting the slots divides
+    double RecordSceneCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t firstDrawSlot, uint32_t drawSlotCount);
+    void RecordImGuiCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void RecordScenePass(VkCommandBuffer commandBuffer);
+    void BeginSecondaryCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
     bool IsDeviceSuitable(VkPhysicalDevice device);
     bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
@@ -125,31 +237,111 @@ private:
 
     void CreateDescriptorPool();
     void CreateDescriptorSets();
+    // Only while the frame isn't in flight
+    void WriteDescriptorSet(uint32_t frameIndex);
     void CleanupSwapChain();
-    void RecreateSwapChain();
-    void CreateSwapChain();
+    bool RecreateSwapChain();
+    void CreateSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE);
     void CreateImageViews();
     void CreateFramebuffers();
 
     void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-        VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+        VkBuffer& buffer, GpuAllocation& bufferAllocation);
+    void DestroyBuffer(VkBuffer& buffer, GpuAllocation& bufferAllocation);
     void CreateVertexBuffer();
     void CreateIndexBuffer();
-    void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-    void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
     void CreateDescriptorSetLayout();
 
+    // All buffers and images get their memory from here
+    GpuMemoryAllocator m_allocator;
+
+    // All buffer and image contents go to the GPU through here
+    UploadManager m_uploadManager;
+    UploadManager::Ticket m_fontUploadTicket = 0;
+
+    // Shared by every pipeline we create, ImGui included
+    PipelineCache m_pipelineCache;
+    double m_pipelineCreationMs = 0.0;
+    double m_pipelineColdMs = 0.0;
+    double m_pipelineWarmMs = 0.0;
+
+    // Per-frame dynamic data: uniforms, instance data, streaming vertices
+    FrameRingBuffer m_frameRing;
+    // Uniforms and slack, ReserveFrameRing adds room for the draw slots and every instance on top
+    static constexpr VkDeviceSize FrameRingBaseBytesPerFrame = 1ull * 1024 * 1024;
+
     VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_vertexBufferMemory = VK_NULL_HANDLE;
+    GpuAllocation m_vertexBufferAllocation;
 
     VkBuffer m_indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_indexBufferMemory = VK_NULL_HANDLE;
-
-    GpuImage m_objectTexture;
+    GpuAllocation m_indexBufferAllocation;
+
+    // All meshes share the vertex and index buffer above
+    std::vector<MeshDrawInfo> m_meshDraws;
+    uint32_t m_drawSlotCount = 0; // parts of all LODs of all meshes
+    uint32_t m_maxLodPartCount = 1; // the most ring buffer entries one instance can take
+    float m_lodErrorPixels = 1.0f;
+
+    // Every entity with a Position and a Mesh is drawn as an instance of its mesh
+    GameWorld* m_gameWorld = nullptr;
+    flecs::query<const Position, const Mesh, const ShapeOfSphere*> m_renderQuery;
+
+    // CPU frustum culling before anything is uploaded
+    WorkerPool m_workerPool;
+    BoundingSpheres m_cullSpheres;
+    std::vector<uint32_t> m_cullMeshIndices;
+    std::vector<uint32_t> m_cullVisible;
+    std::vector<uint32_t> m_cullLods; // of every visible instance
+
+    struct CullStats
+    {
+        uint32_t entityCount = 0;
+        uint32_t visibleCount = 0;
+        double cpuCullMs = 0.0;
+        uint64_t triangleCount = 0;           // of the visible instances at their LOD
+        uint64_t fullDetailTriangleCount = 0; // the same instances without LODs
+    };
+    CullStats m_cullStats;
+    CullingBenchmarkResult m_cullBenchmark;
+
+    GpuCuller m_culler;
+    GpuCuller::Features m_cullerFeatures;
+    bool m_verifyGpuCulling = false;
+    uint32_t m_gpuCullingVerifiedCount = 0; // frames
+    uint32_t m_gpuCullingMismatchCount = 0;
+
+    TextureSettings m_textureSettings;
+    // Loaded together at init, the object texture is handle 0
+    TextureStreamer m_textureStreamer;
+    StreamedTextureHandle m_objectTexture = 0;
+    float m_screenScale = 1.0f; // pixels per unit of view space size at distance 1, for the streaming requests
     VkSampler m_textureSampler = VK_NULL_HANDLE;
 
-    GpuImage m_depth;
+    // Every texture is addressed by index through the instance data, set 1 of the scene pipeline
+    BindlessTextureTable m_textureTable;
+    BindlessTextureTable::Features m_textureTableFeatures;
+
+    // Culling and the scene pass, rebuilt with the swap chain. Owns the depth buffer.
+    RenderGraph m_renderGraph;
+    RenderGraphResource m_swapChainResource = 0;
+    RenderGraphResource m_culledDrawsResource = 0;
+    RenderGraphResource m_depthResource = 0;
+
+    // What the scene pass executes this frame, filled in RecordCommandBuffer
+    uint32_t m_recordingImageIndex = 0;
+    std::vector<VkCommandBuffer> m_sceneSecondaryCommandBuffers;
+
+    // Per pass GPU times, the outermost scope covers the whole frame
+    GpuProfiler m_gpuProfiler;
+    std::vector<double> m_gpuFrameTimesMs;
+
+    // Headless only, the offscreen images stand in for the swap chain images
+    VkExtent2D m_headlessExtent{};
+    std::vector<GpuAllocation> m_offscreenImageAllocations;
+
+    // Fixed time step of the camera if not zero, otherwise it follows the wall clock
+    float m_fixedFrameSeconds = 0.0f;
+    uint64_t m_submittedFrameCount = 0;
 
 
     bool m_enableValidationLayers = true;
@@ -162,7 +354,7 @@ private:
         VK_KHR_SWAPCHAIN_EXTENSION_NAME
     };
 
-    std::unique_ptr<Asset::FbxLoader> m_meshLoader;
+    MeshContainer m_meshContainer; // cooked from objects/model.fbx
 
     GLFWwindow* m_window = nullptr;
     VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
@@ -171,6 +363,7 @@ private:
     VkQueue m_graphicsQueue = VK_NULL_HANDLE;
     VkSurfaceKHR m_surface = VK_NULL_HANDLE;
     VkQueue m_presentQueue = VK_NULL_HANDLE;
+    VkQueue m_transferQueue = VK_NULL_HANDLE; // same as m_graphicsQueue if there is no dedicated transfer family
     VkSwapchainKHR m_swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> m_swapChainImages; // no cleanup needed    
     std::vector<VkImageView> m_swapChainImageViews;
@@ -180,15 +373,35 @@ private:
     VkRenderPass m_renderPass = VK_NULL_HANDLE;
     VkPipeline m_graphicsPipeline = VK_NULL_HANDLE;
     std::vector<VkFramebuffer> m_swapChainFramebuffers;
-    VkCommandPool m_commandPool = VK_NULL_HANDLE;
 
-    bool m_framebufferResized = false;
+    /*
+     * Scene draws recorded per secondary command buffer are sized by time, not by slot count: each range has to take
+     * at least this long to record, about what waking a worker and setting up a secondary's state costs.
+     * m_recordingMsPerDraw is measured every frame by RecordSceneCommands.
+     */
+    static constexpr double MinRecordingMsPerThread = 0.05;
+    static constexpr uint32_t MaxRecordingPartitions = 64;
+    double m_recordingMsPerDraw = 0.0;
+
+    // Set on resize, present mode or image count changes and when the surface reports it. Recreated at the next frame.
+    bool m_swapChainOutOfDate = false;
+    bool m_minimized = false;
+
+    // Objects frames in flight may still use, retired swap chains in particular
+    DeferredDeletionQueue m_deletionQueue;
+    uint64_t m_completedFrameCount = 0;
 
     uint32_t m_queueRenderFamily = 0;
 
-    const int MAX_FRAMES_IN_FLIGHT = 2;
+    // Fixed at init, the per-frame resources are sized by it. Present mode and image count can change at runtime.
+    uint32_t m_framesInFlight = 2;
+    FramePacingSettings m_pacingSettings;
+    FramePacer m_framePacer;
+    std::vector<VkPresentModeKHR> m_supportedPresentModes;
+    VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR; // what the swap chain actually uses
 
-    void CreateUniformBuffers();
+    void CreateFrameObjects();
+    void ReserveFrameRing();
 
     std::vector<FrameObjects> m_frameObjects;
     uint32_t m_currentFrame = 0;
@@ -199,5 +412,4 @@ private:
 
     std::vector<char> ReadFile(const char* filename);
     VkShaderModule CreateShaderModule(const std::vector<char>& code);
-    uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 };
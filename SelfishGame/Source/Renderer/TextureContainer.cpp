@@ -0,0 +1,137 @@
+#include "TextureContainer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <Utilities.h>
+
+namespace
+{
+    constexpr uint64_t DataAlignment = 16;
+}
+
+bool TextureContainer::Load(const std::string& path)
+{
+    m_path = path;
+    m_data.clear();
+    m_levels.clear();
+
+    {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        m_data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(m_data.data(), m_data.size());
+    }
+
+    return ParseHeader(m_data.data(), m_data.size(), m_data.size());
+}
+
+bool TextureContainer::LoadHeader(const std::string& path)
+{
+    m_path = path;
+    m_data.clear();
+    m_levels.clear();
+
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    Header header{};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.mipLevels > 32)
+    {
+        return false;
+    }
+
+    std::vector<char> headerData(sizeof(Header) + header.mipLevels * sizeof(Level));
+    memcpy(headerData.data(), &header, sizeof(header));
+    if (!file.read(headerData.data() + sizeof(Header), headerData.size() - sizeof(Header)))
+    {
+        return false;
+    }
+
+    return ParseHeader(headerData.data(), headerData.size(), fileSize);
+}
+
+bool TextureContainer::ReadLevel(uint32_t mip, void* destination) const
+{
+    std::ifstream file(m_path, std::ios::binary);
+    if (!file.is_open() || mip >= m_levels.size())
+    {
+        return false;
+    }
+
+    file.seekg(static_cast<std::streamoff>(m_levels[mip].offset));
+    return static_cast<bool>(file.read(static_cast<char*>(destination), static_cast<std::streamsize>(m_levels[mip].size)));
+}
+
+bool TextureContainer::ParseHeader(const char* data, size_t size, uint64_t fileSize)
+{
+    if (size < sizeof(Header))
+    {
+        return false;
+    }
+
+    memcpy(&m_header, data, sizeof(Header));
+    if (m_header.magic != Magic || m_header.version != Version || m_header.mipLevels == 0 ||
+        size < sizeof(Header) + m_header.mipLevels * sizeof(Level))
+    {
+        return false;
+    }
+
+    m_levels.resize(m_header.mipLevels);
+    memcpy(m_levels.data(), data + sizeof(Header), m_levels.size() * sizeof(Level));
+
+    for (const Level& level : m_levels)
+    {
+        if (level.offset % DataAlignment != 0 || level.offset + level.size > fileSize)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TextureContainer::Write(const std::string& path, VkFormat format, uint32_t width, uint32_t height,
+    const std::vector<std::vector<uint8_t>>& levels)
+{
+    Header header{};
+    header.magic = Magic;
+    header.version = Version;
+    header.format = static_cast<uint32_t>(format);
+    header.width = width;
+    header.height = height;
+    header.depth = 1;
+    header.mipLevels = static_cast<uint32_t>(levels.size());
+    header.arrayLayers = 1;
+
+    std::vector<Level> table(levels.size());
+    uint64_t offset = AlignUp(sizeof(Header) + table.size() * sizeof(Level), DataAlignment);
+    for (size_t mip = 0; mip < levels.size(); ++mip)
+    {
+        table[mip].offset = offset;
+        table[mip].size = levels[mip].size();
+        table[mip].width = std::max(width >> mip, 1u);
+        table[mip].height = std::max(height >> mip, 1u);
+        offset = AlignUp(offset + levels[mip].size(), DataAlignment);
+    }
+
+    std::vector<char> contents(offset, 0);
+    memcpy(contents.data(), &header, sizeof(header));
+    memcpy(contents.data() + sizeof(header), table.data(), table.size() * sizeof(Level));
+    for (size_t mip = 0; mip < levels.size(); ++mip)
+    {
+        memcpy(contents.data() + table[mip].offset, levels[mip].data(), levels[mip].size());
+    }
+    return WriteFileAtomically(path, contents.data(), contents.size());
+}
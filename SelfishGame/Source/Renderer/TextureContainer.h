@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+/*
+ * Cooked texture (.stex) written by the TextureCooker tool.
+ *
+ * Header | one Level per mip | level data. The header fields are the ones VkImageCreateInfo needs, every level is
+ * already in the layout vkCmdCopyBufferToImage expects (tightly packed rows of texel blocks), so loading is reading
+ * the file and staging the levels as they are. Level data starts 16 byte aligned, which covers the texel block size
+ * of every format the cooker writes.
+ */
+class TextureContainer
+{
+public:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format; // VkFormat
+        uint32_t width;
+        uint32_t height;
+        uint32_t depth;
+        uint32_t mipLevels;
+        uint32_t arrayLayers;
+    };
+
+    struct Level
+    {
+        uint64_t offset; // from the start of the file
+        uint64_t size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    static constexpr uint32_t Magic = 0x58455453; // "STEX"
+    static constexpr uint32_t Version = 1;
+
+    // Reads the whole file, false if it is missing, truncated or not a container of this version
+    bool Load(const std::string& path);
+
+    // Only reads the header and the level table, the levels are read one by one with ReadLevel
+    bool LoadHeader(const std::string& path);
+    // Reads level mip from the file into destination, which has room for GetLevels()[mip].size bytes
+    bool ReadLevel(uint32_t mip, void* destination) const;
+
+    // levels[0] is the full resolution, every following one halves it
+    static bool Write(const std::string& path, VkFormat format, uint32_t width, uint32_t height,
+        const std::vector<std::vector<uint8_t>>& levels);
+
+    VkFormat GetFormat() const { return static_cast<VkFormat>(m_header.format); }
+    const Header& GetHeader() const { return m_header; }
+    const std::vector<Level>& GetLevels() const { return m_levels; }
+    // Only after Load
+    const void* GetLevelData(uint32_t mip) const { return m_data.data() + m_levels[mip].offset; }
+
+private:
+    bool ParseHeader(const char* data, size_t size, uint64_t fileSize);
+
+    std::string m_path;
+    Header m_header{};
+    std::vector<Level> m_levels;
+    std::vector<char> m_data;
+};
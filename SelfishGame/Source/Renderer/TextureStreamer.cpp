@@ -0,0 +1,427 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <filesystem>
+#include <imgui.h>
+#include <iostream>
+#include <Profiler/Profiler.h>
+#include <Renderer.h>
+#include <Utilities.h>
+
+void TextureStreamer::Init(Renderer& renderer, VkSampler sampler, const Settings& settings)
+{
+    m_renderer = &renderer;
+    m_sampler = sampler;
+    m_settings = settings;
+}
+
+void TextureStreamer::Release()
+{
+    for (Texture& texture : m_textures)
+    {
+        if (texture.streamed)
+        {
+            texture.image.Release(*m_renderer);
+            if (texture.HasPending())
+            {
+                texture.pendingImage.Release(*m_renderer);
+            }
+        }
+    }
+    m_textures.clear();
+
+    for (TextureBatch& batch : m_fallbackBatches)
+    {
+        batch.Release(*m_renderer);
+    }
+    m_fallbackBatches.clear();
+
+    m_stats = {};
+}
+
+std::vector<StreamedTextureHandle> TextureStreamer::Register(const std::vector<std::string>& texturePaths)
+{
+    Renderer& renderer = *m_renderer;
+
+    std::vector<StreamedTextureHandle> handles;
+    std::vector<std::string> fallbackPaths;
+    std::vector<StreamedTextureHandle> fallbackHandles;
+    std::vector<Upload> uploads;
+
+    for (const std::string& path : texturePaths)
+    {
+        const StreamedTextureHandle handle = static_cast<StreamedTextureHandle>(m_textures.size());
+        handles.push_back(handle);
+        m_textures.emplace_back();
+
+        Texture& texture = m_textures.back();
+        texture.path = path;
+
+        // Streaming needs the mips, without them (TextureSettings::mipmaps off) everything is loaded the usual way
+        const std::string cookedPath = std::filesystem::path(path).replace_extension(".stex").string();
+        if (renderer.m_textureSettings.mipmaps && texture.source.LoadHeader(cookedPath))
+        {
+            VkFormatProperties formatProperties;
+            vkGetPhysicalDeviceFormatProperties(renderer.m_physicalDevice, texture.source.GetFormat(), &formatProperties);
+            texture.streamed = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+        }
+
+        if (!texture.streamed)
+        {
+            fallbackPaths.push_back(path);
+            fallbackHandles.push_back(handle);
+            continue;
+        }
+
+        const std::vector<TextureContainer::Level>& levels = texture.source.GetLevels();
+        texture.tailMip = static_cast<uint32_t>(levels.size()) - 1;
+        while (texture.tailMip > 0 && std::max(levels[texture.tailMip - 1].width, levels[texture.tailMip - 1].height) <= TailSize)
+        {
+            --texture.tailMip;
+        }
+
+        ScheduleUpload(handle, texture.tailMip, uploads);
+    }
+
+    // The tails go out right away and are used without waiting, frames are submitted to the graphics queue after them
+    SubmitUploads(uploads);
+    for (const Upload& upload : uploads)
+    {
+        if (upload.readFailed)
+        {
+            // Not even the tail could be read and SubmitUploads stopped streaming it, load it whole instead
+            fallbackPaths.push_back(m_textures[upload.texture].path);
+            fallbackHandles.push_back(upload.texture);
+            continue;
+        }
+
+        Texture& texture = m_textures[upload.texture];
+        texture.image = texture.pendingImage;
+        texture.residentMip = texture.pendingMip;
+        texture.pendingImage = {};
+        texture.pendingTicket = 0;
+
+        texture.slot = renderer.m_textureTable.Add(texture.image.m_view, m_sampler);
+        assert(texture.slot != BindlessTextureTable::InvalidSlot);
+    }
+
+    if (!fallbackPaths.empty())
+    {
+        m_fallbackBatches.push_back(GpuImage::LoadBatch(renderer, fallbackPaths));
+        const TextureBatch& batch = m_fallbackBatches.back();
+        for (uint32_t i = 0; i < batch.GetCount(); ++i)
+        {
+            m_textures[fallbackHandles[i]].slot = renderer.m_textureTable.Add(batch.Get(i).m_view, m_sampler);
+            assert(m_textures[fallbackHandles[i]].slot != BindlessTextureTable::InvalidSlot);
+        }
+        m_stats.fallbackBytes += batch.GetMemorySize();
+    }
+
+    return handles;
+}
+
+void TextureStreamer::RequestScreenSize(StreamedTextureHandle handle, float screenPixels)
+{
+    const Texture& texture = m_textures[handle];
+    if (!texture.streamed)
+    {
+        return;
+    }
+
+    // One texel per pixel: every halving of the on screen size is one mip further down
+    const float texels = static_cast<float>(texture.source.GetHeader().width);
+    const float mip = std::floor(std::log2(texels / std::max(screenPixels, 1.0f)));
+    RequestMip(handle, static_cast<uint32_t>(std::max(mip, 0.0f)));
+}
+
+void TextureStreamer::RequestMip(StreamedTextureHandle handle, uint32_t mip)
+{
+    Texture& texture = m_textures[handle];
+    texture.requestedMip = std::min(texture.requestedMip, mip);
+    texture.lastRequestFrame = m_frame;
+}
+
+void TextureStreamer::Update()
+{
+    PROFILE_ZONE("TextureStreamer::Update");
+
+    UploadManager& uploadManager = m_renderer->m_uploadManager;
+    m_stats.uploadedBytes = 0;
+
+    // Finished uploads replace what was resident
+    for (Texture& texture : m_textures)
+    {
+        if (texture.HasPending() && uploadManager.IsComplete(texture.pendingTicket))
+        {
+            SwitchToPending(texture);
+        }
+    }
+
+    // The textures furthest from the mip they need go first, the most recently requested of those
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < m_textures.size(); ++i)
+    {
+        const Texture& texture = m_textures[i];
+        if (texture.streamed && !texture.HasPending() && texture.requestedMip < texture.residentMip)
+        {
+            candidates.push_back(i);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+        {
+            const Texture& textureA = m_textures[a];
+            const Texture& textureB = m_textures[b];
+            const uint32_t gapA = textureA.residentMip - textureA.requestedMip;
+            const uint32_t gapB = textureB.residentMip - textureB.requestedMip;
+            return gapA != gapB ? gapA > gapB : textureA.lastRequestFrame > textureB.lastRequestFrame;
+        });
+
+    std::vector<Upload> uploads;
+    for (uint32_t index : candidates)
+    {
+        const Texture& texture = m_textures[index];
+
+        // One level at a time, so every texture improves a little before any gets everything
+        const uint32_t mip = texture.residentMip - 1;
+        const VkDeviceSize uploadSize = GetResidentSize(texture, mip);
+        if (m_stats.uploadedBytes > 0 && m_stats.uploadedBytes + uploadSize > m_settings.uploadBudget)
+        {
+            break;
+        }
+
+        bool fits = true;
+        while (m_stats.residentBytes + uploadSize > m_settings.memoryBudget)
+        {
+            if (!EvictOne(texture.lastRequestFrame, uploads))
+            {
+                fits = false;
+                break;
+            }
+        }
+        if (!fits)
+        {
+            break;
+        }
+
+        ScheduleUpload(index, mip, uploads);
+    }
+
+    if (!uploads.empty())
+    {
+        const UploadManager::Ticket ticket = SubmitUploads(uploads);
+        for (const Upload& upload : uploads)
+        {
+            if (!upload.readFailed)
+            {
+                m_textures[upload.texture].pendingTicket = ticket;
+            }
+        }
+    }
+
+    m_stats.pendingCount = 0;
+    for (Texture& texture : m_textures)
+    {
+        m_stats.pendingCount += texture.HasPending() ? 1 : 0;
+        texture.requestedMip = NoRequest;
+    }
+
+    ++m_frame;
+}
+
+VkDeviceSize TextureStreamer::GetResidentSize(const Texture& texture, uint32_t mip) const
+{
+    VkDeviceSize size = 0;
+    const std::vector<TextureContainer::Level>& levels = texture.source.GetLevels();
+    for (uint32_t level = mip; level < levels.size(); ++level)
+    {
+        size += levels[level].size;
+    }
+    return size;
+}
+
+void TextureStreamer::ScheduleUpload(uint32_t textureIndex, uint32_t mip, std::vector<Upload>& uploads)
+{
+    Texture& texture = m_textures[textureIndex];
+    const std::vector<TextureContainer::Level>& levels = texture.source.GetLevels();
+    const uint32_t mipLevels = static_cast<uint32_t>(levels.size()) - mip;
+
+    texture.pendingImage.Create(*m_renderer, texture.source.GetFormat(), levels[mip].width, levels[mip].height, mipLevels);
+    texture.pendingMip = mip;
+
+    Upload upload;
+    upload.texture = textureIndex;
+
+    VkDeviceSize stagingSize = 0;
+    for (uint32_t level = mip; level < levels.size(); ++level)
+    {
+        stagingSize = AlignUp(stagingSize, StagingAlignment);
+        upload.levels.push_back({ stagingSize, levels[level].width, levels[level].height });
+        stagingSize += levels[level].size;
+    }
+
+    upload.staging = m_renderer->m_uploadManager.AllocateStaging(stagingSize);
+    for (UploadManager::StagedImageLevel& level : upload.levels)
+    {
+        level.offset += upload.staging.offset;
+    }
+
+    // Counted as replaced right away, for a few frames both images exist
+    m_stats.residentBytes = m_stats.residentBytes - texture.image.m_allocation.size + texture.pendingImage.m_allocation.size;
+    m_stats.uploadedBytes += stagingSize;
+    uploads.push_back(std::move(upload));
+}
+
+UploadManager::Ticket TextureStreamer::SubmitUploads(std::vector<Upload>& uploads)
+{
+    if (uploads.empty())
+    {
+        return 0;
+    }
+
+    // Disk reads go straight into the staging memory, on the workers
+    m_renderer->m_workerPool.ParallelFor(static_cast<uint32_t>(uploads.size()), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                Upload& upload = uploads[i];
+                const Texture& texture = m_textures[upload.texture];
+                for (uint32_t level = 0; level < upload.levels.size() && !upload.readFailed; ++level)
+                {
+                    char* destination = static_cast<char*>(upload.staging.data) + (upload.levels[level].offset - upload.staging.offset);
+                    upload.readFailed = !texture.source.ReadLevel(texture.pendingMip + level, destination);
+                }
+            }
+        });
+
+    for (const Upload& upload : uploads)
+    {
+        Texture& texture = m_textures[upload.texture];
+        if (upload.readFailed)
+        {
+            // Keep what is resident and stop streaming it, reading the file again every frame would fail the same way
+            std::cout << "Texture streaming: failed to read mip " << texture.pendingMip << " of " << texture.path;
+            if (texture.image.m_image != VK_NULL_HANDLE)
+            {
+                std::cout << ", keeping mip " << texture.residentMip << std::endl;
+            }
+            else
+            {
+                std::cout << ", loading it without streaming" << std::endl;
+            }
+            m_stats.residentBytes = m_stats.residentBytes - texture.pendingImage.m_allocation.size + texture.image.m_allocation.size;
+            texture.pendingImage.Release(*m_renderer);
+            texture.pendingImage = {};
+            texture.streamed = false;
+            continue;
+        }
+
+        const uint32_t levelCount = static_cast<uint32_t>(upload.levels.size());
+        m_renderer->m_uploadManager.UploadStagedImage(texture.pendingImage.m_image, upload.staging.buffer,
+            upload.levels.data(), levelCount, levelCount);
+    }
+
+    return m_renderer->m_uploadManager.Flush();
+}
+
+void TextureStreamer::SwitchToPending(Texture& texture)
+{
+    Renderer& renderer = *m_renderer;
+
+    const uint32_t slot = renderer.m_textureTable.Add(texture.pendingImage.m_view, m_sampler);
+    GpuImage retired = texture.image;
+    if (slot == BindlessTextureTable::InvalidSlot)
+    {
+        // Table full, keep what is resident
+        retired = texture.pendingImage;
+        m_stats.residentBytes = m_stats.residentBytes - texture.pendingImage.m_allocation.size + texture.image.m_allocation.size;
+    }
+    else
+    {
+        renderer.m_textureTable.Remove(texture.slot);
+        texture.slot = slot;
+        texture.image = texture.pendingImage;
+        texture.residentMip = texture.pendingMip;
+    }
+
+    // Frames in flight may still sample the old image
+    renderer.m_deletionQueue.Push([&renderer, retired]() mutable
+        {
+            retired.Release(renderer);
+        });
+
+    texture.pendingImage = {};
+    texture.pendingTicket = 0;
+}
+
+bool TextureStreamer::EvictOne(uint64_t requestedBefore, std::vector<Upload>& uploads)
+{
+    uint32_t victim = NoRequest;
+    for (uint32_t i = 0; i < m_textures.size(); ++i)
+    {
+        const Texture& texture = m_textures[i];
+        if (!texture.streamed || texture.HasPending() || texture.residentMip >= texture.tailMip ||
+            texture.lastRequestFrame >= requestedBefore)
+        {
+            continue;
+        }
+
+        if (victim == NoRequest || texture.lastRequestFrame < m_textures[victim].lastRequestFrame)
+        {
+            victim = i;
+        }
+    }
+
+    if (victim == NoRequest)
+    {
+        return false;
+    }
+
+    ScheduleUpload(victim, m_textures[victim].residentMip + 1, uploads);
+    ++m_stats.evictionCount;
+    return true;
+}
+
+void TextureStreamer::DrawImGui()
+{
+    ImGui::Begin("Texture Streaming");
+
+    ImGui::Text("Resident %.1f of %.1f MB, %.1f MB not streamed", m_stats.residentBytes / (1024.0 * 1024.0),
+        m_settings.memoryBudget / (1024.0 * 1024.0), m_stats.fallbackBytes / (1024.0 * 1024.0));
+    ImGui::Text("Uploaded %.1f KB last frame, %u uploads pending, %llu evictions", m_stats.uploadedBytes / 1024.0,
+        m_stats.pendingCount, static_cast<unsigned long long>(m_stats.evictionCount));
+
+    if (ImGui::BeginTable("textures", 3))
+    {
+        ImGui::TableSetupColumn("texture");
+        ImGui::TableSetupColumn("resident");
+        ImGui::TableSetupColumn("last request");
+        ImGui::TableHeadersRow();
+
+        for (const Texture& texture : m_textures)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(std::filesystem::path(texture.path).filename().string().c_str());
+            ImGui::TableNextColumn();
+            if (texture.streamed)
+            {
+                const TextureContainer::Level& level = texture.source.GetLevels()[texture.residentMip];
+                ImGui::Text("%ux%u%s", level.width, level.height, texture.HasPending() ? " (loading)" : "");
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu frames ago", static_cast<unsigned long long>(m_frame - texture.lastRequestFrame));
+            }
+            else
+            {
+                ImGui::TextUnformatted("all, not streamed");
+                ImGui::TableNextColumn();
+            }
+        }
+
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <GpuImage.h>
+#include <TextureContainer.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class Renderer;
+
+using StreamedTextureHandle = uint32_t;
+
+/*
+ * Keeps textures usable from the first frame and their device memory within a budget.
+ *
+ * Registering a cooked texture only reads its header and uploads the mip tail (the levels of TailSize and smaller),
+ * which is never evicted. Every frame the renderer reports how large each texture appears on screen, and Update
+ * streams in finer mips one level at a time, the textures furthest from what they need first, reading no more
+ * than the upload budget from disk per frame. If the next level doesn't fit into the memory budget, the textures
+ * that were requested the longest time ago give up their finest level.
+ *
+ * Without sparse residency a different set of resident mips is a different image: it is created with the new level
+ * count, all its levels are staged from the container and once the upload's fence signaled the texture table slot
+ * is switched over and the old image goes to the deferred deletion queue. Re-staging the coarser levels costs a
+ * third on top of the new level, copying them on the GPU would avoid that.
+ *
+ * Textures without a usable .stex (not cooked, or a block compressed format the device can't sample) are loaded
+ * completely with GpuImage::LoadBatch and never streamed.
+ */
+class TextureStreamer
+{
+public:
+    struct Settings
+    {
+        VkDeviceSize memoryBudget = 256ull * 1024 * 1024; // device memory of the streamed textures
+        VkDeviceSize uploadBudget = 4ull * 1024 * 1024;   // bytes staged per frame, at least one level is always allowed
+    };
+
+    struct Stats
+    {
+        VkDeviceSize residentBytes = 0; // streamed textures, as if the pending uploads were done
+        VkDeviceSize fallbackBytes = 0; // textures that are not streamed
+        VkDeviceSize uploadedBytes = 0; // last Update
+        uint32_t pendingCount = 0;      // uploads waiting for their fence
+        uint64_t evictionCount = 0;
+    };
+
+    static constexpr uint32_t TailSize = 64;
+    static constexpr uint32_t NoRequest = ~0u;
+
+    void Init(Renderer& renderer, VkSampler sampler, const Settings& settings);
+    // The device has to be idle
+    void Release();
+
+    // Handles are returned in the order of the paths, their slots are valid right away
+    std::vector<StreamedTextureHandle> Register(const std::vector<std::string>& texturePaths);
+
+    // Texture table slot to sample with this frame, changes whenever different mips become resident
+    uint32_t GetSlot(StreamedTextureHandle handle) const { return m_textures[handle].slot; }
+
+    // The texture is stretched across about screenPixels pixels, e.g. the projected size of the object it is on
+    void RequestScreenSize(StreamedTextureHandle handle, float screenPixels);
+    // For estimates that already know the finest mip sampled, e.g. from sampler feedback
+    void RequestMip(StreamedTextureHandle handle, uint32_t mip);
+
+    // Once per frame, before the slots are read: switches finished uploads over, evicts and schedules new uploads
+    void Update();
+
+    const Stats& GetStats() const { return m_stats; }
+    void DrawImGui();
+
+private:
+    struct Texture
+    {
+        std::string path;
+        TextureContainer source; // header and level table only, the levels are read on demand
+
+        bool streamed = false;
+        uint32_t tailMip = 0;    // first level that is always resident
+        uint32_t slot = 0;
+
+        GpuImage image;          // levels residentMip.. of the source
+        uint32_t residentMip = 0;
+
+        GpuImage pendingImage;   // replaces image once its upload is complete
+        uint32_t pendingMip = 0;
+        UploadManager::Ticket pendingTicket = 0;
+
+        uint32_t requestedMip = NoRequest; // finest mip requested since the last Update
+        uint64_t lastRequestFrame = 0;
+
+        bool HasPending() const { return pendingImage.m_image != VK_NULL_HANDLE; }
+    };
+
+    struct Upload
+    {
+        uint32_t texture;
+        UploadManager::StagingRegion staging;
+        std::vector<UploadManager::StagedImageLevel> levels;
+        bool readFailed = false; // the staging memory holds garbage, nothing is uploaded
+    };
+
+    // Device memory of the levels from mip on
+    VkDeviceSize GetResidentSize(const Texture& texture, uint32_t mip) const;
+
+    // Creates the pending image and reserves its staging memory, the levels are read by SubmitUploads
+    void ScheduleUpload(uint32_t textureIndex, uint32_t mip, std::vector<Upload>& uploads);
+    UploadManager::Ticket SubmitUploads(std::vector<Upload>& uploads);
+    void SwitchToPending(Texture& texture);
+    // Drops the finest resident level of the least recently requested texture, false if nothing can go
+    bool EvictOne(uint64_t requestedBefore, std::vector<Upload>& uploads);
+
+    Renderer* m_renderer = nullptr;
+    VkSampler m_sampler = VK_NULL_HANDLE;
+    Settings m_settings;
+
+    std::vector<Texture> m_textures;
+    std::vector<TextureBatch> m_fallbackBatches;
+
+    uint64_t m_frame = 0;
+    Stats m_stats;
+};
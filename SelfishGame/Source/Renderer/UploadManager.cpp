@@ -0,0 +1,583 @@
+#include "UploadManager.h"
+
+#include <Utilities.h>
+#include <VulkanCheck.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+void UploadManager::Init(VkDevice device, GpuMemoryAllocator& allocator, uint32_t graphicsFamily, VkQueue graphicsQueue,
+    uint32_t transferFamily, VkQueue transferQueue)
+{
+    m_device = device;
+    m_allocator = &allocator;
+    m_graphicsFamily = graphicsFamily;
+    m_graphicsQueue = graphicsQueue;
+    m_transferFamily = transferFamily;
+    m_transferQueue = transferQueue;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // short-lived buffers, freed once the batch is done
+    poolInfo.queueFamilyIndex = m_graphicsFamily;
+    VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_graphicsPool));
+
+    if (HasDedicatedTransferQueue())
+    {
+        poolInfo.queueFamilyIndex = m_transferFamily;
+        VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_transferPool));
+    }
+}
+
+void UploadManager::Release()
+{
+    for (Batch& batch : m_inFlight)
+    {
+        vkWaitForFences(m_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        ReleaseBatch(batch);
+    }
+    m_inFlight.clear();
+
+    // Never flushed, nothing was submitted
+    ReleaseBatch(m_current);
+    m_current = {};
+    m_bufferCopies.clear();
+    m_imageCopies.clear();
+    m_images.clear();
+
+    vkDestroyCommandPool(m_device, m_graphicsPool, nullptr);
+    vkDestroyCommandPool(m_device, m_transferPool, nullptr);
+}
+
+void UploadManager::UploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset,
+    VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+    PendingBufferCopy copy{};
+    copy.buffer = buffer;
+    copy.region.srcOffset = Stage(data, size, copy.stagingBuffer);
+    copy.region.dstOffset = dstOffset;
+    copy.region.size = size;
+    copy.dstAccess = dstAccess;
+    copy.dstStage = dstStage;
+
+    m_bufferCopies.push_back(copy);
+}
+
+void UploadManager::UploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height)
+{
+    const ImageLevel level{ data, size, width, height };
+    UploadImage(image, &level, 1, 1);
+}
+
+void UploadManager::UploadImage(VkImage image, const ImageLevel* levels, uint32_t levelCount, uint32_t mipLevels)
+{
+    assert(levelCount > 0 && levelCount <= mipLevels);
+
+    // Levels may end up in different staging chunks, one copy per level either way
+    for (uint32_t mip = 0; mip < levelCount; ++mip)
+    {
+        StagedImageLevel staged{};
+        VkBuffer stagingBuffer;
+        staged.offset = Stage(levels[mip].data, levels[mip].size, stagingBuffer);
+        staged.width = levels[mip].width;
+        staged.height = levels[mip].height;
+
+        AddImageCopy(image, stagingBuffer, staged, mip);
+    }
+
+    m_images.push_back({ image, levels[0].width, levels[0].height, levelCount, mipLevels });
+}
+
+UploadManager::StagingRegion UploadManager::AllocateStaging(VkDeviceSize size)
+{
+    // Copy offsets into images have to be a multiple of the texel size and of 4, StagingAlignment covers all our formats
+    StagingChunk* chunk = m_current.staging.empty() ? nullptr : &m_current.staging.back();
+    VkDeviceSize offset = chunk ? AlignUp(chunk->used, StagingAlignment) : 0;
+
+    if (!chunk || offset + size > chunk->allocation.size)
+    {
+        StagingChunk newChunk;
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = std::max(StagingChunkSize, size);
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &newChunk.buffer));
+
+        VK_CHECK(m_allocator->AllocateForBuffer(newChunk.buffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, newChunk.allocation));
+
+        m_current.staging.push_back(newChunk);
+        chunk = &m_current.staging.back();
+        offset = 0;
+    }
+
+    chunk->used = offset + size;
+
+    return { chunk->buffer, offset, static_cast<char*>(chunk->allocation.mapped) + offset };
+}
+
+void UploadManager::UploadStagedImage(VkImage image, VkBuffer stagingBuffer, const StagedImageLevel* levels, uint32_t levelCount,
+    uint32_t mipLevels)
+{
+    assert(levelCount > 0 && levelCount <= mipLevels);
+
+    for (uint32_t mip = 0; mip < levelCount; ++mip)
+    {
+        AddImageCopy(image, stagingBuffer, levels[mip], mip);
+    }
+
+    m_images.push_back({ image, levels[0].width, levels[0].height, levelCount, mipLevels });
+}
+
+void UploadManager::AddImageCopy(VkImage image, VkBuffer stagingBuffer, const StagedImageLevel& level, uint32_t mip)
+{
+    PendingImageCopy copy{};
+    copy.image = image;
+    copy.stagingBuffer = stagingBuffer;
+
+    copy.region.bufferOffset = level.offset;
+    copy.region.bufferRowLength = 0; // tightly packed
+    copy.region.bufferImageHeight = 0;
+
+    copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.region.imageSubresource.mipLevel = mip;
+    copy.region.imageSubresource.baseArrayLayer = 0;
+    copy.region.imageSubresource.layerCount = 1;
+
+    copy.region.imageOffset = { 0, 0, 0 };
+    copy.region.imageExtent = { level.width, level.height, 1 };
+
+    m_imageCopies.push_back(copy);
+}
+
+VkCommandBuffer UploadManager::GetGraphicsCommandBuffer()
+{
+    if (m_current.graphicsCommandBuffer == VK_NULL_HANDLE)
+    {
+        m_current.graphicsCommandBuffer = AllocateCommandBuffer(m_graphicsPool);
+    }
+
+    return m_current.graphicsCommandBuffer;
+}
+
+UploadManager::Ticket UploadManager::Flush()
+{
+    const bool hasCopies = !m_bufferCopies.empty() || !m_images.empty();
+    if (!hasCopies && m_current.graphicsCommandBuffer == VK_NULL_HANDLE)
+    {
+        return 0;
+    }
+
+    Batch batch = std::move(m_current);
+    m_current = {};
+    batch.ticket = m_nextTicket++;
+
+    if (hasCopies)
+    {
+        batch.transferCommandBuffer = AllocateCommandBuffer(HasDedicatedTransferQueue() ? m_transferPool : m_graphicsPool);
+        if (HasDedicatedTransferQueue() && batch.graphicsCommandBuffer == VK_NULL_HANDLE)
+        {
+            // The ownership of the uploaded resources has to be acquired on the graphics queue
+            batch.graphicsCommandBuffer = AllocateCommandBuffer(m_graphicsPool);
+        }
+
+        RecordCopies(batch);
+        VK_CHECK(vkEndCommandBuffer(batch.transferCommandBuffer));
+    }
+
+    if (batch.graphicsCommandBuffer != VK_NULL_HANDLE)
+    {
+        VK_CHECK(vkEndCommandBuffer(batch.graphicsCommandBuffer));
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &batch.fence));
+
+    if (HasDedicatedTransferQueue() && hasCopies)
+    {
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &batch.transferDone));
+
+        VkSubmitInfo transferSubmit{};
+        transferSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        transferSubmit.commandBufferCount = 1;
+        transferSubmit.pCommandBuffers = &batch.transferCommandBuffer;
+        transferSubmit.signalSemaphoreCount = 1;
+        transferSubmit.pSignalSemaphores = &batch.transferDone;
+        VK_CHECK(vkQueueSubmit(m_transferQueue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        VkSubmitInfo graphicsSubmit{};
+        graphicsSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        graphicsSubmit.waitSemaphoreCount = 1;
+        graphicsSubmit.pWaitSemaphores = &batch.transferDone;
+        graphicsSubmit.pWaitDstStageMask = &waitStage;
+        graphicsSubmit.commandBufferCount = 1;
+        graphicsSubmit.pCommandBuffers = &batch.graphicsCommandBuffer;
+        VK_CHECK(vkQueueSubmit(m_graphicsQueue, 1, &graphicsSubmit, batch.fence));
+    }
+    else
+    {
+        // Same queue: copies first, then whatever was recorded into the graphics command buffer
+        std::vector<VkCommandBuffer> commandBuffers;
+        if (batch.transferCommandBuffer != VK_NULL_HANDLE)
+        {
+            commandBuffers.push_back(batch.transferCommandBuffer);
+        }
+        if (batch.graphicsCommandBuffer != VK_NULL_HANDLE)
+        {
+            commandBuffers.push_back(batch.graphicsCommandBuffer);
+        }
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+        submitInfo.pCommandBuffers = commandBuffers.data();
+        VK_CHECK(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, batch.fence));
+    }
+
+    const Ticket ticket = batch.ticket;
+    m_inFlight.push_back(std::move(batch));
+
+    return ticket;
+}
+
+bool UploadManager::IsComplete(Ticket ticket) const
+{
+    if (ticket == 0)
+    {
+        return true;
+    }
+
+    for (const Batch& batch : m_inFlight)
+    {
+        if (batch.ticket == ticket)
+        {
+            return vkGetFenceStatus(m_device, batch.fence) == VK_SUCCESS;
+        }
+    }
+
+    // Either already collected or not flushed yet
+    return ticket < m_nextTicket;
+}
+
+void UploadManager::Wait(Ticket ticket)
+{
+    for (const Batch& batch : m_inFlight)
+    {
+        if (batch.ticket == ticket)
+        {
+            vkWaitForFences(m_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+            return;
+        }
+    }
+}
+
+void UploadManager::CollectCompleted()
+{
+    auto firstDone = std::stable_partition(m_inFlight.begin(), m_inFlight.end(), [this](const Batch& batch)
+        {
+            return vkGetFenceStatus(m_device, batch.fence) != VK_SUCCESS;
+        });
+
+    for (auto it = firstDone; it != m_inFlight.end(); ++it)
+    {
+        ReleaseBatch(*it);
+    }
+
+    m_inFlight.erase(firstDone, m_inFlight.end());
+}
+
+VkDeviceSize UploadManager::Stage(const void* data, VkDeviceSize size, VkBuffer& stagingBuffer)
+{
+    const StagingRegion region = AllocateStaging(size);
+    memcpy(region.data, data, size);
+
+    stagingBuffer = region.buffer;
+    return region.offset;
+}
+
+VkCommandBuffer UploadManager::AllocateCommandBuffer(VkCommandPool pool)
+{
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = pool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer));
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+    return commandBuffer;
+}
+
+void UploadManager::RecordCopies(Batch& batch)
+{
+    const bool dedicated = HasDedicatedTransferQueue();
+    const VkCommandBuffer commandBuffer = batch.transferCommandBuffer;
+
+    VkImageSubresourceRange colorRange{};
+    colorRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    colorRange.baseMipLevel = 0;
+    colorRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    colorRange.baseArrayLayer = 0;
+    colorRange.layerCount = 1;
+
+    // All mips of all images go to TRANSFER_DST in one barrier, the blitted ones are written later
+    if (!m_images.empty())
+    {
+        std::vector<VkImageMemoryBarrier> toTransfer;
+        toTransfer.reserve(m_images.size());
+
+        for (const PendingImage& image : m_images)
+        {
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image.image;
+            barrier.subresourceRange = colorRange;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toTransfer.push_back(barrier);
+        }
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+    }
+
+    for (const PendingBufferCopy& copy : m_bufferCopies)
+    {
+        vkCmdCopyBuffer(commandBuffer, copy.stagingBuffer, copy.buffer, 1, &copy.region);
+    }
+
+    for (const PendingImageCopy& copy : m_imageCopies)
+    {
+        vkCmdCopyBufferToImage(commandBuffer, copy.stagingBuffer, copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy.region);
+    }
+
+    // Make the writes visible to the consumers, or hand the resources over to the graphics queue
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    VkPipelineStageFlags dstStages = 0;
+
+    for (const PendingBufferCopy& copy : m_bufferCopies)
+    {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = copy.dstAccess;
+        barrier.srcQueueFamilyIndex = dedicated ? m_transferFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = dedicated ? m_graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = copy.buffer;
+        barrier.offset = copy.region.dstOffset;
+        barrier.size = copy.region.size;
+        bufferBarriers.push_back(barrier);
+
+        dstStages |= copy.dstStage;
+    }
+
+    for (const PendingImage& image : m_images)
+    {
+        // Images with mips left to blit stay in TRANSFER_DST, RecordMipBlits takes them from there
+        if (image.NeedsBlits() && !dedicated)
+        {
+            continue;
+        }
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = image.NeedsBlits() ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = dedicated ? m_transferFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = dedicated ? m_graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image.image;
+        barrier.subresourceRange = colorRange;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = image.NeedsBlits() ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+        imageBarriers.push_back(barrier);
+
+        dstStages |= image.NeedsBlits() ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+
+    if (!dedicated)
+    {
+        if (!bufferBarriers.empty() || !imageBarriers.empty())
+        {
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0, 0, nullptr,
+                static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        }
+
+        // The copies were recorded on the graphics queue already
+        for (const PendingImage& image : m_images)
+        {
+            if (image.NeedsBlits())
+            {
+                RecordMipBlits(commandBuffer, image);
+            }
+        }
+    }
+    else
+    {
+        // Release on the transfer queue: the destination access is ignored here
+        for (auto& barrier : bufferBarriers) { barrier.dstAccessMask = 0; }
+        for (auto& barrier : imageBarriers) { barrier.dstAccessMask = 0; }
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+            static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+            static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+        // Acquire on the graphics queue: the source access is ignored here
+        for (size_t i = 0; i < bufferBarriers.size(); ++i)
+        {
+            bufferBarriers[i].srcAccessMask = 0;
+            bufferBarriers[i].dstAccessMask = m_bufferCopies[i].dstAccess;
+        }
+        for (size_t i = 0; i < imageBarriers.size(); ++i)
+        {
+            imageBarriers[i].srcAccessMask = 0;
+            imageBarriers[i].dstAccessMask = m_images[i].NeedsBlits() ?
+                VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+        }
+
+        vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages, 0, 0, nullptr,
+            static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+            static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+        // Blits need a graphics queue, the transfer queue only did the copies
+        for (const PendingImage& image : m_images)
+        {
+            if (image.NeedsBlits())
+            {
+                RecordMipBlits(batch.graphicsCommandBuffer, image);
+            }
+        }
+    }
+
+    m_bufferCopies.clear();
+    m_imageCopies.clear();
+    m_images.clear();
+}
+
+void UploadManager::RecordMipBlits(VkCommandBuffer commandBuffer, const PendingImage& image)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.levelCount = 1;
+
+    // Uploaded mips that aren't a blit source are done already
+    if (image.uploadedLevels > 1)
+    {
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = image.uploadedLevels - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        barrier.subresourceRange.levelCount = 1;
+    }
+
+    int32_t mipWidth = static_cast<int32_t>(std::max(image.width >> (image.uploadedLevels - 1), 1u));
+    int32_t mipHeight = static_cast<int32_t>(std::max(image.height >> (image.uploadedLevels - 1), 1u));
+
+    for (uint32_t mip = image.uploadedLevels; mip < image.mipLevels; ++mip)
+    {
+        // The previous mip was just written, by a copy or by the last blit: it becomes the source of this one
+        barrier.subresourceRange.baseMipLevel = mip - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        const int32_t nextWidth = std::max(mipWidth / 2, 1);
+        const int32_t nextHeight = std::max(mipHeight / 2, 1);
+
+        VkImageBlit blit{};
+        blit.srcOffsets[0] = { 0, 0, 0 };
+        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = mip - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[0] = { 0, 0, 0 };
+        blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = mip;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+
+        vkCmdBlitImage(commandBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        // The source mip is final now
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        mipWidth = nextWidth;
+        mipHeight = nextHeight;
+    }
+
+    // The last mip was never a blit source
+    barrier.subresourceRange.baseMipLevel = image.mipLevels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadManager::ReleaseBatch(Batch& batch)
+{
+    for (StagingChunk& chunk : batch.staging)
+    {
+        vkDestroyBuffer(m_device, chunk.buffer, nullptr);
+        m_allocator->Free(chunk.allocation);
+    }
+    batch.staging.clear();
+
+    if (batch.transferCommandBuffer != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(m_device, HasDedicatedTransferQueue() ? m_transferPool : m_graphicsPool, 1, &batch.transferCommandBuffer);
+    }
+    if (batch.graphicsCommandBuffer != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(m_device, m_graphicsPool, 1, &batch.graphicsCommandBuffer);
+    }
+
+    vkDestroySemaphore(m_device, batch.transferDone, nullptr);
+    vkDestroyFence(m_device, batch.fence, nullptr);
+}
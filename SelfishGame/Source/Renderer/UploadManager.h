@@ -0,0 +1,160 @@
+#pragma once
+
+#include <GpuMemoryAllocator.h>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+/*
+ * Batches buffer and image uploads into as few queue submissions as possible.
+ *
+ * Uploads are copied into a host visible staging arena right away and the copies are only recorded on Flush():
+ * one barrier for all images, all copies, one barrier for everything that was written, then the blits of the mip
+ * chains that weren't uploaded. If the device has a
+ * dedicated transfer queue family the copies run there and the resources are handed over to the graphics queue
+ * with a queue family ownership transfer, the two submissions are chained with a semaphore.
+ *
+ * Completion is tracked with one fence per batch, nothing ever waits for a queue to go idle.
+ * Staging memory of a batch is recycled in CollectCompleted() once its fence is signaled.
+ */
+class UploadManager
+{
+public:
+    using Ticket = uint64_t;
+
+    void Init(VkDevice device, GpuMemoryAllocator& allocator, uint32_t graphicsFamily, VkQueue graphicsQueue,
+        uint32_t transferFamily, VkQueue transferQueue);
+    void Release();
+
+    // dstAccess/dstStage describe how the buffer is going to be consumed after the upload
+    void UploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset,
+        VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+
+    struct ImageLevel
+    {
+        const void* data;
+        VkDeviceSize size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Uploads the first mip of a 2D color image and leaves it in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    void UploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height);
+
+    /*
+     * Uploads levels[0..levelCount) of a 2D color image with mipLevels mips and leaves all of them in
+     * VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Mips past the uploaded ones are blitted on the graphics queue, each from
+     * the one above it, so the image needs VK_IMAGE_USAGE_TRANSFER_SRC_BIT and its format has to support linear
+     * filtering (VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) in optimal tiling.
+     */
+    void UploadImage(VkImage image, const ImageLevel* levels, uint32_t levelCount, uint32_t mipLevels);
+
+    struct StagingRegion
+    {
+        VkBuffer buffer;
+        VkDeviceSize offset; // 16 byte aligned
+        void* data;
+    };
+
+    // Reserves size bytes of the current batch's staging arena. The caller fills them, from any thread, before Flush().
+    StagingRegion AllocateStaging(VkDeviceSize size);
+
+    struct StagedImageLevel
+    {
+        VkDeviceSize offset; // in the staging buffer
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // UploadImage for level data that was already written to a region from AllocateStaging
+    void UploadStagedImage(VkImage image, VkBuffer stagingBuffer, const StagedImageLevel* levels, uint32_t levelCount, uint32_t mipLevels);
+
+    // Command buffer on the graphics queue that is submitted with the current batch, after all the copies
+    VkCommandBuffer GetGraphicsCommandBuffer();
+
+    // Submits everything recorded so far, returns 0 if there was nothing to submit
+    Ticket Flush();
+
+    bool IsComplete(Ticket ticket) const;
+    void Wait(Ticket ticket);
+
+    // Recycles staging memory and command buffers of finished batches, call once per frame
+    void CollectCompleted();
+
+    bool HasDedicatedTransferQueue() const { return m_graphicsFamily != m_transferFamily; }
+
+private:
+    struct StagingChunk
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        GpuAllocation allocation;
+        VkDeviceSize used = 0;
+    };
+
+    struct PendingBufferCopy
+    {
+        VkBuffer buffer;
+        VkBuffer stagingBuffer;
+        VkBufferCopy region;
+        VkAccessFlags dstAccess;
+        VkPipelineStageFlags dstStage;
+    };
+
+    struct PendingImageCopy
+    {
+        VkImage image;
+        VkBuffer stagingBuffer;
+        VkBufferImageCopy region;
+    };
+
+    struct PendingImage
+    {
+        VkImage image;
+        uint32_t width;
+        uint32_t height;
+        uint32_t uploadedLevels;
+        uint32_t mipLevels;
+
+        bool NeedsBlits() const { return mipLevels > uploadedLevels; }
+    };
+
+    struct Batch
+    {
+        Ticket ticket = 0;
+        VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+        VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+        VkSemaphore transferDone = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        std::vector<StagingChunk> staging;
+    };
+
+    // Returns the staging buffer and the offset inside of it where size bytes of data were copied to
+    VkDeviceSize Stage(const void* data, VkDeviceSize size, VkBuffer& stagingBuffer);
+    void AddImageCopy(VkImage image, VkBuffer stagingBuffer, const StagedImageLevel& level, uint32_t mip);
+    VkCommandBuffer AllocateCommandBuffer(VkCommandPool pool);
+    void RecordCopies(Batch& batch);
+    // Has to run on the graphics queue, all mips are expected in TRANSFER_DST and end up in SHADER_READ_ONLY
+    void RecordMipBlits(VkCommandBuffer commandBuffer, const PendingImage& image);
+    void ReleaseBatch(Batch& batch);
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* m_allocator = nullptr;
+
+    uint32_t m_graphicsFamily = 0;
+    uint32_t m_transferFamily = 0;
+    VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+    VkQueue m_transferQueue = VK_NULL_HANDLE;
+    VkCommandPool m_graphicsPool = VK_NULL_HANDLE;
+    VkCommandPool m_transferPool = VK_NULL_HANDLE;
+
+    static constexpr VkDeviceSize StagingChunkSize = 16ull * 1024 * 1024;
+
+    // Batch currently being filled
+    Batch m_current;
+    std::vector<PendingBufferCopy> m_bufferCopies;
+    std::vector<PendingImageCopy> m_imageCopies;
+    std::vector<PendingImage> m_images;
+
+    std::vector<Batch> m_inFlight;
+    Ticket m_nextTicket = 1;
+};
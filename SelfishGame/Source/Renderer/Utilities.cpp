@@ -0,0 +1,44 @@
+#include "Utilities.h"
+
+#include <filesystem>
+#include <fstream>
+
+bool WriteFileAtomically(const std::string& path, const void* data, size_t size, std::string* error)
+{
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            if (error != nullptr)
+            {
+                *error = "failed to open " + tempPath;
+            }
+            return false;
+        }
+
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        file.flush();
+        if (!file)
+        {
+            if (error != nullptr)
+            {
+                *error = "failed to write " + tempPath;
+            }
+            return false;
+        }
+    }
+
+    std::error_code renameError;
+    std::filesystem::rename(tempPath, path, renameError);
+    if (renameError)
+    {
+        if (error != nullptr)
+        {
+            *error = "failed to replace " + path + ": " + renameError.message();
+        }
+        std::filesystem::remove(tempPath, renameError);
+        return false;
+    }
+    return true;
+}
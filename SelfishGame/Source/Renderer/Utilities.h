@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// SSE2 is part of every x64 CPU, code under SELFISH_SSE2 uses it without a runtime check
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SELFISH_SSE2 1
+#else
+#define SELFISH_SSE2 0
+#endif
+
+// Rounds value up to a multiple of alignment, which doesn't have to be a power of two
+constexpr uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Offsets of the data in one staging allocation, the same alignment as UploadManager::AllocateStaging
+constexpr uint64_t StagingAlignment = 16;
+
+/*
+ * Writes the file next to path first and renames it over path only once it is complete, so a crash or a full disk
+ * never leaves a half written file behind. error, if given, says what failed.
+ */
+bool WriteFileAtomically(const std::string& path, const void* data, size_t size, std::string* error = nullptr);
+
+inline double MillisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
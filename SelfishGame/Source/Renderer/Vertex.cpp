@@ -1,45 +1,56 @@
 
 #include "Vertex.h"
 
-VkVertexInputBindingDescription Vertex::getBindingDescription()
-{
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    return bindingDescription;
-}
+#include <algorithm>
+#include <glm/common.hpp>
 
-std::array<VkVertexInputAttributeDescription, 2> Vertex::getAttributeDescriptions()
+VertexQuantization VertexQuantization::Compute(const Vertex* vertices, size_t count, int positionRange, int texCoordRange)
 {
-    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
-
-    /*
-        float: VK_FORMAT_R32_SFLOAT
-        vec2: VK_FORMAT_R32G32_SFLOAT
-        vec3: VK_FORMAT_R32G32B32_SFLOAT
-        vec4: VK_FORMAT_R32G32B32A32_SFLOAT
-
-        ivec2: VK_FORMAT_R32G32_SINT, a 2-component vector of 32-bit signed integers
-        uvec4: VK_FORMAT_R32G32B32A32_UINT, a 4-component vector of 32-bit unsigned integers
-        double: VK_FORMAT_R64_SFLOAT, a double-precision (64-bit) float
-     */
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, texCoordinates);
-
-    /*attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 1;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, normal);*/
-
-    return attributeDescriptions;
+    VertexQuantization quantization;
+    if (count == 0)
+    {
+        return quantization;
+    }
+
+    glm::vec3 positionMin = vertices[0].pos;
+    glm::vec3 positionMax = vertices[0].pos;
+    glm::vec2 texCoordMin = vertices[0].texCoordinates;
+    glm::vec2 texCoordMax = vertices[0].texCoordinates;
+    for (size_t i = 1; i < count; ++i)
+    {
+        positionMin = glm::min(positionMin, vertices[i].pos);
+        positionMax = glm::max(positionMax, vertices[i].pos);
+        texCoordMin = glm::min(texCoordMin, vertices[i].texCoordinates);
+        texCoordMax = glm::max(texCoordMax, vertices[i].texCoordinates);
+    }
+
+    const auto largestExtent = [](float extent) { return extent > 0.0f ? extent : 1.0f; };
+
+    if (positionRange < 0)
+    {
+        const glm::vec3 halfExtent = (positionMax - positionMin) * 0.5f;
+        quantization.positionOffset = (positionMin + positionMax) * 0.5f;
+        quantization.positionScale = largestExtent(std::max(halfExtent.x, std::max(halfExtent.y, halfExtent.z)));
+    }
+    else if (positionRange > 0)
+    {
+        const glm::vec3 extent = positionMax - positionMin;
+        quantization.positionOffset = positionMin;
+        quantization.positionScale = largestExtent(std::max(extent.x, std::max(extent.y, extent.z)));
+    }
+
+    if (texCoordRange < 0)
+    {
+        const glm::vec2 halfExtent = (texCoordMax - texCoordMin) * 0.5f;
+        quantization.texCoordOffset = (texCoordMin + texCoordMax) * 0.5f;
+        quantization.texCoordScale = largestExtent(std::max(halfExtent.x, halfExtent.y));
+    }
+    else if (texCoordRange > 0)
+    {
+        const glm::vec2 extent = texCoordMax - texCoordMin;
+        quantization.texCoordOffset = texCoordMin;
+        quantization.texCoordScale = largestExtent(std::max(extent.x, extent.y));
+    }
+
+    return quantization;
 }
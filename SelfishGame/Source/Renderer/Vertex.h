@@ -1,23 +1,184 @@
-
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/gtc/packing.hpp>
 #include <vulkan/vulkan_core.h>
 
+// Vertex as imported, full float precision. What the GPU gets is a GpuVertex made from it, which has no normal yet.
 struct Vertex
 {
     glm::vec3 pos;
     glm::vec2 texCoordinates;
+    glm::vec3 normal;
+};
+
+// Per instance data, read from binding 1 once per instance instead of once per vertex. Same layout as Instance in cull.comp.
+struct InstanceData
+{
+    glm::vec4 positionAndScale;     // xyz world position, w uniform scale. cull.comp folds the position dequantization in.
+    uint32_t textureIndex;          // slot in the BindlessTextureTable
+    glm::vec3 texCoordDequantize;   // written by cull.comp: xy offset, z scale; std430 rounds the struct up to 16 bytes
+};
+
+/*
+ * How a mesh's vertices were quantized: the encoded position p and texture coordinate t are read by the shader as
+ * positionOffset + p * positionScale and texCoordOffset + t * texCoordScale. Identity for float layouts.
+ *
+ * Positions are relative to the cube around the mesh's bounding box, texture coordinates to the square around
+ * their bounds. A uniform scale keeps the dequantization a plain offset and scale that folds into the instance
+ * transform, at the cost of some precision along the shorter axes.
+ */
+struct VertexQuantization
+{
+    glm::vec3 positionOffset{ 0.0f };
+    float positionScale = 1.0f;
+    glm::vec2 texCoordOffset{ 0.0f };
+    float texCoordScale = 1.0f;
+
+    // positionRange and texCoordRange: the encoding covers [-1, 1] (signed) or [0, 1] (unsigned), 0 = not normalized
+    static VertexQuantization Compute(const Vertex* vertices, size_t count, int positionRange, int texCoordRange);
+};
+
+/*
+ * Attribute encodings. Each one names the type stored in the vertex, its Vulkan format and how to encode a value
+ * that was already brought into the encoding's range. Range is what VertexQuantization has to normalize to:
+ * -1 for [-1, 1], 1 for [0, 1], 0 for none.
+ */
+namespace VertexEncoding
+{
+    struct Float32x3
+    {
+        using Type = glm::vec3;
+        static constexpr VkFormat Format = VK_FORMAT_R32G32B32_SFLOAT;
+        static constexpr int Range = 0;
+        static Type Encode(const glm::vec3& value) { return value; }
+    };
+
+    struct Float32x2
+    {
+        using Type = glm::vec2;
+        static constexpr VkFormat Format = VK_FORMAT_R32G32_SFLOAT;
+        static constexpr int Range = 0;
+        static Type Encode(const glm::vec2& value) { return value; }
+    };
+
+    // Half floats are only precise around 0, positions are normalized to [-1, 1] first. w is padding.
+    struct Float16x4
+    {
+        using Type = std::array<uint16_t, 4>;
+        static constexpr VkFormat Format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        static constexpr int Range = -1;
+        static Type Encode(const glm::vec3& value)
+        {
+            return { glm::packHalf1x16(value.x), glm::packHalf1x16(value.y), glm::packHalf1x16(value.z), 0 };
+        }
+    };
+
+    struct Float16x2
+    {
+        using Type = std::array<uint16_t, 2>;
+        static constexpr VkFormat Format = VK_FORMAT_R16G16_SFLOAT;
+        static constexpr int Range = 0;
+        static Type Encode(const glm::vec2& value) { return { glm::packHalf1x16(value.x), glm::packHalf1x16(value.y) }; }
+    };
+
+    // w is padding, three 16 bit components aren't a required vertex format
+    struct Snorm16x4
+    {
+        using Type = std::array<int16_t, 4>;
+        static constexpr VkFormat Format = VK_FORMAT_R16G16B16A16_SNORM;
+        static constexpr int Range = -1;
+        static Type Encode(const glm::vec3& value)
+        {
+            return { static_cast<int16_t>(glm::packSnorm1x16(value.x)), static_cast<int16_t>(glm::packSnorm1x16(value.y)),
+                static_cast<int16_t>(glm::packSnorm1x16(value.z)), 0 };
+        }
+    };
+
+    struct Unorm16x2
+    {
+        using Type = std::array<uint16_t, 2>;
+        static constexpr VkFormat Format = VK_FORMAT_R16G16_UNORM;
+        static constexpr int Range = 1;
+        static Type Encode(const glm::vec2& value) { return { glm::packUnorm1x16(value.x), glm::packUnorm1x16(value.y) }; }
+    };
+}
+
+/*
+ * The vertex as the GPU reads it, with the attribute encodings as template parameters. The binding and attribute
+ * descriptions are generated from them at compile time, shader.vert reads every layout the same way because all
+ * formats are converted to float by the vertex fetch and the dequantization comes with the instance.
+ */
+template <typename PositionEncoding, typename TexCoordEncoding>
+struct VertexLayout
+{
+    typename PositionEncoding::Type pos;
+    typename TexCoordEncoding::Type texCoordinates;
+
+    static VertexQuantization ComputeQuantization(const Vertex* vertices, size_t count)
+    {
+        return VertexQuantization::Compute(vertices, count, PositionEncoding::Range, TexCoordEncoding::Range);
+    }
+
+    static VertexLayout Encode(const Vertex& vertex, const VertexQuantization& quantization)
+    {
+        VertexLayout encoded;
+        encoded.pos = PositionEncoding::Encode((vertex.pos - quantization.positionOffset) / quantization.positionScale);
+        encoded.texCoordinates = TexCoordEncoding::Encode((vertex.texCoordinates - quantization.texCoordOffset) / quantization.texCoordScale);
+        return encoded;
+    }
 
     /*
      * A vertex binding describes at which rate to load data from memory throughout the vertices.
      * It specifies the number of bytes between data entries and whether to move to the next data entry
      * after each vertex or after each m_instance.
      */
-    static VkVertexInputBindingDescription getBindingDescription();
+    static constexpr std::array<VkVertexInputBindingDescription, 2> getBindingDescriptions()
+    {
+        return { {
+            { 0, sizeof(VertexLayout), VK_VERTEX_INPUT_RATE_VERTEX },
+            { 1, sizeof(InstanceData), VK_VERTEX_INPUT_RATE_INSTANCE },
+        } };
+    }
+
+    /*
+        float: VK_FORMAT_R32_SFLOAT
+        vec2: VK_FORMAT_R32G32_SFLOAT
+        vec3: VK_FORMAT_R32G32B32_SFLOAT
+        vec4: VK_FORMAT_R32G32B32A32_SFLOAT
 
-    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions();
+        ivec2: VK_FORMAT_R32G32_SINT, a 2-component vector of 32-bit signed integers
+        uvec4: VK_FORMAT_R32G32B32A32_UINT, a 4-component vector of 32-bit unsigned integers
+        double: VK_FORMAT_R64_SFLOAT, a double-precision (64-bit) float
+
+        Normalized formats (SNORM, UNORM) arrive in the shader as floats in [-1, 1] or [0, 1].
+        Each entry is location, binding, format, offset.
+     */
+    static constexpr std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions()
+    {
+        return { {
+            { 0, 0, PositionEncoding::Format, offsetof(VertexLayout, pos) },
+            { 1, 0, TexCoordEncoding::Format, offsetof(VertexLayout, texCoordinates) },
+            { 2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceData, positionAndScale) },
+            { 3, 1, VK_FORMAT_R32_UINT, offsetof(InstanceData, textureIndex) },
+            { 4, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(InstanceData, texCoordDequantize) },
+        } };
+    }
 };
 
+// 20 bytes, exactly what was imported
+using FullVertex = VertexLayout<VertexEncoding::Float32x3, VertexEncoding::Float32x2>;
+// 12 bytes, positions to 1/65534 of the mesh size and texture coordinates to 1/65535 of their range
+using CompactVertex = VertexLayout<VertexEncoding::Snorm16x4, VertexEncoding::Unorm16x2>;
+
+// SELFISH_COMPACT_VERTICES, a CMake option, picks the layout of the vertex buffer
+#if SELFISH_COMPACT_VERTICES
+using GpuVertex = CompactVertex;
+#else
+using GpuVertex = FullVertex;
+#endif
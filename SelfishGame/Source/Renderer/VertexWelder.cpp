@@ -0,0 +1,232 @@
+#include "VertexWelder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <Utilities.h>
+
+#if SELFISH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    static_assert(sizeof(Vertex) == 32, "the SSE compare loads a Vertex as two 16 byte halves");
+
+    constexpr uint32_t EmptySlot = ~0u;
+
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t index; // into the unique vertices, EmptySlot if free
+    };
+
+    uint32_t HashVertex(const Vertex& vertex)
+    {
+        uint32_t words[8];
+        memcpy(words, &vertex, sizeof(words));
+
+        // Multiplicative mixing of every word, the upper half of the product depends on all bits so far
+        uint64_t hash = 0;
+        for (uint32_t word : words)
+        {
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        }
+        return static_cast<uint32_t>(hash >> 32);
+    }
+
+    struct EqualScalar
+    {
+        bool operator()(const Vertex& a, const Vertex& b) const { return memcmp(&a, &b, sizeof(Vertex)) == 0; }
+    };
+
+#if SELFISH_SSE2
+    struct EqualSse
+    {
+        bool operator()(const Vertex& a, const Vertex& b) const
+        {
+            const __m128i* aHalves = reinterpret_cast<const __m128i*>(&a);
+            const __m128i* bHalves = reinterpret_cast<const __m128i*>(&b);
+            const __m128i low = _mm_cmpeq_epi32(_mm_loadu_si128(aHalves), _mm_loadu_si128(bHalves));
+            const __m128i high = _mm_cmpeq_epi32(_mm_loadu_si128(aHalves + 1), _mm_loadu_si128(bHalves + 1));
+            return _mm_movemask_epi8(_mm_and_si128(low, high)) == 0xffff;
+        }
+    };
+#endif
+
+    struct HashVertexFunctor
+    {
+        size_t operator()(const Vertex& vertex) const { return HashVertex(vertex); }
+    };
+
+    template <typename Equal>
+    void WeldWith(const Vertex* corners, size_t cornerCount, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+    {
+        const Equal equal;
+
+        // Typical meshes have a unique vertex for every 4 to 6 corners, the table grows if that guess is too low
+        size_t capacity = 64;
+        while (capacity < cornerCount / 2)
+        {
+            capacity *= 2;
+        }
+        size_t mask = capacity - 1;
+        std::vector<Slot> table(capacity, { 0, EmptySlot });
+
+        vertices.clear();
+        vertices.reserve(cornerCount / 4);
+        indices.resize(cornerCount);
+
+        const auto grow = [&]()
+            {
+                std::vector<Slot> grown(table.size() * 2, { 0, EmptySlot });
+                const size_t grownMask = grown.size() - 1;
+                for (const Slot& slot : table)
+                {
+                    if (slot.index == EmptySlot)
+                    {
+                        continue;
+                    }
+
+                    size_t position = slot.hash & grownMask;
+                    while (grown[position].index != EmptySlot)
+                    {
+                        position = (position + 1) & grownMask;
+                    }
+                    grown[position] = slot;
+                }
+                table = std::move(grown);
+                mask = grownMask;
+            };
+
+        for (size_t i = 0; i < cornerCount; ++i)
+        {
+            const Vertex& corner = corners[i];
+            const uint32_t hash = HashVertex(corner);
+
+            size_t position = hash & mask;
+            while (true)
+            {
+                const Slot slot = table[position];
+                if (slot.index == EmptySlot)
+                {
+                    const uint32_t index = static_cast<uint32_t>(vertices.size());
+                    table[position] = { hash, index };
+                    vertices.push_back(corner);
+                    indices[i] = index;
+                    if (vertices.size() * 2 > table.size())
+                    {
+                        grow();
+                    }
+                    break;
+                }
+
+                // Different hashes can't be equal, most probes never touch the vertices
+                if (slot.hash == hash && equal(vertices[slot.index], corner))
+                {
+                    indices[i] = slot.index;
+                    break;
+                }
+
+                position = (position + 1) & mask;
+            }
+        }
+    }
+}
+
+VertexWelder::Path VertexWelder::GetBestPath()
+{
+#if SELFISH_SSE2
+    return Path::Sse; // part of every x64 CPU
+#else
+    return Path::Scalar;
+#endif
+}
+
+void VertexWelder::Weld(const Vertex* corners, size_t cornerCount, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+    Path path)
+{
+#if SELFISH_SSE2
+    if (path == Path::Sse)
+    {
+        WeldWith<EqualSse>(corners, cornerCount, vertices, indices);
+        return;
+    }
+#endif
+    (void)path;
+    WeldWith<EqualScalar>(corners, cornerCount, vertices, indices);
+}
+
+WeldingBenchmarkResult VertexWelder::RunBenchmark(uint32_t triangleCount)
+{
+    /*
+     * A wavy grid of quads, read like an importer reads it: one vertex per corner. The texture repeats every 64
+     * quads, which puts a UV seam there, and every 128 rows of quads the normal jumps, a hard edge.
+     */
+    const uint32_t side = std::max(1u, static_cast<uint32_t>(std::sqrt(triangleCount / 2.0)));
+
+    const auto makeCorner = [side](uint32_t quadX, uint32_t quadY, uint32_t dx, uint32_t dy)
+        {
+            const uint32_t x = quadX + dx;
+            const uint32_t y = quadY + dy;
+
+            Vertex corner;
+            corner.pos = { static_cast<float>(x), static_cast<float>(y), std::sin(x * 0.1f) * std::cos(y * 0.1f) };
+            corner.texCoordinates = { static_cast<float>(quadX % 64 + dx) / 64.0f, static_cast<float>(y) / static_cast<float>(side) };
+            const float tilt = static_cast<float>(quadY / 128) * 0.1f;
+            corner.normal = { 0.0f, std::sin(tilt), std::cos(tilt) };
+            return corner;
+        };
+
+    std::vector<Vertex> corners;
+    corners.reserve(size_t(side) * side * 6);
+    for (uint32_t quadY = 0; quadY < side; ++quadY)
+    {
+        for (uint32_t quadX = 0; quadX < side; ++quadX)
+        {
+            corners.push_back(makeCorner(quadX, quadY, 0, 0));
+            corners.push_back(makeCorner(quadX, quadY, 1, 0));
+            corners.push_back(makeCorner(quadX, quadY, 1, 1));
+            corners.push_back(makeCorner(quadX, quadY, 0, 0));
+            corners.push_back(makeCorner(quadX, quadY, 1, 1));
+            corners.push_back(makeCorner(quadX, quadY, 0, 1));
+        }
+    }
+
+    WeldingBenchmarkResult result;
+    result.triangleCount = static_cast<uint32_t>(corners.size() / 3);
+
+    std::vector<Vertex> reference;
+    std::vector<uint32_t> referenceIndices;
+    auto start = std::chrono::high_resolution_clock::now();
+    Weld(corners.data(), corners.size(), reference, referenceIndices, Path::Scalar);
+    result.scalarMs = MillisecondsSince(start);
+    result.uniqueVertexCount = static_cast<uint32_t>(reference.size());
+
+#if SELFISH_SSE2
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    start = std::chrono::high_resolution_clock::now();
+    Weld(corners.data(), corners.size(), vertices, indices, Path::Sse);
+    result.sseMs = MillisecondsSince(start);
+    assert(indices == referenceIndices && vertices.size() == reference.size());
+#endif
+
+    // What a welder built on the standard library would take
+    {
+        start = std::chrono::high_resolution_clock::now();
+        std::unordered_map<Vertex, uint32_t, HashVertexFunctor, EqualScalar> unique;
+        std::vector<uint32_t> mapIndices(corners.size());
+        for (size_t i = 0; i < corners.size(); ++i)
+        {
+            mapIndices[i] = unique.emplace(corners[i], static_cast<uint32_t>(unique.size())).first->second;
+        }
+        result.unorderedMapMs = MillisecondsSince(start);
+        assert(mapIndices == referenceIndices);
+    }
+
+    return result;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <Vertex.h>
+
+struct WeldingBenchmarkResult
+{
+    uint32_t triangleCount = 0;
+    uint32_t uniqueVertexCount = 0;
+    double scalarMs = 0.0;
+    double sseMs = 0.0;          // 0 if the CPU isn't x86
+    double unorderedMapMs = 0.0; // std::unordered_map with the same hash, for comparison
+};
+
+/*
+ * Merges the vertices of a triangle list that are identical, bit for bit, into one. An importer reads one vertex
+ * per triangle corner, with the attributes of that corner: the corners sharing position, texture coordinates and
+ * normal become one vertex, the ones that differ in any of them (UV seams, hard edges) stay apart.
+ *
+ * The table uses open addressing with linear probing, its capacity is a power of two kept at most half full and
+ * every slot holds the hash and the index of a unique vertex. A Vertex is 32 bytes, on x86 a candidate with the
+ * same hash is compared with two 16 byte loads and one movemask instead of eight float compares. The scalar path
+ * is the reference the SSE one has to match exactly.
+ */
+class VertexWelder
+{
+public:
+    enum class Path
+    {
+        Scalar,
+        Sse,
+    };
+
+    static Path GetBestPath();
+
+    // The unique vertices, in the order they first appear, go to vertices, indices gets one entry per corner
+    static void Weld(const Vertex* corners, size_t cornerCount, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+        Path path = GetBestPath());
+
+    // Welds a grid of triangleCount triangles with UV seams and hard edges, read one vertex per corner
+    static WeldingBenchmarkResult RunBenchmark(uint32_t triangleCount);
+};
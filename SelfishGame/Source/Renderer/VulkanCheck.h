@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <vulkan/vulkan_core.h>
+
+// Reports the failed call and stops, in every build configuration
+inline void VkCheckFailed(const char* call, VkResult result, const char* file, int line)
+{
+    fprintf(stderr, "%s(%d): %s failed with VkResult %d\n", file, line, call, static_cast<int>(result));
+    fflush(stderr);
+    std::abort();
+}
+
+/*
+ * Checks a Vulkan call that has to succeed. Unlike assert(vkCall(...) == VK_SUCCESS) the call is always made,
+ * NDEBUG only compiles out the check of assert, not its side effects.
+ */
+#define VK_CHECK(call)                                                      \
+    do                                                                      \
+    {                                                                       \
+        const VkResult vkCheckResult = (call);                              \
+        if (vkCheckResult != VK_SUCCESS)                                    \
+        {                                                                   \
+            VkCheckFailed(#call, vkCheckResult, __FILE__, __LINE__);        \
+        }                                                                   \
+    } while (false)
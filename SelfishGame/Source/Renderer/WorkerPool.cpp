@@ -0,0 +1,129 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <Profiler/Profiler.h>
+
+WorkerPool::~WorkerPool()
+{
+    Release();
+}
+
+void WorkerPool::Init(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    m_stopping = false;
+    for (uint32_t i = 0; i < threadCount; ++i)
+    {
+        m_threads.emplace_back([this, i]()
+            {
+                Profiler::SetThreadName(("worker " + std::to_string(i)).c_str());
+                WorkerLoop();
+            });
+    }
+}
+
+void WorkerPool::Release()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobAvailable.notify_all();
+
+    for (std::thread& thread : m_threads)
+    {
+        thread.join();
+    }
+    m_threads.clear();
+    m_jobs.clear();
+}
+
+void WorkerPool::Submit(std::function<void()> job)
+{
+    if (m_threads.empty())
+    {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_jobAvailable.notify_one();
+}
+
+void WorkerPool::ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& function)
+{
+    grainSize = std::max(grainSize, 1u);
+    const uint32_t chunkCount = (count + grainSize - 1) / grainSize;
+    if (chunkCount <= 1 || m_threads.empty())
+    {
+        if (count > 0)
+        {
+            function(0, count);
+        }
+        return;
+    }
+
+    std::atomic<uint32_t> nextChunk{ 0 };
+    auto work = [&]()
+    {
+        for (uint32_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++)
+        {
+            const uint32_t begin = chunk * grainSize;
+            function(begin, std::min(begin + grainSize, count));
+        }
+    };
+
+    // Helpers only run the loop above, wait for all of them to leave it before the stack goes away
+    const uint32_t helperCount = std::min(GetThreadCount(), chunkCount - 1);
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    uint32_t helpersDone = 0;
+
+    for (uint32_t i = 0; i < helperCount; ++i)
+    {
+        Submit([&]()
+            {
+                work();
+
+                std::lock_guard<std::mutex> lock(doneMutex);
+                ++helpersDone;
+                doneCondition.notify_one();
+            });
+    }
+
+    work();
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&]() { return helpersDone == helperCount; });
+}
+
+void WorkerPool::WorkerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobAvailable.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping && m_jobs.empty())
+            {
+                return;
+            }
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        job();
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of worker threads that pull jobs from one queue.
+ *
+ * ParallelFor splits a range into chunks that the workers and the calling thread grab one by one,
+ * and only returns once every chunk is done, so the function can safely reference the caller's stack.
+ * Don't call ParallelFor from inside a job: the helpers would queue up behind the waiting workers.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool() = default;
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // threadCount of 0 means one thread less than there are hardware threads, the calling thread works too
+    void Init(uint32_t threadCount = 0);
+    void Release();
+
+    void Submit(std::function<void()> job);
+
+    // Calls function(begin, end) for consecutive chunks of at most grainSize elements covering [0, count)
+    void ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& function);
+
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_jobAvailable;
+    bool m_stopping = false;
+};
@@ -0,0 +1,541 @@
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <Utilities.h>
+
+#if SELFISH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // One RGBA texel or direction, channels in 0..255
+    struct Float4
+    {
+#if SELFISH_SSE2
+        __m128 v;
+
+        static Float4 Set(float r, float g, float b, float a) { return { _mm_setr_ps(r, g, b, a) }; }
+        static Float4 Splat(float value) { return { _mm_set1_ps(value) }; }
+
+        static Float4 Load(const uint8_t* rgba)
+        {
+            int32_t packed;
+            memcpy(&packed, rgba, sizeof(packed));
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i bytes = _mm_cvtsi32_si128(packed);
+            const __m128i words = _mm_unpacklo_epi8(bytes, zero);
+            return { _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)) };
+        }
+
+        float operator[](int i) const
+        {
+            alignas(16) float values[4];
+            _mm_store_ps(values, v);
+            return values[i];
+        }
+
+        Float4 operator+(const Float4& other) const { return { _mm_add_ps(v, other.v) }; }
+        Float4 operator-(const Float4& other) const { return { _mm_sub_ps(v, other.v) }; }
+        Float4 operator*(const Float4& other) const { return { _mm_mul_ps(v, other.v) }; }
+        Float4 operator*(float scale) const { return { _mm_mul_ps(v, _mm_set1_ps(scale)) }; }
+
+        friend Float4 Min(const Float4& a, const Float4& b) { return { _mm_min_ps(a.v, b.v) }; }
+        friend Float4 Max(const Float4& a, const Float4& b) { return { _mm_max_ps(a.v, b.v) }; }
+
+        friend float Dot(const Float4& a, const Float4& b)
+        {
+            const __m128 product = _mm_mul_ps(a.v, b.v);
+            const __m128 pairs = _mm_add_ps(product, _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 3, 0, 1)));
+            return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 0, 3, 2))));
+        }
+#else
+        float c[4];
+
+        static Float4 Set(float r, float g, float b, float a) { return { { r, g, b, a } }; }
+        static Float4 Splat(float value) { return { { value, value, value, value } }; }
+        static Float4 Load(const uint8_t* rgba) { return { { float(rgba[0]), float(rgba[1]), float(rgba[2]), float(rgba[3]) } }; }
+
+        float operator[](int i) const { return c[i]; }
+
+        Float4 operator+(const Float4& o) const { return { { c[0] + o.c[0], c[1] + o.c[1], c[2] + o.c[2], c[3] + o.c[3] } }; }
+        Float4 operator-(const Float4& o) const { return { { c[0] - o.c[0], c[1] - o.c[1], c[2] - o.c[2], c[3] - o.c[3] } }; }
+        Float4 operator*(const Float4& o) const { return { { c[0] * o.c[0], c[1] * o.c[1], c[2] * o.c[2], c[3] * o.c[3] } }; }
+        Float4 operator*(float s) const { return { { c[0] * s, c[1] * s, c[2] * s, c[3] * s } }; }
+
+        friend Float4 Min(const Float4& a, const Float4& b)
+        {
+            return { { std::min(a.c[0], b.c[0]), std::min(a.c[1], b.c[1]), std::min(a.c[2], b.c[2]), std::min(a.c[3], b.c[3]) } };
+        }
+        friend Float4 Max(const Float4& a, const Float4& b)
+        {
+            return { { std::max(a.c[0], b.c[0]), std::max(a.c[1], b.c[1]), std::max(a.c[2], b.c[2]), std::max(a.c[3], b.c[3]) } };
+        }
+        friend float Dot(const Float4& a, const Float4& b) { return a.c[0] * b.c[0] + a.c[1] * b.c[1] + a.c[2] * b.c[2] + a.c[3] * b.c[3]; }
+#endif
+
+        Float4 Clamped() const { return Min(Max(*this, Splat(0.0f)), Splat(255.0f)); }
+    };
+
+    constexpr int TexelCount = 16;
+
+    // Endpoints at the extremes of the texels projected onto the principal axis
+    void FindEndpoints(const Float4* texels, Float4& e0, Float4& e1)
+    {
+        Float4 mean = Float4::Splat(0.0f);
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            mean = mean + texels[i];
+        }
+        mean = mean * (1.0f / TexelCount);
+
+        // Covariance rows, the matrix is symmetric
+        Float4 covariance[4] = { Float4::Splat(0.0f), Float4::Splat(0.0f), Float4::Splat(0.0f), Float4::Splat(0.0f) };
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            const Float4 d = texels[i] - mean;
+            for (int row = 0; row < 4; ++row)
+            {
+                covariance[row] = covariance[row] + d * d[row];
+            }
+        }
+
+        // Power iteration, starting from the channel with the largest variance
+        int largest = 0;
+        for (int c = 1; c < 4; ++c)
+        {
+            if (covariance[c][c] > covariance[largest][largest])
+            {
+                largest = c;
+            }
+        }
+        Float4 axis = covariance[largest];
+
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            const Float4 next = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2] + covariance[3] * axis[3];
+            const float length = std::sqrt(Dot(next, next));
+            if (length < 1e-6f)
+            {
+                break;
+            }
+            axis = next * (1.0f / length);
+        }
+
+        const float axisLength = std::sqrt(Dot(axis, axis));
+        if (axisLength < 1e-6f)
+        {
+            // Flat block
+            e0 = mean;
+            e1 = mean;
+            return;
+        }
+        axis = axis * (1.0f / axisLength);
+
+        float minT = 0.0f;
+        float maxT = 0.0f;
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            const float t = Dot(texels[i] - mean, axis);
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        e0 = (mean + axis * maxT).Clamped();
+        e1 = (mean + axis * minT).Clamped();
+    }
+
+    // Texel i is approximated by e0 * (1 - weights[i]) + e1 * weights[i], solves for the best e0 and e1
+    bool FitEndpoints(const Float4* texels, const float* weights, Float4& e0, Float4& e1)
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        Float4 ax = Float4::Splat(0.0f);
+        Float4 bx = Float4::Splat(0.0f);
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            const float b = weights[i];
+            const float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            ax = ax + texels[i] * a;
+            bx = bx + texels[i] * b;
+        }
+
+        const float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+        {
+            return false; // every texel uses the same index
+        }
+
+        const float inverse = 1.0f / determinant;
+        e0 = ((ax * bb - bx * ab) * inverse).Clamped();
+        e1 = ((bx * aa - ax * ab) * inverse).Clamped();
+        return true;
+    }
+
+    // Nearest palette entry of every texel, returns the total squared error
+    float SelectIndices(const Float4* texels, const Float4* palette, int paletteSize, uint8_t* indices)
+    {
+        float totalError = 0.0f;
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            float bestError = 1e30f;
+            for (int p = 0; p < paletteSize; ++p)
+            {
+                const Float4 d = texels[i] - palette[p];
+                const float error = Dot(d, d);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    indices[i] = static_cast<uint8_t>(p);
+                }
+            }
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+    ///////////////////////////////////////// BC1 /////////////////////////////////////////
+
+    uint16_t To565(const Float4& color)
+    {
+        const uint32_t r = static_cast<uint32_t>(color[0] * (31.0f / 255.0f) + 0.5f);
+        const uint32_t g = static_cast<uint32_t>(color[1] * (63.0f / 255.0f) + 0.5f);
+        const uint32_t b = static_cast<uint32_t>(color[2] * (31.0f / 255.0f) + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    Float4 From565(uint16_t color)
+    {
+        const uint32_t r = (color >> 11) & 31;
+        const uint32_t g = (color >> 5) & 63;
+        const uint32_t b = color & 31;
+        return Float4::Set(float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2)), 0.0f);
+    }
+
+    struct ColorBlock
+    {
+        uint16_t color0;
+        uint16_t color1;
+        uint8_t indices[TexelCount];
+        float error;
+    };
+
+    // Four color mode only, which is also how BC3 decodes its color block
+    ColorBlock EncodeColorEndpoints(const Float4* texels, Float4 e0, Float4 e1)
+    {
+        ColorBlock block{};
+        block.color0 = To565(e0);
+        block.color1 = To565(e1);
+        if (block.color0 < block.color1)
+        {
+            std::swap(block.color0, block.color1);
+        }
+
+        const Float4 c0 = From565(block.color0);
+        const Float4 c1 = From565(block.color1);
+        if (block.color0 == block.color1)
+        {
+            // Three color mode, index 0 is the only color
+            const Float4 d = c0;
+            block.error = SelectIndices(texels, &d, 1, block.indices);
+            return block;
+        }
+
+        const Float4 palette[4] = { c0, c1, c0 * (2.0f / 3.0f) + c1 * (1.0f / 3.0f), c0 * (1.0f / 3.0f) + c1 * (2.0f / 3.0f) };
+        block.error = SelectIndices(texels, palette, 4, block.indices);
+        return block;
+    }
+
+    void CompressColorBlock(const uint8_t* rgba, uint8_t* out)
+    {
+        // Alpha doesn't take part in the fit
+        const Float4 rgbMask = Float4::Set(1.0f, 1.0f, 1.0f, 0.0f);
+        Float4 texels[TexelCount];
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            texels[i] = Float4::Load(rgba + i * 4) * rgbMask;
+        }
+
+        Float4 e0, e1;
+        FindEndpoints(texels, e0, e1);
+        ColorBlock best = EncodeColorEndpoints(texels, e0, e1);
+
+        // Weight of color1 for each index of the four color palette
+        static constexpr float IndexWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        float weights[TexelCount];
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            weights[i] = IndexWeights[best.indices[i]];
+        }
+
+        if (best.color0 != best.color1 && FitEndpoints(texels, weights, e0, e1))
+        {
+            const ColorBlock refined = EncodeColorEndpoints(texels, e0, e1);
+            if (refined.error < best.error)
+            {
+                best = refined;
+            }
+        }
+
+        uint32_t indexBits = 0;
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            indexBits |= static_cast<uint32_t>(best.indices[i]) << (i * 2);
+        }
+
+        memcpy(out, &best.color0, 2);
+        memcpy(out + 2, &best.color1, 2);
+        memcpy(out + 4, &indexBits, 4);
+    }
+
+    ///////////////////////////////////////// BC3 /////////////////////////////////////////
+
+    void CompressAlphaBlock(const uint8_t* rgba, uint8_t* out)
+    {
+        uint8_t minAlpha = 255;
+        uint8_t maxAlpha = 0;
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            minAlpha = std::min(minAlpha, rgba[i * 4 + 3]);
+            maxAlpha = std::max(maxAlpha, rgba[i * 4 + 3]);
+        }
+
+        out[0] = maxAlpha;
+        out[1] = minAlpha;
+
+        // Eight alpha mode (alpha0 > alpha1): both endpoints and six interpolated values between them
+        int palette[8] = { maxAlpha, minAlpha };
+        for (int i = 2; i < 8; ++i)
+        {
+            palette[i] = ((8 - i) * maxAlpha + (i - 1) * minAlpha) / 7;
+        }
+
+        uint64_t indexBits = 0;
+        if (maxAlpha != minAlpha)
+        {
+            for (int i = 0; i < TexelCount; ++i)
+            {
+                const int alpha = rgba[i * 4 + 3];
+                uint64_t bestIndex = 0;
+                int bestError = 256;
+                for (int p = 0; p < 8; ++p)
+                {
+                    const int error = std::abs(alpha - palette[p]);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        bestIndex = static_cast<uint64_t>(p);
+                    }
+                }
+                indexBits |= bestIndex << (i * 3);
+            }
+        }
+
+        for (int i = 0; i < 6; ++i)
+        {
+            out[2 + i] = static_cast<uint8_t>(indexBits >> (i * 8));
+        }
+    }
+
+    ///////////////////////////////////////// BC7 /////////////////////////////////////////
+
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(uint8_t* out) : m_out(out) { memset(m_out, 0, 16); }
+
+        void Write(uint32_t value, int bitCount)
+        {
+            for (int i = 0; i < bitCount; ++i, ++m_position)
+            {
+                m_out[m_position / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (m_position % 8));
+            }
+        }
+
+    private:
+        uint8_t* m_out;
+        int m_position = 0;
+    };
+
+    struct Mode6Endpoint
+    {
+        uint32_t channels[4]; // 7 bits each
+        uint32_t pBit;
+
+        Float4 Expand() const
+        {
+            return Float4::Set(float((channels[0] << 1) | pBit), float((channels[1] << 1) | pBit),
+                float((channels[2] << 1) | pBit), float((channels[3] << 1) | pBit));
+        }
+    };
+
+    // The p-bit is shared by all four channels, take the one that rounds them best
+    Mode6Endpoint QuantizeMode6(const Float4& color)
+    {
+        Mode6Endpoint best{};
+        float bestError = 1e30f;
+        for (uint32_t pBit = 0; pBit < 2; ++pBit)
+        {
+            Mode6Endpoint candidate{};
+            candidate.pBit = pBit;
+            float error = 0.0f;
+            for (int c = 0; c < 4; ++c)
+            {
+                const float quantized = std::round((color[c] - float(pBit)) * 0.5f);
+                candidate.channels[c] = static_cast<uint32_t>(std::clamp(quantized, 0.0f, 127.0f));
+                const float d = float((candidate.channels[c] << 1) | pBit) - color[c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    constexpr int Mode6Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    struct Mode6Block
+    {
+        Mode6Endpoint e0;
+        Mode6Endpoint e1;
+        uint8_t indices[TexelCount];
+        float error;
+    };
+
+    Mode6Block EncodeMode6Endpoints(const Float4* texels, const Float4& e0, const Float4& e1)
+    {
+        Mode6Block block{};
+        block.e0 = QuantizeMode6(e0);
+        block.e1 = QuantizeMode6(e1);
+
+        // Same interpolation as the decoder, in integers
+        const Float4 c0 = block.e0.Expand();
+        const Float4 c1 = block.e1.Expand();
+        Float4 palette[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            const Float4 mixed = c0 * float(64 - Mode6Weights[i]) + c1 * float(Mode6Weights[i]) + Float4::Splat(32.0f);
+            palette[i] = Float4::Set(std::floor(mixed[0] / 64.0f), std::floor(mixed[1] / 64.0f),
+                std::floor(mixed[2] / 64.0f), std::floor(mixed[3] / 64.0f));
+        }
+
+        block.error = SelectIndices(texels, palette, 16, block.indices);
+        return block;
+    }
+
+    void CompressBC7Block(const uint8_t* rgba, uint8_t* out)
+    {
+        Float4 texels[TexelCount];
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            texels[i] = Float4::Load(rgba + i * 4);
+        }
+
+        Float4 e0, e1;
+        FindEndpoints(texels, e0, e1);
+        Mode6Block best = EncodeMode6Endpoints(texels, e0, e1);
+
+        float weights[TexelCount];
+        for (int i = 0; i < TexelCount; ++i)
+        {
+            weights[i] = Mode6Weights[best.indices[i]] / 64.0f;
+        }
+
+        if (FitEndpoints(texels, weights, e0, e1))
+        {
+            const Mode6Block refined = EncodeMode6Endpoints(texels, e0, e1);
+            if (refined.error < best.error)
+            {
+                best = refined;
+            }
+        }
+
+        // The anchor texel's index has an implicit 0 as its top bit, swap the endpoints if it would need a 1
+        if (best.indices[0] & 8)
+        {
+            std::swap(best.e0, best.e1);
+            for (uint8_t& index : best.indices)
+            {
+                index = static_cast<uint8_t>(15 - index);
+            }
+        }
+
+        BitWriter writer(out);
+        writer.Write(1u << 6, 7); // mode 6
+        for (int c = 0; c < 4; ++c)
+        {
+            writer.Write(best.e0.channels[c], 7);
+            writer.Write(best.e1.channels[c], 7);
+        }
+        writer.Write(best.e0.pBit, 1);
+        writer.Write(best.e1.pBit, 1);
+
+        writer.Write(best.indices[0], 3);
+        for (int i = 1; i < TexelCount; ++i)
+        {
+            writer.Write(best.indices[i], 4);
+        }
+    }
+}
+
+size_t GetBlockSize(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+void CompressBlock(BlockFormat format, const uint8_t* texels, uint8_t* block)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        CompressColorBlock(texels, block);
+        break;
+    case BlockFormat::BC3:
+        CompressAlphaBlock(texels, block);
+        CompressColorBlock(texels, block + 8);
+        break;
+    case BlockFormat::BC7:
+        CompressBC7Block(texels, block);
+        break;
+    }
+}
+
+std::vector<uint8_t> CompressImage(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+    assert(width > 0 && height > 0);
+
+    const uint32_t blocksX = (width + 3) / 4;
+    const uint32_t blocksY = (height + 3) / 4;
+    const size_t blockSize = GetBlockSize(format);
+
+    std::vector<uint8_t> result(static_cast<size_t>(blocksX) * blocksY * blockSize);
+
+    uint8_t texels[TexelCount * 4];
+    for (uint32_t by = 0; by < blocksY; ++by)
+    {
+        for (uint32_t bx = 0; bx < blocksX; ++bx)
+        {
+            for (uint32_t y = 0; y < 4; ++y)
+            {
+                const uint32_t sourceY = std::min(by * 4 + y, height - 1);
+                for (uint32_t x = 0; x < 4; ++x)
+                {
+                    const uint32_t sourceX = std::min(bx * 4 + x, width - 1);
+                    memcpy(&texels[(y * 4 + x) * 4], &rgba[(static_cast<size_t>(sourceY) * width + sourceX) * 4], 4);
+                }
+            }
+
+            CompressBlock(format, texels, &result[(static_cast<size_t>(by) * blocksX + bx) * blockSize]);
+        }
+    }
+
+    return result;
+}
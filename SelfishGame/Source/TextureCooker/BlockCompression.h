@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * BC1, BC3 and BC7 encoders for 4x4 blocks of RGBA8 texels.
+ *
+ * Endpoints come from the principal axis of the block's colors, refined once with a least squares fit to the
+ * chosen indices. BC7 only uses mode 6 (one subset, RGBA 7.7.7.7 endpoints with a p-bit, 4 bit indices): not the
+ * best BC7 can do, but it beats BC1/BC3 on every block and encodes fast. The per texel math runs on one RGBA
+ * vector per texel, SSE2 where available.
+ */
+enum class BlockFormat
+{
+    BC1, // RGB, 8 bytes per block, alpha is ignored
+    BC3, // BC1 color + interpolated alpha, 16 bytes per block
+    BC7, // RGBA, 16 bytes per block
+};
+
+size_t GetBlockSize(BlockFormat format);
+
+// texels are 16 RGBA8 values in row order, block is GetBlockSize bytes
+void CompressBlock(BlockFormat format, const uint8_t* texels, uint8_t* block);
+
+// Blocks in row order, edge blocks of sizes that aren't a multiple of 4 repeat the last row and column
+std::vector<uint8_t> CompressImage(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height);
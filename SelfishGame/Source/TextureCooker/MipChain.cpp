@@ -0,0 +1,183 @@
+#include "MipChain.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr float Pi = 3.14159265358979f;
+    constexpr int LanczosRadius = 3;
+
+    float Sinc(float x)
+    {
+        if (std::fabs(x) < 1e-5f)
+        {
+            return 1.0f;
+        }
+        return std::sin(Pi * x) / (Pi * x);
+    }
+
+    float Lanczos(float x)
+    {
+        return std::fabs(x) < LanczosRadius ? Sinc(x) * Sinc(x / LanczosRadius) : 0.0f;
+    }
+
+    int Address(int coordinate, int size, MipAddressMode addressMode)
+    {
+        if (addressMode == MipAddressMode::Clamp)
+        {
+            return std::clamp(coordinate, 0, size - 1);
+        }
+        return ((coordinate % size) + size) % size;
+    }
+
+    struct Tap
+    {
+        int source;
+        float weight;
+    };
+
+    // Taps of every destination texel along one axis, normalized
+    std::vector<std::vector<Tap>> ComputeTaps(uint32_t sourceSize, uint32_t destinationSize, MipAddressMode addressMode)
+    {
+        std::vector<std::vector<Tap>> taps(destinationSize);
+        if (sourceSize == destinationSize)
+        {
+            for (uint32_t i = 0; i < destinationSize; ++i)
+            {
+                taps[i].push_back({ static_cast<int>(i), 1.0f });
+            }
+            return taps;
+        }
+
+        // The kernel is stretched by the scale to stay a low pass filter for the destination
+        const float scale = static_cast<float>(sourceSize) / static_cast<float>(destinationSize);
+        const float support = LanczosRadius * scale;
+
+        for (uint32_t i = 0; i < destinationSize; ++i)
+        {
+            const float center = (static_cast<float>(i) + 0.5f) * scale;
+            const int first = static_cast<int>(std::floor(center - support));
+            const int last = static_cast<int>(std::ceil(center + support));
+
+            float sum = 0.0f;
+            for (int s = first; s <= last; ++s)
+            {
+                const float weight = Lanczos((static_cast<float>(s) + 0.5f - center) / scale);
+                if (weight != 0.0f)
+                {
+                    taps[i].push_back({ Address(s, static_cast<int>(sourceSize), addressMode), weight });
+                    sum += weight;
+                }
+            }
+
+            for (Tap& tap : taps[i])
+            {
+                tap.weight /= sum;
+            }
+        }
+        return taps;
+    }
+
+    float SrgbToLinear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float LinearToSrgb(float value)
+    {
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    }
+}
+
+FloatImage ToFloatImage(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb)
+{
+    FloatImage image;
+    image.width = width;
+    image.height = height;
+    image.texels.resize(static_cast<size_t>(width) * height * 4);
+
+    for (size_t i = 0; i < image.texels.size(); ++i)
+    {
+        const float value = rgba[i] / 255.0f;
+        const bool isColor = (i % 4) != 3;
+        image.texels[i] = srgb && isColor ? SrgbToLinear(value) : value;
+    }
+    return image;
+}
+
+std::vector<uint8_t> ToRgba8(const FloatImage& image, bool srgb)
+{
+    std::vector<uint8_t> rgba(image.texels.size());
+    for (size_t i = 0; i < rgba.size(); ++i)
+    {
+        const float value = std::clamp(image.texels[i], 0.0f, 1.0f);
+        const bool isColor = (i % 4) != 3;
+        rgba[i] = static_cast<uint8_t>((srgb && isColor ? LinearToSrgb(value) : value) * 255.0f + 0.5f);
+    }
+    return rgba;
+}
+
+FloatImage Downsample(const FloatImage& image, MipAddressMode addressMode)
+{
+    const uint32_t width = std::max(image.width / 2, 1u);
+    const uint32_t height = std::max(image.height / 2, 1u);
+    const std::vector<std::vector<Tap>> tapsX = ComputeTaps(image.width, width, addressMode);
+    const std::vector<std::vector<Tap>> tapsY = ComputeTaps(image.height, height, addressMode);
+
+    // Horizontal pass: width x source height
+    std::vector<float> horizontal(static_cast<size_t>(width) * image.height * 4, 0.0f);
+    for (uint32_t y = 0; y < image.height; ++y)
+    {
+        const float* sourceRow = &image.texels[static_cast<size_t>(y) * image.width * 4];
+        float* row = &horizontal[static_cast<size_t>(y) * width * 4];
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            for (const Tap& tap : tapsX[x])
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    row[x * 4 + c] += sourceRow[tap.source * 4 + c] * tap.weight;
+                }
+            }
+        }
+    }
+
+    // Vertical pass
+    FloatImage result;
+    result.width = width;
+    result.height = height;
+    result.texels.assign(static_cast<size_t>(width) * height * 4, 0.0f);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        float* row = &result.texels[static_cast<size_t>(y) * width * 4];
+        for (const Tap& tap : tapsY[y])
+        {
+            const float* sourceRow = &horizontal[static_cast<size_t>(tap.source) * width * 4];
+            for (uint32_t i = 0; i < width * 4; ++i)
+            {
+                row[i] += sourceRow[i] * tap.weight;
+            }
+        }
+    }
+
+    // Negative lobes overshoot at sharp edges
+    for (float& value : result.texels)
+    {
+        value = std::clamp(value, 0.0f, 1.0f);
+    }
+
+    return result;
+}
+
+std::vector<FloatImage> BuildMipChain(FloatImage image, MipAddressMode addressMode)
+{
+    std::vector<FloatImage> levels;
+    levels.push_back(std::move(image));
+
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        levels.push_back(Downsample(levels.back(), addressMode));
+    }
+    return levels;
+}
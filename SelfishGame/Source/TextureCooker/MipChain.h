@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// RGBA, 4 floats per texel, color channels in linear space
+struct FloatImage
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> texels;
+};
+
+enum class MipAddressMode
+{
+    Wrap,  // tiling textures, the filter reads across the opposite edge
+    Clamp,
+};
+
+FloatImage ToFloatImage(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb);
+std::vector<uint8_t> ToRgba8(const FloatImage& image, bool srgb);
+
+/*
+ * Halves the image in both dimensions (a side of 1 stays 1) with a separable Lanczos3 filter. Much sharper than
+ * the 2x2 box of a blit at the cost of some ringing, which is clamped away. Alpha is filtered like the colors.
+ */
+FloatImage Downsample(const FloatImage& image, MipAddressMode addressMode);
+
+// levels[0] is the source image, the last level is 1x1
+std::vector<FloatImage> BuildMipChain(FloatImage image, MipAddressMode addressMode);
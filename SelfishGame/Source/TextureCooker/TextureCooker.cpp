@@ -0,0 +1,119 @@
+#include "BlockCompression.h"
+#include "MipChain.h"
+
+#include <TextureContainer.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stb_image/stb_image.h>
+#include <string>
+
+/*
+ * TextureCooker <input image> <output.stex> [--format bc1|bc3|bc7] [--linear] [--clamp]
+ *
+ * Converts an image stb_image can read into a block compressed container with the full mip chain, see
+ * TextureContainer. The default is BC7 in sRGB, --linear is for data that isn't color (normal maps, masks),
+ * --clamp for textures that don't tile.
+ */
+namespace
+{
+    VkFormat GetVulkanFormat(BlockFormat format, bool srgb)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case BlockFormat::BC3: return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+        case BlockFormat::BC7: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+        }
+        return VK_FORMAT_UNDEFINED;
+    }
+
+    bool ParseBlockFormat(const char* name, BlockFormat& format)
+    {
+        if (strcmp(name, "bc1") == 0) { format = BlockFormat::BC1; return true; }
+        if (strcmp(name, "bc3") == 0) { format = BlockFormat::BC3; return true; }
+        if (strcmp(name, "bc7") == 0) { format = BlockFormat::BC7; return true; }
+        return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: TextureCooker <input image> <output.stex> [--format bc1|bc3|bc7] [--linear] [--clamp]" << std::endl;
+        return 1;
+    }
+
+    const std::string inputPath = argv[1];
+    const std::string outputPath = argv[2];
+
+    BlockFormat format = BlockFormat::BC7;
+    bool srgb = true;
+    MipAddressMode addressMode = MipAddressMode::Wrap;
+
+    for (int i = 3; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            if (!ParseBlockFormat(argv[++i], format))
+            {
+                std::cout << "Unknown format " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--linear") == 0)
+        {
+            srgb = false;
+        }
+        else if (strcmp(argv[i], "--clamp") == 0)
+        {
+            addressMode = MipAddressMode::Clamp;
+        }
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load(inputPath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        std::cout << "Failed to read " << inputPath << ": " << stbi_failure_reason() << std::endl;
+        return 1;
+    }
+
+    const std::vector<FloatImage> mips = BuildMipChain(
+        ToFloatImage(pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), srgb), addressMode);
+    stbi_image_free(pixels);
+
+    std::vector<std::vector<uint8_t>> levels;
+    size_t uncompressedSize = 0;
+    size_t compressedSize = 0;
+    for (const FloatImage& mip : mips)
+    {
+        const std::vector<uint8_t> rgba = ToRgba8(mip, srgb);
+        levels.push_back(CompressImage(format, rgba.data(), mip.width, mip.height));
+
+        uncompressedSize += rgba.size();
+        compressedSize += levels.back().size();
+    }
+
+    if (!TextureContainer::Write(outputPath, GetVulkanFormat(format, srgb), static_cast<uint32_t>(width),
+        static_cast<uint32_t>(height), levels))
+    {
+        std::cout << "Failed to write " << outputPath << std::endl;
+        return 1;
+    }
+
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << inputPath << " -> " << outputPath << ": " << width << "x" << height << ", " << levels.size()
+        << " mips, " << compressedSize << " bytes (" << uncompressedSize << " as RGBA8) in "
+        << std::chrono::duration<double, std::milli>(endTime - startTime).count() << " ms" << std::endl;
+
+    return 0;
+}